@@ -588,7 +588,7 @@ public:
      *                  initialize this.
      */
     completion_future(const completion_future& other)
-        : __amp_future(other.__amp_future), __thread_then(other.__thread_then) {}
+        : __amp_future(other.__amp_future) {}
 
     /**
      * Move constructor. Move constructs a new completion_future object that
@@ -600,7 +600,7 @@ public:
      *                  completion_future
      */
     completion_future(completion_future&& other)
-        : __amp_future(std::move(other.__amp_future)), __thread_then(other.__thread_then) {}
+        : __amp_future(std::move(other.__amp_future)) {}
 
     /**
      * Copy assignment. Copy assigns the contents of other to this. This method
@@ -613,7 +613,6 @@ public:
     completion_future& operator=(const completion_future& other) {
         if (this != &other) {
            __amp_future = other.__amp_future;
-           __thread_then = other.__thread_then;
         }
         return (*this);
     }
@@ -630,7 +629,6 @@ public:
     completion_future& operator=(completion_future&& other) {
         if (this != &other) {
             __amp_future = std::move(other.__amp_future);
-            __thread_then = other.__thread_then;
         }
         return (*this);
     }
@@ -699,6 +697,10 @@ public:
      * executed upon completion of the asynchronous operation associated with
      * this completion_future object. The completion callback func should have
      * an operator() that is valid when invoked with non arguments, i.e., "func()".
+     *
+     * A copy of func is executed by the continuation executor of the runtime,
+     * on one of a few threads shared by all callbacks, so it should not block
+     * for long. Nothing is executed if this completion_future is invalid.
      */
     // FIXME: notice we removed const from the signature here
     //        the original signature in the specification should be
@@ -707,29 +709,13 @@ public:
     template<typename functor>
     void then(const functor & func) {
 #if __KALMAR_ACCELERATOR__ != 1
-      // could only assign once
-      if (__thread_then == nullptr) {
-        // spawn a new thread to wait on the future and then execute the callback functor
-        __thread_then = new std::thread([&]() restrict(cpu) {
-          this->wait();
-          if(this->valid())
-            func();
-        });
-      }
+      if (this->valid())
+        Kalmar::CLAMP::ScheduleContinuation(__amp_future, nullptr, [func]() restrict(cpu) { func(); });
 #endif
     }
 
-    ~completion_future() {
-      if (__thread_then != nullptr) {
-        __thread_then->join();
-      }
-      delete __thread_then;
-      __thread_then = nullptr;
-    }
-
 private:
     std::shared_future<void> __amp_future;
-    std::thread* __thread_then = nullptr;
 
     completion_future(const std::shared_future<void> &__future)
         : __amp_future(__future) {}
@@ -1108,13 +1094,42 @@ void bar_wrapper(Ker *f, Ti *t)
     (*f)(*t);
 }
 
+#if KALMAR_CPU_FIBER
+template <typename Ker, typename Ti>
+void fiber_wrapper(void *p)
+{
+    Kalmar::CPUFiber *self = static_cast<Kalmar::CPUFiber*>(p);
+    bar_wrapper<Ker, Ti>(static_cast<Ker*>(const_cast<void*>(self->kernel)), static_cast<Ti*>(self->index));
+    // like uc_link, continue with the previous context once finished
+    Kalmar::CPUFiber::exit(self[-1]);
+}
+#endif
+
+/// Work-items of a tile run as coroutines on their own stacks, numbered from 1,
+/// context 0 is the one executing the tile. They are switched either with
+/// ucontext or, if Kalmar::CLAMP::use_cpu_tile_fiber(), with Kalmar::CPUFiber.
 struct barrier_t {
     std::unique_ptr<ucontext_t[]> ctx;
+    std::unique_ptr<Kalmar::CPUFiber[]> fib;
     int idx;
-    barrier_t (int a) :
-        ctx(new ucontext_t[a + 1]) {}
+    barrier_t (int a) : ctx(), fib() {
+#if KALMAR_CPU_FIBER
+        if (Kalmar::CLAMP::use_cpu_tile_fiber())
+            fib.reset(new Kalmar::CPUFiber[a + 1]);
+        else
+#endif
+            ctx.reset(new ucontext_t[a + 1]);
+    }
     template <typename Ti, typename Ker>
     void setctx(int x, char *stack, Ker& f, Ti* tidx, int S) {
+#if KALMAR_CPU_FIBER
+        if (fib) {
+            fib[x].kernel = &f;
+            fib[x].index = tidx;
+            fib[x].make(stack, S, fiber_wrapper<Ker, Ti>);
+            return;
+        }
+#endif
         getcontext(&ctx[x]);
         ctx[x].uc_stack.ss_sp = stack;
         ctx[x].uc_stack.ss_size = S;
@@ -1122,11 +1137,17 @@ struct barrier_t {
         makecontext(&ctx[x], (void (*)(void))bar_wrapper<Ker, Ti>, 2, &f, tidx);
     }
     void swap(int a, int b) {
+#if KALMAR_CPU_FIBER
+        if (fib) {
+            Kalmar::CPUFiber::swap(fib[a], fib[b]);
+            return;
+        }
+#endif
         swapcontext(&ctx[a], &ctx[b]);
     }
     void wait() {
         --idx;
-        swapcontext(&ctx[idx + 1], &ctx[idx]);
+        swap(idx + 1, idx);
     }
 };
 #endif
@@ -1427,7 +1448,7 @@ private:
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
     template<typename K, int D1_, int D2_, int D3_> friend
-        void partitioned_task_tile(K const&, tiled_extent<D1_, D2_, D3_> const&, int);
+        void partitioned_task_tile(K const&, tiled_extent<D1_, D2_, D3_> const&, size_t, size_t);
 #endif
 };
 
@@ -1561,7 +1582,7 @@ private:
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
     template<typename K, int D> friend
-        void partitioned_task_tile(K const&, tiled_extent<D> const&, int);
+        void partitioned_task_tile(K const&, tiled_extent<D> const&, size_t, size_t);
 #endif
 };
 
@@ -1698,7 +1719,7 @@ private:
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
     template<typename K, int D1_, int D2_> friend
-        void partitioned_task_tile(K const&, tiled_extent<D1_, D2_> const&, int);
+        void partitioned_task_tile(K const&, tiled_extent<D1_, D2_> const&, size_t, size_t);
 #endif
 };
 
@@ -2035,56 +2056,50 @@ public:
 };
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
-#define SSIZE 1024 * 10
-template <int N, typename Kernel,  int K>
-struct cpu_helper
-{
-    static inline void call(const Kernel& k, index<K>& idx, const extent<K>& ext) restrict(amp,cpu) {
-        int i;
-        for (i = 0; i < ext[N]; ++i) {
-            idx[N] = i;
-            cpu_helper<N + 1, Kernel, K>::call(k, idx, ext);
-        }
-    }
-};
-template <typename Kernel, int K>
-struct cpu_helper<K, Kernel, K>
-{
-    static inline void call(const Kernel& k, const index<K>& idx, const extent<K>& ext) restrict(amp,cpu) {
-        (const_cast<Kernel&>(k))(idx);
-    }
-};
-
+/// The compute domain of a CPU kernel is linearized in row-major order into
+/// work units, which are work-items for flat kernels and tiles for tiled
+/// kernels. Each partitioned_task executes work units [begin, end).
 template <typename Kernel, int N>
-void partitioned_task(const Kernel& ker, const extent<N>& ext, int part) {
+void partitioned_task(const Kernel& ker, const extent<N>& ext, size_t begin, size_t end) {
+    Kernel& k = const_cast<Kernel&>(ker);
+    const bool simd = Kalmar::CLAMP::use_cpu_simd();
     index<N> idx;
-    int start = ext[0] * part / Kalmar::NTHREAD;
-    int end = ext[0] * (part + 1) / Kalmar::NTHREAD;
-    for (int i = start; i < end; i++) {
-        idx[0] = i;
-        cpu_helper<1, Kernel, N>::call(ker, idx, ext);
+    size_t rem = begin;
+    for (int i = N - 1; i >= 0; --i) {
+        idx[i] = rem % ext[i];
+        rem /= ext[i];
+    }
+    /// work-items are executed in runs along the innermost dimension
+    while (begin < end) {
+        const int first = idx[N - 1];
+        const int last = first + std::min<size_t>(end - begin, ext[N - 1] - first);
+        if (simd)
+            Kalmar::run_cpu_row_simd(k, idx, first, last);
+        else
+            Kalmar::run_cpu_row(k, idx, first, last);
+        begin += last - first;
+        idx[N - 1] = 0;
+        for (int d = N - 2; d >= 0 && ++idx[d] == ext[d]; --d)
+            idx[d] = 0;
     }
 }
 
 template <typename Kernel, int D0>
-void partitioned_task_tile(Kernel const& f, tiled_extent<D0> const& ext, int part) {
-    int start = (ext[0] / D0) * part / Kalmar::NTHREAD;
-    int end = (ext[0] / D0) * (part + 1) / Kalmar::NTHREAD;
-    int stride = end - start;
-    if (stride == 0)
-        return;
-    char *stk = new char[D0 * SSIZE];
-    tiled_index<D0> *tidx = new tiled_index<D0>[D0];
-    tile_barrier::pb_t amp_bar = std::make_shared<barrier_t>(D0);
+void partitioned_task_tile(Kernel const& f, tiled_extent<D0> const& ext, size_t begin, size_t end) {
+    auto& tile = Kalmar::CPUTileStorage<barrier_t, tiled_index<D0>>::get(D0);
+    const int S = tile.stackSize;
+    tile_barrier::pb_t amp_bar = tile.barrier;
     tile_barrier tbar(amp_bar);
-    for (int tx = start; tx < end; tx++) {
+    for (size_t t = begin; t < end; t++) {
+        int tx = t;
         int id = 0;
-        char *sp = stk;
-        tiled_index<D0> *tip = tidx;
+        char *sp = tile.stack.get();
+        tiled_index<D0> *tip = tile.index.get();
         for (int x = 0; x < D0; x++) {
+            tile.release(tip);
             new (tip) tiled_index<D0>(tx * D0 + x, x, tx, tbar);
-            amp_bar->setctx(++id, sp, f, tip, SSIZE);
-            sp += SSIZE;
+            amp_bar->setctx(++id, sp, f, tip, S);
+            sp += S;
             ++tip;
         }
         amp_bar->idx = 0;
@@ -2093,119 +2108,103 @@ void partitioned_task_tile(Kernel const& f, tiled_extent<D0> const& ext, int par
             amp_bar->swap(0, id);
         }
     }
-    delete [] stk;
-    delete [] tidx;
 }
 template <typename Kernel, int D0, int D1>
-void partitioned_task_tile(Kernel const& f, tiled_extent<D0, D1> const& ext, int part) {
-    int start = (ext[0] / D0) * part / Kalmar::NTHREAD;
-    int end = (ext[0] / D0) * (part + 1) / Kalmar::NTHREAD;
-    int stride = end - start;
-    if (stride == 0)
-        return;
-    char *stk = new char[D1 * D0 * SSIZE];
-    tiled_index<D0, D1> *tidx = new tiled_index<D0, D1>[D0 * D1];
-    tile_barrier::pb_t amp_bar = std::make_shared<barrier_t>(D0 * D1);
+void partitioned_task_tile(Kernel const& f, tiled_extent<D0, D1> const& ext, size_t begin, size_t end) {
+    int T1 = ext[1] / D1;
+    auto& tile = Kalmar::CPUTileStorage<barrier_t, tiled_index<D0, D1>>::get(D0 * D1);
+    const int S = tile.stackSize;
+    tile_barrier::pb_t amp_bar = tile.barrier;
     tile_barrier tbar(amp_bar);
 
-    for (int tx = 0; tx < ext[1] / D1; tx++)
-        for (int ty = start; ty < end; ty++) {
-            int id = 0;
-            char *sp = stk;
-            tiled_index<D0, D1> *tip = tidx;
-            for (int x = 0; x < D1; x++)
-                for (int y = 0; y < D0; y++) {
-                    new (tip) tiled_index<D0, D1>(D1 * tx + x, D0 * ty + y, x, y, tx, ty, tbar);
-                    amp_bar->setctx(++id, sp, f, tip, SSIZE);
-                    ++tip;
-                    sp += SSIZE;
-                }
-            amp_bar->idx = 0;
-            while (amp_bar->idx == 0) {
-                amp_bar->idx = id;
-                amp_bar->swap(0, id);
+    for (size_t t = begin; t < end; t++) {
+        int ty = t / T1;
+        int tx = t % T1;
+        int id = 0;
+        char *sp = tile.stack.get();
+        tiled_index<D0, D1> *tip = tile.index.get();
+        for (int x = 0; x < D1; x++)
+            for (int y = 0; y < D0; y++) {
+                tile.release(tip);
+                new (tip) tiled_index<D0, D1>(D1 * tx + x, D0 * ty + y, x, y, tx, ty, tbar);
+                amp_bar->setctx(++id, sp, f, tip, S);
+                ++tip;
+                sp += S;
             }
+        amp_bar->idx = 0;
+        while (amp_bar->idx == 0) {
+            amp_bar->idx = id;
+            amp_bar->swap(0, id);
         }
-    delete [] stk;
-    delete [] tidx;
+    }
 }
 
 template <typename Kernel, int D0, int D1, int D2>
-void partitioned_task_tile(Kernel const& f, tiled_extent<D0, D1, D2> const& ext, int part) {
-    int start = (ext[0] / D0) * part / Kalmar::NTHREAD;
-    int end = (ext[0] / D0) * (part + 1) / Kalmar::NTHREAD;
-    int stride = end - start;
-    if (stride == 0)
-        return;
-    char *stk = new char[D2 * D1 * D0 * SSIZE];
-    tiled_index<D0, D1, D2> *tidx = new tiled_index<D0, D1, D2>[D0 * D1 * D2];
-    tile_barrier::pb_t amp_bar = std::make_shared<barrier_t>(D0 * D1 * D2);
+void partitioned_task_tile(Kernel const& f, tiled_extent<D0, D1, D2> const& ext, size_t begin, size_t end) {
+    int T1 = ext[1] / D1;
+    int T2 = ext[2] / D2;
+    auto& tile = Kalmar::CPUTileStorage<barrier_t, tiled_index<D0, D1, D2>>::get(D0 * D1 * D2);
+    const int S = tile.stackSize;
+    tile_barrier::pb_t amp_bar = tile.barrier;
     tile_barrier tbar(amp_bar);
 
-    for (int i = 0; i < ext[2] / D2; i++)
-        for (int j = 0; j < ext[1] / D1; j++)
-            for(int k = start; k < end; k++) {
-                int id = 0;
-                char *sp = stk;
-                tiled_index<D0, D1, D2> *tip = tidx;
-                for (int x = 0; x < D2; x++)
-                    for (int y = 0; y < D1; y++)
-                        for (int z = 0; z < D0; z++) {
-                            new (tip) tiled_index<D0, D1, D2>(D2 * i + x,
-                                                              D1 * j + y,
-                                                              D0 * k + z,
-                                                              x, y, z, i, j, k, tbar);
-                            amp_bar->setctx(++id, sp, f, tip, SSIZE);
-                            ++tip;
-                            sp += SSIZE;
-                        }
-                amp_bar->idx = 0;
-                while (amp_bar->idx == 0) {
-                    amp_bar->idx = id;
-                    amp_bar->swap(0, id);
+    for (size_t t = begin; t < end; t++) {
+        int k = t / (T1 * T2);
+        int j = (t / T2) % T1;
+        int i = t % T2;
+        int id = 0;
+        char *sp = tile.stack.get();
+        tiled_index<D0, D1, D2> *tip = tile.index.get();
+        for (int x = 0; x < D2; x++)
+            for (int y = 0; y < D1; y++)
+                for (int z = 0; z < D0; z++) {
+                    tile.release(tip);
+                    new (tip) tiled_index<D0, D1, D2>(D2 * i + x,
+                                                      D1 * j + y,
+                                                      D0 * k + z,
+                                                      x, y, z, i, j, k, tbar);
+                    amp_bar->setctx(++id, sp, f, tip, S);
+                    ++tip;
+                    sp += S;
                 }
-            }
-    delete [] stk;
-    delete [] tidx;
+        amp_bar->idx = 0;
+        while (amp_bar->idx == 0) {
+            amp_bar->idx = id;
+            amp_bar->swap(0, id);
+        }
+    }
 }
 
 template <typename Kernel, int N>
 void launch_cpu_task(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      extent<N> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task<Kernel, N>, std::cref(f), std::cref(compute_domain), i);
+    Kalmar::launch_cpu_kernel(pQueue, partitioned_task<Kernel, N>, f, compute_domain,
+                              compute_domain.size());
 }
 
 template <typename Kernel, int D0>
 void launch_cpu_task(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<D0> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task_tile<Kernel, D0>,
-                             std::cref(f), std::cref(compute_domain), i);
+    Kalmar::launch_cpu_kernel(pQueue, partitioned_task_tile<Kernel, D0>, f, compute_domain,
+                              compute_domain[0] / D0);
 }
 
 template <typename Kernel, int D0, int D1>
 void launch_cpu_task(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<D0, D1> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task_tile<Kernel, D0, D1>,
-                             std::cref(f), std::cref(compute_domain), i);
+    Kalmar::launch_cpu_kernel(pQueue, partitioned_task_tile<Kernel, D0, D1>, f, compute_domain,
+                              (compute_domain[0] / D0) * (compute_domain[1] / D1));
 }
 
 template <typename Kernel, int D0, int D1, int D2>
 void launch_cpu_task(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<D0, D1, D2> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task_tile<Kernel, D0, D1, D2>,
-                             std::cref(f), std::cref(compute_domain), i);
+    Kalmar::launch_cpu_kernel(pQueue, partitioned_task_tile<Kernel, D0, D1, D2>, f, compute_domain,
+                              (compute_domain[0] / D0) * (compute_domain[1] / D1) * (compute_domain[2] / D2));
 }
 
 #endif
@@ -3982,13 +3981,21 @@ private:
     // used by view_as and reinterpret_as
     array_view(const acc_buffer_t& cache, const Concurrency::extent<N>& ext,
                int offset) restrict(amp,cpu)
-        : cache(cache), extent(ext), extent_base(ext), offset(offset) {}
+        : cache(cache), extent(ext), extent_base(ext), offset(offset) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(offset, Concurrency::index<N>(), ext, ext);
+#endif
+    }
 
     // used by section and projection
     array_view(const acc_buffer_t& cache, const Concurrency::extent<N>& ext_now,
                const Concurrency::extent<N>& ext_b,
                const Concurrency::index<N>& idx_b, int off) restrict(amp,cpu)
-        : cache(cache), extent(ext_now), extent_base(ext_b), index_base(idx_b), offset(off) {}
+        : cache(cache), extent(ext_now), extent_base(ext_b), index_base(idx_b), offset(off) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(off, idx_b, ext_now, ext_b);
+#endif
+    }
   
     acc_buffer_t cache;
     Concurrency::extent<N> extent;
@@ -4550,13 +4557,21 @@ private:
     // used by view_as and reinterpret_as
     array_view(const acc_buffer_t& cache, const Concurrency::extent<N>& ext,
                int offset) restrict(amp,cpu)
-        : cache(cache), extent(ext), extent_base(ext), offset(offset) {}
+        : cache(cache), extent(ext), extent_base(ext), offset(offset) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(offset, Concurrency::index<N>(), ext, ext);
+#endif
+    }
   
     // used by section and projection
     array_view(const acc_buffer_t& cache, const Concurrency::extent<N>& ext_now,
                const Concurrency::extent<N>& ext_b,
                const Concurrency::index<N>& idx_b, int off) restrict(amp,cpu)
-        : cache(cache), extent(ext_now), extent_base(ext_b), index_base(idx_b), offset(off) {}
+        : cache(cache), extent(ext_now), extent_base(ext_b), index_base(idx_b), offset(off) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(off, idx_b, ext_now, ext_b);
+#endif
+    }
   
     acc_buffer_t cache;
     Concurrency::extent<N> extent;
@@ -5449,12 +5464,14 @@ unsigned int atomic_compare_exchange_unsigned(unsigned int *dest, unsigned int e
 int atomic_compare_exchange_int(int *dest, int expected_val, int val);
 
 static inline bool atomic_compare_exchange(unsigned int *dest, unsigned int *expected_val, unsigned int val) restrict(amp,cpu) {
-  *expected_val = atomic_compare_exchange_unsigned(dest, *expected_val, val);
-  return (*dest == val);
+  auto old = *expected_val;
+  *expected_val = atomic_compare_exchange_unsigned(dest, old, val);
+  return (*expected_val == old);
 }
 static inline bool atomic_compare_exchange(int *dest, int *expected_val, int val) restrict(amp,cpu) {
-  *expected_val = atomic_compare_exchange_int(dest, *expected_val, val);
-  return (*dest == val);
+  auto old = *expected_val;
+  *expected_val = atomic_compare_exchange_int(dest, old, val);
+  return (*expected_val == old);
 }
 #else
 extern unsigned int atomic_compare_exchange(unsigned int *dest, unsigned int *expected_val, unsigned int val) restrict(amp,cpu);
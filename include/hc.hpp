@@ -46,6 +46,7 @@ using namespace Kalmar::CLAMP;
 class accelerator;
 class accelerator_view;
 class completion_future;
+class command_graph;
 template <int N> class extent;
 template <int N> class tiled_extent;
 template <typename T, int N> class array_view;
@@ -239,6 +240,47 @@ public:
      */
     completion_future create_marker();
 
+    /**
+     * This command inserts a marker event into the accelerator_view's command
+     * queue with a prior dependent asynchronous event, which may belong to
+     * another accelerator_view. When its dependent event and all commands
+     * submitted prior to the marker event creation have completed, the
+     * future is ready.
+     *
+     * On an accelerator_view created with execute_any_order, the commands
+     * submitted after a marker do not start before it is ready.
+     *
+     * @param[in] dependent_future The asynchronous event the marker waits for.
+     * @return A future which can be waited on, and will block until the
+     *         current batch of commands and the dependent event have
+     *         completed.
+     */
+    completion_future create_blocking_marker(completion_future& dependent_future);
+
+    /**
+     * Starts recording the commands issued on this accelerator_view into a
+     * command_graph instead of executing them. Kernels launched while
+     * recording return an empty completion_future and only execute when the
+     * graph is replayed. Only supported on the CPU runtime.
+     *
+     * A copy_async enqueued on this accelerator_view is recorded the same
+     * way, copying the same elements at every replay, and returns a ready
+     * completion_future; host memory it copies from or to must outlive the
+     * graph. A copy which can't be recorded
+     * throws instead of executing out of order: copy of an array of this
+     * accelerator_view, and copy_async which is not between flat arrays,
+     * array_views or contiguous host memory of the same size. array_views
+     * are not bound to an accelerator_view, their copy executes right away.
+     */
+    void begin_capture();
+
+    /**
+     * Stops recording the commands issued on this accelerator_view.
+     *
+     * @return The graph of the commands issued since begin_capture.
+     */
+    command_graph end_capture();
+
     /**
      * Compares "this" accelerator_view with the passed accelerator_view object
      * to determine if they represent the same underlying object.
@@ -538,6 +580,15 @@ public:
      * @param[in] qmode The queuing mode of the accelerator_view to be created.
      *                  See "Queuing Mode". The default value would be
      *                  queueing_mdoe_automatic if not specified.
+     *                  With queuing_mode_deferred, non-tiled kernels are
+     *                  recorded and enqueued together on the CPU runtime.
+     *                  With queuing_mode_deferred_elementwise, consecutive
+     *                  ones over the same extent are also executed as one
+     *                  pass, a block of indices at a time. This is only
+     *                  correct for element-wise kernels, which read the
+     *                  elements written by the kernels before them at their
+     *                  own index only; any other kernel needs
+     *                  queuing_mode_deferred.
      */
     accelerator_view create_view(execute_order order = execute_in_order, queuing_mode mode = queuing_mode_automatic) {
         auto pQueue = pDev->createQueue(order);
@@ -739,14 +790,17 @@ public:
     }
 
     void memcpy_symbol(const char* symbolName, void* hostptr, size_t count, size_t offset = 0, hcMemcpyKind kind = hcMemcpyHostToDevice) {
+        build_programs();
         pDev->memcpySymbol(symbolName, hostptr, count, offset, kind);
     }
 
     void memcpy_symbol(void* symbolAddr, void* hostptr, size_t count, size_t offset = 0, hcMemcpyKind kind = hcMemcpyHostToDevice) {
+        build_programs();
         pDev->memcpySymbol(symbolAddr, hostptr, count, offset, kind);
     }
 
     void* get_symbol_address(const char* symbolName) {
+        build_programs();
         return pDev->getSymbolAddress(symbolName);
     }
 
@@ -792,6 +846,12 @@ private:
     accelerator(Kalmar::KalmarDevice* pDev) : pDev(pDev) {}
     friend class accelerator_view;
     Kalmar::KalmarDevice* pDev;
+
+    // kernels are built on their first launch, symbols are only known to the
+    // device once all of them are
+    void build_programs() {
+        Kalmar::CLAMP::BuildProgram(pDev->get_default_queue().get());
+    }
 };
 
 // ------------------------------------------------------------------------
@@ -814,7 +874,7 @@ public:
      * object which does not refer to any asynchronous operation. Default
      * constructed completion_future objects have valid() == false
      */
-    completion_future() : __amp_future(), __thread_then(nullptr), __asyncOp(nullptr) {};
+    completion_future() : __amp_future(), __asyncOp(nullptr) {};
 
     /**
      * Copy constructor. Constructs a new completion_future object that referes
@@ -824,7 +884,7 @@ public:
      *                  initialize this.
      */
     completion_future(const completion_future& other)
-        : __amp_future(other.__amp_future), __thread_then(other.__thread_then), __asyncOp(other.__asyncOp) {}
+        : __amp_future(other.__amp_future), __asyncOp(other.__asyncOp) {}
 
     /**
      * Move constructor. Move constructs a new completion_future object that
@@ -836,7 +896,7 @@ public:
      *                  completion_future
      */
     completion_future(completion_future&& other)
-        : __amp_future(std::move(other.__amp_future)), __thread_then(other.__thread_then), __asyncOp(other.__asyncOp) {}
+        : __amp_future(std::move(other.__amp_future)), __asyncOp(other.__asyncOp) {}
 
     /**
      * Copy assignment. Copy assigns the contents of other to this. This method
@@ -849,7 +909,6 @@ public:
     completion_future& operator=(const completion_future& _Other) {
         if (this != &_Other) {
            __amp_future = _Other.__amp_future;
-           __thread_then = _Other.__thread_then;
            __asyncOp = _Other.__asyncOp;
         }
         return (*this);
@@ -867,7 +926,6 @@ public:
     completion_future& operator=(completion_future&& _Other) {
         if (this != &_Other) {
             __amp_future = std::move(_Other.__amp_future);
-            __thread_then = _Other.__thread_then;
            __asyncOp = _Other.__asyncOp;
         }
         return (*this);
@@ -946,23 +1004,37 @@ public:
      * executed upon completion of the asynchronous operation associated with
      * this completion_future object. The completion callback func should have
      * an operator() that is valid when invoked with non arguments, i.e., "func()".
+     *
+     * A copy of func is executed by the continuation executor of the runtime,
+     * on one of a few threads shared by all callbacks, so it should not block
+     * for long. Several callbacks may be specified.
+     *
+     * @return A completion_future which is ready once func has returned, and
+     *         holds the exception it threw if any. If func returns a
+     *         completion_future, the returned one is ready once that one is,
+     *         so that callbacks can be chained. An invalid completion_future
+     *         if this one is invalid, func is then never executed.
      */
     // FIXME: notice we removed const from the signature here
     //        the original signature in the specification should be
     //        template<typename functor>
     //        void then(const functor& func) const;
     template<typename functor>
-    void then(const functor & func) {
+    completion_future then(const functor & func) {
 #if __KALMAR_ACCELERATOR__ != 1
-      // could only assign once
-      if (__thread_then == nullptr) {
-        // spawn a new thread to wait on the future and then execute the callback functor
-        __thread_then = new std::thread([&]() __CPU__ {
-          this->wait();
-          if(this->valid())
-            func();
-        });
-      }
+      if (!this->valid())
+        return completion_future();
+      // the copy of func is destroyed once it has returned, before the
+      // returned future is ready, so that its captures do not outlive it
+      auto callback = std::make_shared<std::unique_ptr<functor>>(new functor(func));
+      auto done = std::make_shared<std::promise<void>>();
+      completion_future next(done->get_future().share());
+      Kalmar::CLAMP::ScheduleContinuation(__amp_future, __asyncOp, [callback, done]() __CPU__ {
+        __run_continuation(*callback, done);
+      });
+      return next;
+#else
+      return completion_future();
 #endif
     }
 
@@ -1035,12 +1107,6 @@ public:
     }
 
     ~completion_future() {
-      if (__thread_then != nullptr) {
-        __thread_then->join();
-      }
-      delete __thread_then;
-      __thread_then = nullptr;
-      
       if (__asyncOp != nullptr) {
         __asyncOp = nullptr;
       }
@@ -1048,13 +1114,53 @@ public:
 
 private:
     std::shared_future<void> __amp_future;
-    std::thread* __thread_then = nullptr;
     std::shared_ptr<Kalmar::KalmarAsyncOp> __asyncOp;
 
+    /// execute the callback @func of then, @done is completed once it has
+    template <typename functor>
+    static typename std::enable_if<std::is_void<decltype(std::declval<const functor&>()())>::value>::type
+    __run_continuation(std::unique_ptr<functor>& func, const std::shared_ptr<std::promise<void>>& done) {
+      try {
+        (*func)();
+        func.reset();
+        done->set_value();
+      } catch (...) {
+        func.reset();
+        done->set_exception(std::current_exception());
+      }
+    }
+
+    /// same for a callback returning a completion_future, @done is completed
+    /// once it is
+    template <typename functor>
+    static typename std::enable_if<!std::is_void<decltype(std::declval<const functor&>()())>::value>::type
+    __run_continuation(std::unique_ptr<functor>& func, const std::shared_ptr<std::promise<void>>& done) {
+      try {
+        completion_future inner = (*func)();
+        func.reset();
+        if (!inner.valid()) {
+          done->set_value();
+          return;
+        }
+        std::shared_future<void> future = inner.__amp_future;
+        Kalmar::CLAMP::ScheduleContinuation(future, inner.__asyncOp, [future, done]() __CPU__ {
+          try {
+            future.get();
+            done->set_value();
+          } catch (...) {
+            done->set_exception(std::current_exception());
+          }
+        });
+      } catch (...) {
+        func.reset();
+        done->set_exception(std::current_exception());
+      }
+    }
+
     completion_future(std::shared_ptr<Kalmar::KalmarAsyncOp> event) : __amp_future(*(event->getFuture())), __asyncOp(event) {}
 
     completion_future(const std::shared_future<void> &__future)
-        : __amp_future(__future), __thread_then(nullptr), __asyncOp(nullptr) {}
+        : __amp_future(__future), __asyncOp(nullptr) {}
 
     // non-tiled parallel_for_each
     // generic version
@@ -1085,6 +1191,18 @@ private:
     template <typename Kernel> friend
         completion_future parallel_for_each(const accelerator_view&, const tiled_extent<1>&, const Kernel&);
 
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    // parallel_for_each on CPU path
+    template <typename Kernel, int N> friend
+        completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>&, Kernel const&, extent<N> const&);
+    template <typename Kernel> friend
+        completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>&, Kernel const&, tiled_extent<1> const&);
+    template <typename Kernel> friend
+        completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>&, Kernel const&, tiled_extent<2> const&);
+    template <typename Kernel> friend
+        completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>&, Kernel const&, tiled_extent<3> const&);
+#endif
+
     // copy_async
     template <typename T, int N> friend
         completion_future copy_async(const array_view<const T, N>& src, const array_view<T, N>& dest);
@@ -1109,12 +1227,169 @@ private:
         completion_future copy_async(const array<T, N>& src, OutputIter destBegin);
     template <typename OutputIter, typename T, int N> friend
         completion_future copy_async(const array_view<T, N>& src, OutputIter destBegin);
+    template <typename Copy> friend
+        completion_future copy_eagerly(Copy copy);
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    template <typename Locate> friend
+        completion_future copy_launch(const std::shared_ptr<Kalmar::KalmarQueue>&, Locate);
+#endif
 
     // array_view
     template <typename T, int N> friend class array_view;
 
     // accelerator_view
     friend class accelerator_view;
+
+    // command_graph
+    friend class command_graph;
+
+    // when_all, when_any
+    template <typename InputIter> friend
+        completion_future when_all(InputIter first, InputIter last);
+    template <typename InputIter> friend
+        completion_future when_any(InputIter first, InputIter last);
+};
+
+// ------------------------------------------------------------------------
+// when_all, when_any
+// ------------------------------------------------------------------------
+
+/** @{ */
+/**
+ * Returns a completion_future which is ready once all the valid
+ * completion_future objects in [first, last), or in the list, are ready. If
+ * some of them hold an exception, the returned one holds one of those.
+ *
+ * No thread waits in the meantime, the returned completion_future is
+ * completed by the continuation executor, see completion_future::then.
+ */
+template <typename InputIter>
+completion_future when_all(InputIter first, InputIter last) {
+    struct state {
+        std::atomic<size_t> count;
+        std::promise<void> done;
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+    auto s = std::make_shared<state>();
+    std::vector<completion_future> futures;
+    for (; first != last; ++first)
+        if (first->valid())
+            futures.push_back(*first);
+    completion_future result(s->done.get_future().share());
+
+    // one more arrival for the loop below, so that all callbacks are set
+    // before the result can get ready
+    s->count = futures.size() + 1;
+    auto arrive = [s] {
+        if (--s->count == 0) {
+            if (s->error)
+                s->done.set_exception(s->error);
+            else
+                s->done.set_value();
+        }
+    };
+    for (auto& f : futures) {
+        std::shared_future<void> future = f;
+        f.then([s, future, arrive] {
+            try {
+                future.get();
+            } catch (...) {
+                std::lock_guard<std::mutex> lck(s->mutex);
+                if (!s->error)
+                    s->error = std::current_exception();
+            }
+            arrive();
+        });
+    }
+    arrive();
+    return result;
+}
+
+inline completion_future when_all(std::initializer_list<completion_future> futures) {
+    return when_all(futures.begin(), futures.end());
+}
+/** @} */
+
+/** @{ */
+/**
+ * Returns a completion_future which is ready once any of the valid
+ * completion_future objects in [first, last), or in the list, is ready, and
+ * holds its exception if any. It is ready right away if there is none.
+ */
+template <typename InputIter>
+completion_future when_any(InputIter first, InputIter last) {
+    struct state {
+        std::atomic<bool> fired;
+        std::promise<void> done;
+    };
+    auto s = std::make_shared<state>();
+    s->fired = false;
+    completion_future result(s->done.get_future().share());
+    bool any = false;
+    for (; first != last; ++first) {
+        if (!first->valid())
+            continue;
+        any = true;
+        completion_future f = *first;
+        std::shared_future<void> future = f;
+        f.then([s, future] {
+            if (s->fired.exchange(true))
+                return;
+            try {
+                future.get();
+                s->done.set_value();
+            } catch (...) {
+                s->done.set_exception(std::current_exception());
+            }
+        });
+    }
+    if (!any)
+        s->done.set_value();
+    return result;
+}
+
+inline completion_future when_any(std::initializer_list<completion_future> futures) {
+    return when_any(futures.begin(), futures.end());
+}
+/** @} */
+
+// ------------------------------------------------------------------------
+// command_graph
+// ------------------------------------------------------------------------
+
+/**
+ * Represents the kernels, copies and markers issued on an accelerator_view
+ * between accelerator_view::begin_capture and accelerator_view::end_capture,
+ * which can be replayed as many times as needed. A replay reuses the buffers
+ * and arguments captured by the kernels, and costs a single launch.
+ */
+class command_graph {
+public:
+    /**
+     * Default constructor. Constructs an empty graph.
+     */
+    command_graph() : graph() {}
+
+    /**
+     * Executes the recorded commands on the accelerator_view they were
+     * captured from, after the commands issued before.
+     *
+     * @return A future which is ready once all the commands have completed.
+     */
+    completion_future replay() const;
+
+    /**
+     * Returns the number of kernels, copies and markers in the graph.
+     */
+    size_t get_size() const;
+
+private:
+    std::shared_ptr<Kalmar::CPUGraph> graph;
+
+    command_graph(const std::shared_ptr<Kalmar::CPUGraph>& graph) : graph(graph) {}
+
+    friend class accelerator_view;
 };
 
 // ------------------------------------------------------------------------
@@ -1124,9 +1399,73 @@ private:
 inline accelerator accelerator_view::get_accelerator() const { return pQueue->getDev(); }
 
 inline completion_future accelerator_view::create_marker() {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    if (pQueue->get_capture()) {
+        pQueue->get_capture()->record_marker();
+        return completion_future();
+    }
+#endif
     return completion_future(pQueue->EnqueueMarker());
 }
 
+inline completion_future accelerator_view::create_blocking_marker(completion_future& dependent_future) {
+    /// an event which is not an operation of a queue, e.g. a copy, is waited
+    /// for on the host
+    if (!dependent_future.__asyncOp)
+        dependent_future.wait();
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    if (pQueue->get_capture()) {
+        dependent_future.wait();
+        pQueue->get_capture()->record_marker();
+        return completion_future();
+    }
+#endif
+    return completion_future(pQueue->EnqueueMarkerWithDependency(dependent_future.__asyncOp));
+}
+
+inline void accelerator_view::begin_capture() {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    if (Kalmar::CLAMP::is_cpu()) {
+        if (pQueue->get_capture())
+            throw runtime_exception("accelerator_view is already capturing", E_FAIL);
+        pQueue->set_capture(std::make_shared<Kalmar::CPUGraph>(pQueue));
+        return;
+    }
+#endif
+    throw runtime_exception("command capture is only supported on the CPU runtime", E_FAIL);
+}
+
+inline command_graph accelerator_view::end_capture() {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    std::shared_ptr<Kalmar::CPUGraph> graph = pQueue->get_capture();
+    if (graph) {
+        pQueue->set_capture(nullptr);
+        graph->end();
+    }
+    return command_graph(graph);
+#else
+    return command_graph();
+#endif
+}
+
+inline completion_future command_graph::replay() const {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    if (graph) {
+        std::shared_ptr<Kalmar::KalmarAsyncOp> op = graph->replay();
+        return op ? completion_future(op) : completion_future();
+    }
+#endif
+    return completion_future();
+}
+
+inline size_t command_graph::get_size() const {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    if (graph)
+        return graph->get_size();
+#endif
+    return 0;
+}
+
 // ------------------------------------------------------------------------
 // extent
 // ------------------------------------------------------------------------
@@ -2526,13 +2865,42 @@ void bar_wrapper(Ker *f, Ti *t)
     (*f)(*t);
 }
 
+#if KALMAR_CPU_FIBER
+template <typename Ker, typename Ti>
+void fiber_wrapper(void *p)
+{
+    Kalmar::CPUFiber *self = static_cast<Kalmar::CPUFiber*>(p);
+    bar_wrapper<Ker, Ti>(static_cast<Ker*>(const_cast<void*>(self->kernel)), static_cast<Ti*>(self->index));
+    // like uc_link, continue with the previous context once finished
+    Kalmar::CPUFiber::exit(self[-1]);
+}
+#endif
+
+/// Work-items of a tile run as coroutines on their own stacks, numbered from 1,
+/// context 0 is the one executing the tile. They are switched either with
+/// ucontext or, if Kalmar::CLAMP::use_cpu_tile_fiber(), with Kalmar::CPUFiber.
 struct barrier_t {
     std::unique_ptr<ucontext_t[]> ctx;
+    std::unique_ptr<Kalmar::CPUFiber[]> fib;
     int idx;
-    barrier_t (int a) :
-        ctx(new ucontext_t[a + 1]) {}
+    barrier_t (int a) : ctx(), fib() {
+#if KALMAR_CPU_FIBER
+        if (Kalmar::CLAMP::use_cpu_tile_fiber())
+            fib.reset(new Kalmar::CPUFiber[a + 1]);
+        else
+#endif
+            ctx.reset(new ucontext_t[a + 1]);
+    }
     template <typename Ti, typename Ker>
     void setctx(int x, char *stack, Ker& f, Ti* tidx, int S) {
+#if KALMAR_CPU_FIBER
+        if (fib) {
+            fib[x].kernel = &f;
+            fib[x].index = tidx;
+            fib[x].make(stack, S, fiber_wrapper<Ker, Ti>);
+            return;
+        }
+#endif
         getcontext(&ctx[x]);
         ctx[x].uc_stack.ss_sp = stack;
         ctx[x].uc_stack.ss_size = S;
@@ -2540,11 +2908,17 @@ struct barrier_t {
         makecontext(&ctx[x], (void (*)(void))bar_wrapper<Ker, Ti>, 2, &f, tidx);
     }
     void swap(int a, int b) {
+#if KALMAR_CPU_FIBER
+        if (fib) {
+            Kalmar::CPUFiber::swap(fib[a], fib[b]);
+            return;
+        }
+#endif
         swapcontext(&ctx[a], &ctx[b]);
     }
     void wait() __HC__ {
         --idx;
-        swapcontext(&ctx[idx + 1], &ctx[idx]);
+        swap(idx + 1, idx);
     }
 };
 #endif
@@ -2805,7 +3179,7 @@ private:
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
     template<typename K> friend
-        void partitioned_task_tile_3D(K const&, tiled_extent<3> const&, int);
+        void partitioned_task_tile_3D(K const&, tiled_extent<3> const&, size_t, size_t);
 #endif
 };
 
@@ -2904,7 +3278,7 @@ private:
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
     template<typename K> friend
-        void partitioned_task_tile_1D(K const&, tiled_extent<1> const&, int);
+        void partitioned_task_tile_1D(K const&, tiled_extent<1> const&, size_t, size_t);
 #endif
 };
 
@@ -3003,62 +3377,56 @@ private:
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
     template<typename K> friend
-        void partitioned_task_tile_2D(K const&, tiled_extent<2> const&, int);
+        void partitioned_task_tile_2D(K const&, tiled_extent<2> const&, size_t, size_t);
 #endif
 };
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
-#define SSIZE 1024 * 10
-template <int N, typename Kernel,  int K>
-struct cpu_helper
-{
-    static inline void call(const Kernel& k, index<K>& idx, const extent<K>& ext) __CPU__ __HC__ {
-        int i;
-        for (i = 0; i < ext[N]; ++i) {
-            idx[N] = i;
-            cpu_helper<N + 1, Kernel, K>::call(k, idx, ext);
-        }
-    }
-};
-template <typename Kernel, int K>
-struct cpu_helper<K, Kernel, K>
-{
-    static inline void call(const Kernel& k, const index<K>& idx, const extent<K>& ext) __CPU__ __HC__ {
-        (const_cast<Kernel&>(k))(idx);
-    }
-};
-
+/// The compute domain of a CPU kernel is linearized in row-major order into
+/// work units, which are work-items for flat kernels and tiles for tiled
+/// kernels. Each partitioned_task executes work units [begin, end).
 template <typename Kernel, int N>
-void partitioned_task(const Kernel& ker, const extent<N>& ext, int part) {
+void partitioned_task(const Kernel& ker, const extent<N>& ext, size_t begin, size_t end) {
+    Kernel& k = const_cast<Kernel&>(ker);
+    const bool simd = Kalmar::CLAMP::use_cpu_simd();
     index<N> idx;
-    int start = ext[0] * part / Kalmar::NTHREAD;
-    int end = ext[0] * (part + 1) / Kalmar::NTHREAD;
-    for (int i = start; i < end; i++) {
-        idx[0] = i;
-        cpu_helper<1, Kernel, N>::call(ker, idx, ext);
+    size_t rem = begin;
+    for (int i = N - 1; i >= 0; --i) {
+        idx[i] = rem % ext[i];
+        rem /= ext[i];
+    }
+    /// work-items are executed in runs along the innermost dimension
+    while (begin < end) {
+        const int first = idx[N - 1];
+        const int last = first + std::min<size_t>(end - begin, ext[N - 1] - first);
+        if (simd)
+            Kalmar::run_cpu_row_simd(k, idx, first, last);
+        else
+            Kalmar::run_cpu_row(k, idx, first, last);
+        begin += last - first;
+        idx[N - 1] = 0;
+        for (int d = N - 2; d >= 0 && ++idx[d] == ext[d]; --d)
+            idx[d] = 0;
     }
 }
 
 template <typename Kernel>
-void partitioned_task_tile_1D(Kernel const& f, tiled_extent<1> const& ext, int part) {
+void partitioned_task_tile_1D(Kernel const& f, tiled_extent<1> const& ext, size_t begin, size_t end) {
     int D0 = ext.tile_dim[0];
-    int start = (ext[0] / D0) * part / Kalmar::NTHREAD;
-    int end = (ext[0] / D0) * (part + 1) / Kalmar::NTHREAD;
-    int stride = end - start;
-    if (stride == 0)
-        return;
-    char *stk = new char[D0 * SSIZE];
-    tiled_index<1> *tidx = new tiled_index<1>[D0];
-    tile_barrier::pb_t hc_bar = std::make_shared<barrier_t>(D0);
+    auto& tile = Kalmar::CPUTileStorage<barrier_t, tiled_index<1>>::get(D0);
+    const int S = tile.stackSize;
+    tile_barrier::pb_t hc_bar = tile.barrier;
     tile_barrier tbar(hc_bar);
-    for (int tx = start; tx < end; tx++) {
+    for (size_t t = begin; t < end; t++) {
+        int tx = t;
         int id = 0;
-        char *sp = stk;
-        tiled_index<1> *tip = tidx;
+        char *sp = tile.stack.get();
+        tiled_index<1> *tip = tile.index.get();
         for (int x = 0; x < D0; x++) {
+            tile.release(tip);
             new (tip) tiled_index<1>(tx * D0 + x, x, tx, tbar, D0);
-            hc_bar->setctx(++id, sp, f, tip, SSIZE);
-            sp += SSIZE;
+            hc_bar->setctx(++id, sp, f, tip, S);
+            sp += S;
             ++tip;
         }
         hc_bar->idx = 0;
@@ -3067,133 +3435,135 @@ void partitioned_task_tile_1D(Kernel const& f, tiled_extent<1> const& ext, int p
             hc_bar->swap(0, id);
         }
     }
-    delete [] stk;
-    delete [] tidx;
 }
 
 template <typename Kernel>
-void partitioned_task_tile_2D(Kernel const& f, tiled_extent<2> const& ext, int part) {
+void partitioned_task_tile_2D(Kernel const& f, tiled_extent<2> const& ext, size_t begin, size_t end) {
     int D0 = ext.tile_dim[0];
     int D1 = ext.tile_dim[1];
-    int start = (ext[0] / D0) * part / Kalmar::NTHREAD;
-    int end = (ext[0] / D0) * (part + 1) / Kalmar::NTHREAD;
-    int stride = end - start;
-    if (stride == 0)
-        return;
-    char *stk = new char[D1 * D0 * SSIZE];
-    tiled_index<2> *tidx = new tiled_index<2>[D0 * D1];
-    tile_barrier::pb_t hc_bar = std::make_shared<barrier_t>(D0 * D1);
+    int T1 = ext[1] / D1;
+    auto& tile = Kalmar::CPUTileStorage<barrier_t, tiled_index<2>>::get(D0 * D1);
+    const int S = tile.stackSize;
+    tile_barrier::pb_t hc_bar = tile.barrier;
     tile_barrier tbar(hc_bar);
 
-    for (int tx = 0; tx < ext[1] / D1; tx++)
-        for (int ty = start; ty < end; ty++) {
-            int id = 0;
-            char *sp = stk;
-            tiled_index<2> *tip = tidx;
-            for (int x = 0; x < D1; x++)
-                for (int y = 0; y < D0; y++) {
-                    new (tip) tiled_index<2>(D1 * tx + x, D0 * ty + y, x, y, tx, ty, tbar, D0, D1);
-                    hc_bar->setctx(++id, sp, f, tip, SSIZE);
-                    ++tip;
-                    sp += SSIZE;
-                }
-            hc_bar->idx = 0;
-            while (hc_bar->idx == 0) {
-                hc_bar->idx = id;
-                hc_bar->swap(0, id);
+    for (size_t t = begin; t < end; t++) {
+        int ty = t / T1;
+        int tx = t % T1;
+        int id = 0;
+        char *sp = tile.stack.get();
+        tiled_index<2> *tip = tile.index.get();
+        for (int x = 0; x < D1; x++)
+            for (int y = 0; y < D0; y++) {
+                tile.release(tip);
+                new (tip) tiled_index<2>(D1 * tx + x, D0 * ty + y, x, y, tx, ty, tbar, D0, D1);
+                hc_bar->setctx(++id, sp, f, tip, S);
+                ++tip;
+                sp += S;
             }
+        hc_bar->idx = 0;
+        while (hc_bar->idx == 0) {
+            hc_bar->idx = id;
+            hc_bar->swap(0, id);
         }
-    delete [] stk;
-    delete [] tidx;
+    }
 }
 
 template <typename Kernel>
-void partitioned_task_tile_3D(Kernel const& f, tiled_extent<3> const& ext, int part) {
+void partitioned_task_tile_3D(Kernel const& f, tiled_extent<3> const& ext, size_t begin, size_t end) {
     int D0 = ext.tile_dim[0];
     int D1 = ext.tile_dim[1];
     int D2 = ext.tile_dim[2];
-    int start = (ext[0] / D0) * part / Kalmar::NTHREAD;
-    int end = (ext[0] / D0) * (part + 1) / Kalmar::NTHREAD;
-    int stride = end - start;
-    if (stride == 0)
-        return;
-    char *stk = new char[D2 * D1 * D0 * SSIZE];
-    tiled_index<3> *tidx = new tiled_index<3>[D0 * D1 * D2];
-    tile_barrier::pb_t hc_bar = std::make_shared<barrier_t>(D0 * D1 * D2);
+    int T1 = ext[1] / D1;
+    int T2 = ext[2] / D2;
+    auto& tile = Kalmar::CPUTileStorage<barrier_t, tiled_index<3>>::get(D0 * D1 * D2);
+    const int S = tile.stackSize;
+    tile_barrier::pb_t hc_bar = tile.barrier;
     tile_barrier tbar(hc_bar);
 
-    for (int i = 0; i < ext[2] / D2; i++)
-        for (int j = 0; j < ext[1] / D1; j++)
-            for(int k = start; k < end; k++) {
-                int id = 0;
-                char *sp = stk;
-                tiled_index<3> *tip = tidx;
-                for (int x = 0; x < D2; x++)
-                    for (int y = 0; y < D1; y++)
-                        for (int z = 0; z < D0; z++) {
-                            new (tip) tiled_index<3>(D2 * i + x,
-                                                              D1 * j + y,
-                                                              D0 * k + z,
-                                                              x, y, z, i, j, k, tbar, D0, D1, D2);
-                            hc_bar->setctx(++id, sp, f, tip, SSIZE);
-                            ++tip;
-                            sp += SSIZE;
-                        }
-                hc_bar->idx = 0;
-                while (hc_bar->idx == 0) {
-                    hc_bar->idx = id;
-                    hc_bar->swap(0, id);
+    for (size_t t = begin; t < end; t++) {
+        int k = t / (T1 * T2);
+        int j = (t / T2) % T1;
+        int i = t % T2;
+        int id = 0;
+        char *sp = tile.stack.get();
+        tiled_index<3> *tip = tile.index.get();
+        for (int x = 0; x < D2; x++)
+            for (int y = 0; y < D1; y++)
+                for (int z = 0; z < D0; z++) {
+                    tile.release(tip);
+                    new (tip) tiled_index<3>(D2 * i + x,
+                                             D1 * j + y,
+                                             D0 * k + z,
+                                             x, y, z, i, j, k, tbar, D0, D1, D2);
+                    hc_bar->setctx(++id, sp, f, tip, S);
+                    ++tip;
+                    sp += S;
                 }
-            }
-    delete [] stk;
-    delete [] tidx;
+        hc_bar->idx = 0;
+        while (hc_bar->idx == 0) {
+            hc_bar->idx = id;
+            hc_bar->swap(0, id);
+        }
+    }
 }
 
 template <typename Kernel, int N>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      extent<N> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task<Kernel, N>, std::cref(f), std::cref(compute_domain), i);
-    // FIXME wrap the above operation into the completion_future object
-    return completion_future();
+    if (Kalmar::capture_cpu_kernel(pQueue, partitioned_task<Kernel, N>, f, compute_domain,
+                                   compute_domain.size()))
+        return completion_future();
+    std::shared_ptr<Kalmar::KalmarAsyncOp> op;
+    if (pQueue->get_mode() == queuing_mode_deferred ||
+        pQueue->get_mode() == queuing_mode_deferred_elementwise) {
+        std::vector<int> shape(N);
+        for (int i = 0; i < N; ++i)
+            shape[i] = compute_domain[i];
+        op = Kalmar::defer_cpu_kernel(pQueue, partitioned_task<Kernel, N>, f, compute_domain,
+                                      compute_domain.size(), std::move(shape));
+    } else {
+        op = Kalmar::launch_cpu_kernel_async(pQueue, partitioned_task<Kernel, N>, f, compute_domain,
+                                             compute_domain.size());
+    }
+    return op ? completion_future(op) : completion_future();
 }
 
 template <typename Kernel>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<1> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task_tile_1D<Kernel>,
-                             std::cref(f), std::cref(compute_domain), i);
-    // FIXME wrap the above operation into the completion_future object
-    return completion_future();
+    const size_t size = compute_domain[0] / compute_domain.tile_dim[0];
+    if (Kalmar::capture_cpu_kernel(pQueue, partitioned_task_tile_1D<Kernel>, f, compute_domain, size))
+        return completion_future();
+    auto op = Kalmar::launch_cpu_kernel_async(pQueue, partitioned_task_tile_1D<Kernel>, f, compute_domain, size);
+    return op ? completion_future(op) : completion_future();
 }
 
 template <typename Kernel>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<2> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task_tile_2D<Kernel>,
-                             std::cref(f), std::cref(compute_domain), i);
-    // FIXME wrap the above operation into the completion_future object
-    return completion_future();
+    const size_t size = (compute_domain[0] / compute_domain.tile_dim[0]) *
+                        (compute_domain[1] / compute_domain.tile_dim[1]);
+    if (Kalmar::capture_cpu_kernel(pQueue, partitioned_task_tile_2D<Kernel>, f, compute_domain, size))
+        return completion_future();
+    auto op = Kalmar::launch_cpu_kernel_async(pQueue, partitioned_task_tile_2D<Kernel>, f, compute_domain, size);
+    return op ? completion_future(op) : completion_future();
 }
 
 template <typename Kernel>
 completion_future launch_cpu_task_async(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Kernel const& f,
                      tiled_extent<3> const& compute_domain)
 {
-    Kalmar::CPUKernelRAII<Kernel> obj(pQueue, f);
-    for (int i = 0; i < Kalmar::NTHREAD; ++i)
-        obj[i] = std::thread(partitioned_task_tile_3D<Kernel>,
-                             std::cref(f), std::cref(compute_domain), i);
-    // FIXME wrap the above operation into the completion_future object
-    return completion_future();
+    const size_t size = (compute_domain[0] / compute_domain.tile_dim[0]) *
+                        (compute_domain[1] / compute_domain.tile_dim[1]) *
+                        (compute_domain[2] / compute_domain.tile_dim[2]);
+    if (Kalmar::capture_cpu_kernel(pQueue, partitioned_task_tile_3D<Kernel>, f, compute_domain, size))
+        return completion_future();
+    auto op = Kalmar::launch_cpu_kernel_async(pQueue, partitioned_task_tile_3D<Kernel>, f, compute_domain, size);
+    return op ? completion_future(op) : completion_future();
 }
 
 #endif
@@ -3472,6 +3842,9 @@ void copy(const array_view<T, N> &src, OutputIter destBegin);
 template <typename OutputIter, typename T, int N>
 void copy(const array<T, N> &src, OutputIter destBegin);
 
+template <typename Copy>
+completion_future copy_eagerly(Copy copy);
+
 // ------------------------------------------------------------------------
 // array
 // ------------------------------------------------------------------------
@@ -4700,8 +5073,14 @@ public:
      */
     // FIXME: type parameter is not implemented
     completion_future synchronize_async() const {
-        std::future<void> fut = std::async([&]() mutable { synchronize(); });
-        return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+        if (Kalmar::CLAMP::is_cpu()) {
+            std::shared_ptr<Kalmar::KalmarAsyncOp> op = Kalmar::launch_cpu_sync_async(cache);
+            if (op)
+                return completion_future(op);
+        }
+#endif
+        return copy_eagerly([&] { synchronize(); });
     }
 
     /**
@@ -5008,14 +5387,22 @@ private:
     // used by view_as and reinterpret_as
     array_view(const acc_buffer_t& cache, const hc::extent<N>& ext,
                int offset) __CPU__ __HC__
-        : cache(cache), extent(ext), extent_base(ext), offset(offset) {}
+        : cache(cache), extent(ext), extent_base(ext), offset(offset) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(offset, index<N>(), ext, ext);
+#endif
+    }
 
     // used by section and projection
     array_view(const acc_buffer_t& cache, const hc::extent<N>& ext_now,
                const hc::extent<N>& ext_b,
                const index<N>& idx_b, int off) __CPU__ __HC__
         : cache(cache), extent(ext_now), extent_base(ext_b), index_base(idx_b),
-        offset(off) {}
+        offset(off) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(off, idx_b, ext_now, ext_b);
+#endif
+    }
   
     acc_buffer_t cache;
     hc::extent<N> extent;
@@ -5315,8 +5702,14 @@ public:
      *         completion of the asynchronous operation.
      */
     completion_future synchronize_async() const {
-        std::future<void> fut = std::async([&]() mutable { synchronize(); });
-        return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+        if (Kalmar::CLAMP::is_cpu()) {
+            std::shared_ptr<Kalmar::KalmarAsyncOp> op = Kalmar::launch_cpu_sync_async(cache);
+            if (op)
+                return completion_future(op);
+        }
+#endif
+        return copy_eagerly([&] { synchronize(); });
     }
 
     /**
@@ -5587,14 +5980,22 @@ private:
     // used by view_as and reinterpret_as
     array_view(const acc_buffer_t& cache, const hc::extent<N>& ext,
                int offset) __CPU__ __HC__
-        : cache(cache), extent(ext), extent_base(ext), offset(offset) {}
+        : cache(cache), extent(ext), extent_base(ext), offset(offset) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(offset, index<N>(), ext, ext);
+#endif
+    }
   
     // used by section and projection
     array_view(const acc_buffer_t& cache, const hc::extent<N>& ext_now,
                const extent<N>& ext_b,
                const index<N>& idx_b, int off) __CPU__ __HC__
         : cache(cache), extent(ext_now), extent_base(ext_b), index_base(idx_b),
-        offset(off) {}
+        offset(off) {
+#if __KALMAR_ACCELERATOR__ != 1
+        this->cache.set_section(off, idx_b, ext_now, ext_b);
+#endif
+    }
   
     acc_buffer_t cache;
     hc::extent<N> extent;
@@ -5615,101 +6016,91 @@ static inline bool is_flat(const array_view<T, N>& av) noexcept {
 template<typename T>
 static inline bool is_flat(const array_view<T, 1>& av) noexcept { return true; }
 
-template <typename InputIter, typename T, int N, int dim>
-struct copy_input
-{
-    void operator()(InputIter& It, T* ptr, const extent<N>& ext,
-                    const extent<N>& base, const index<N>& idx)
-    {
-        size_t stride = 1;
-        for (int i = dim; i < N; i++)
-            stride *= base[i];
-        ptr += stride * idx[dim - 1];
-        for (int i = 0; i < ext[dim - 1]; i++) {
-            copy_input<InputIter, T, N, dim + 1>()(It, ptr, ext, base, idx);
-            ptr += stride;
-        }
-    }
-};
-
-template <typename InputIter, typename T, int N>
-struct copy_input<InputIter, T, N, N>
-{
-    void operator()(InputIter& It, T* ptr, const extent<N>& ext,
-                    const extent<N>& base, const index<N>& idx)
-    {
-        InputIter end = It;
-        std::advance(end, ext[N - 1]);
-        std::copy(It, end, ptr + idx[N - 1]);
-        It = end;
-    }
-};
-
-template <typename OutputIter, typename T, int N, int dim>
-struct copy_output
+/// true if @Iter is known to address contiguous elements of type @T:
+/// pointers and iterators of std::vector, except std::vector<bool>
+template <typename Iter, typename T>
+struct is_contiguous_iterator
 {
-    void operator()(const T* ptr, OutputIter& It, const extent<N>& ext,
-                    const extent<N>& base, const index<N>& idx)
-    {
-        size_t stride = 1;
-        for (int i = dim; i < N; i++)
-            stride *= base[i];
-        ptr += stride * idx[dim - 1];
-        for (int i = 0; i < ext[dim - 1]; i++) {
-            copy_output<OutputIter, T, N, dim + 1>()(ptr, It, ext, base, idx);
-            ptr += stride;
-        }
-    }
+    typedef typename std::remove_cv<T>::type U;
+    static const bool value = std::is_same<Iter, U*>::value || std::is_same<Iter, const U*>::value ||
+                              (!std::is_same<U, bool>::value &&
+                               (std::is_same<Iter, typename std::vector<U>::iterator>::value ||
+                                std::is_same<Iter, typename std::vector<U>::const_iterator>::value));
 };
 
-template <typename OutputIter, typename T, int N>
-struct copy_output<OutputIter, T, N, N>
-{
-    void operator()(const T* ptr, OutputIter& It, const extent<N>& ext,
-                    const extent<N>& base, const index<N>& idx)
-    {
-        ptr += idx[N - 1];
-        It = std::copy(ptr, ptr + ext[N - 1], It);
-    }
-};
+/// address of the element at @it if it is a contiguous iterator of elements
+/// of type @T, nullptr otherwise
+template <typename T, typename Iter>
+static inline typename std::enable_if<is_contiguous_iterator<Iter, T>::value,
+                                      typename std::remove_cv<T>::type*>::type
+contiguous_address(const Iter& it) { return const_cast<typename std::remove_cv<T>::type*>(&*it); }
+
+template <typename T, typename Iter>
+static inline typename std::enable_if<!is_contiguous_iterator<Iter, T>::value,
+                                      typename std::remove_cv<T>::type*>::type
+contiguous_address(const Iter&) { return nullptr; }
+
+/// throw if the accelerator_view of @a is capturing commands, see
+/// accelerator_view::begin_capture
+/// A copy executes before returning, the commands captured before it only
+/// once the graph is replayed.
+template <typename T, int N>
+static inline void check_capture(const array<T, N>& a) {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    std::shared_ptr<Kalmar::KalmarQueue> pQueue = a.internal().get_av();
+    if (pQueue && pQueue->get_capture())
+        throw runtime_exception("copy of an array on an accelerator_view which is capturing", E_FAIL);
+#endif
+}
 
-template <typename T, int N, int dim>
-struct copy_bidir
-{
-    void operator()(const T* src, T* dst, const extent<N>& ext,
-                    const extent<N>& base1, const index<N>& idx1,
-                    const extent<N>& base2, const index<N>& idx2)
-    {
-        size_t stride1 = 1;
-        for (int i = dim; i < N; i++)
-            stride1 *= base1[i];
-        src += stride1 * idx1[dim - 1];
-
-        size_t stride2 = 1;
-        for (int i = dim; i < N; i++)
-            stride2 *= base2[i];
-        dst += stride2 * idx2[dim - 1];
-
-        for (int i = 0; i < ext[dim - 1]; i++) {
-            copy_bidir<T, N, dim + 1>()(src, dst, ext, base1, idx1, base2, idx2);
-            src += stride1;
-            dst += stride2;
+/// call @copy with the Kalmar::KalmarRect of a strided copy of the elements
+/// of extent @ext at @src_idx in a buffer of extent @src_base starting at
+/// element @src_offset, to those at @dst_idx in a buffer of extent @dst_base
+/// starting at element @dst_offset
+/// Rows are the last dimension, the dimensions above the last three are
+/// walked here, calling @copy for each of their indices.
+template <typename T, int N, typename Copy>
+void copy_rects(const extent<N>& ext,
+                int src_offset, const extent<N>& src_base, const index<N>& src_idx,
+                int dst_offset, const extent<N>& dst_base, const index<N>& dst_idx,
+                Copy copy) {
+    if (ext.size() == 0)
+        return;
+    size_t src_stride[N], dst_stride[N];
+    src_stride[N - 1] = dst_stride[N - 1] = sizeof(T);
+    for (int i = N - 1; i > 0; --i) {
+        src_stride[i - 1] = src_stride[i] * src_base[i];
+        dst_stride[i - 1] = dst_stride[i] * dst_base[i];
+    }
+    size_t src_begin = src_offset * sizeof(T), dst_begin = dst_offset * sizeof(T);
+    for (int i = 0; i < N; ++i) {
+        src_begin += src_idx[i] * src_stride[i];
+        dst_begin += dst_idx[i] * dst_stride[i];
+    }
+
+    const int row = N > 1 ? N - 2 : 0, slice = N > 2 ? N - 3 : 0, outer = N > 3 ? N - 3 : 0;
+    Kalmar::KalmarRect rect;
+    rect.width = ext[N - 1] * sizeof(T);
+    rect.rows = N > 1 ? ext[row] : 1;
+    rect.src_pitch = N > 1 ? src_stride[row] : 0;
+    rect.dst_pitch = N > 1 ? dst_stride[row] : 0;
+    rect.slices = N > 2 ? ext[slice] : 1;
+    rect.src_slice_pitch = N > 2 ? src_stride[slice] : 0;
+    rect.dst_slice_pitch = N > 2 ? dst_stride[slice] : 0;
+
+    size_t count = 1;
+    for (int i = 0; i < outer; ++i)
+        count *= ext[i];
+    for (size_t k = 0; k < count; ++k) {
+        rect.src_offset = src_begin;
+        rect.dst_offset = dst_begin;
+        for (int i = outer - 1, rest = k; i >= 0; rest /= ext[i], --i) {
+            rect.src_offset += rest % ext[i] * src_stride[i];
+            rect.dst_offset += rest % ext[i] * dst_stride[i];
         }
+        copy(rect);
     }
-};
-
-template <typename T, int N>
-struct copy_bidir<T, N, N>
-{
-    void operator()(const T* src, T* dst, const extent<N>& ext,
-                    const extent<N>& base1, const index<N>& idx1,
-                    const extent<N>& base2, const index<N>& idx2)
-    {
-        src += idx1[N - 1];
-        dst += idx2[N - 1];
-        std::copy(src, src + ext[N - 1], dst);
-    }
-};
+}
 
 template <typename Iter, typename T, int N>
 struct do_copy
@@ -5803,6 +6194,8 @@ struct do_copy<T*, T, 1>
  */
 template <typename T, int N>
 void copy(const array<T, N>& src, array<T, N>& dest) {
+    check_capture(src);
+    check_capture(dest);
     src.internal().copy(dest.internal(), 0, 0, 0);
 }
 
@@ -5816,29 +6209,21 @@ void copy(const array<T, N>& src, array<T, N>& dest) {
  */
 template <typename T, int N>
 void copy(const array<T, N>& src, const array_view<T, N>& dest) {
+    check_capture(src);
     if (is_flat(dest))
         src.internal().copy(dest.internal(), src.get_offset(),
                             dest.get_offset(), dest.get_extent().size());
-    else {
-        // FIXME: logic here deserve to be reviewed
-        size_t srcSize = src.extent.size();
-        size_t srcOffset = 0;
-        bool srcModify = false;
-        size_t destSize = dest.extent_base.size();
-        size_t destOffset = dest.offset;
-        bool destModify = true;
-
-        T* pSrc = src.internal().map_ptr(srcModify, srcSize, srcOffset);
-        T* p = pSrc;
-        T* pDst = dest.internal().map_ptr(destModify, destSize, destOffset);
-        copy_input<T*, T, N, 1>()(pSrc, pDst, dest.extent, dest.extent_base, dest.index_base);
-        dest.internal().unmap_ptr(pDst, destModify, destSize, destOffset);
-        src.internal().unmap_ptr(p, srcModify, srcSize, srcOffset);
-    }
+    else
+        copy_rects<T>(dest.extent, src.get_offset(), dest.extent, index<N>(),
+                      dest.offset, dest.extent_base, dest.index_base,
+                      [&](const Kalmar::KalmarRect& rect) {
+            src.internal().copy_rect(dest.internal(), rect);
+        });
 }
 
 template <typename T>
 void copy(const array<T, 1>& src, const array_view<T, 1>& dest) {
+    check_capture(src);
     src.internal().copy(dest.internal(),
                         src.get_offset() + src.get_index_base()[0],
                         dest.get_offset() + dest.get_index_base()[0],
@@ -5858,25 +6243,16 @@ void copy(const array<T, 1>& src, const array_view<T, 1>& dest) {
  */
 template <typename T, int N>
 void copy(const array_view<const T, N>& src, array<T, N>& dest) {
+    check_capture(dest);
     if (is_flat(src)) {
         src.internal().copy(dest.internal(), src.get_offset(),
                             dest.get_offset(), dest.get_extent().size());
-    } else {
-        // FIXME: logic here deserve to be reviewed
-        size_t srcSize = src.extent_base.size();
-        size_t srcOffset = src.offset;
-        bool srcModify = false;
-        size_t destSize = dest.extent.size();
-        size_t destOffset = 0;
-        bool destModify = true;
-
-        T* pDst = dest.internal().map_ptr(destModify, destSize, destOffset);
-        T* p = pDst;
-        const T* pSrc = src.internal().map_ptr(srcModify, srcSize, srcOffset);
-        copy_output<T*, T, N, 1>()(pSrc, pDst, src.extent, src.extent_base, src.index_base);
-        src.internal().unmap_ptr(pSrc, srcModify, srcSize, srcOffset);
-        dest.internal().unmap_ptr(p, destModify, destSize, destOffset);
-    }
+    } else
+        copy_rects<T>(src.extent, src.offset, src.extent_base, src.index_base,
+                      dest.get_offset(), src.extent, index<N>(),
+                      [&](const Kalmar::KalmarRect& rect) {
+            src.internal().copy_rect(dest.internal(), rect);
+        });
 }
 
 template <typename T, int N>
@@ -5887,6 +6263,7 @@ void copy(const array_view<T, N>& src, array<T, N>& dest) {
 
 template <typename T>
 void copy(const array_view<const T, 1>& src, array<T, 1>& dest) {
+    check_capture(dest);
     src.internal().copy(dest.internal(),
                         src.get_offset() + src.get_index_base()[0],
                         dest.get_offset() + dest.get_index_base()[0],
@@ -5906,59 +6283,15 @@ void copy(const array_view<const T, 1>& src, array<T, 1>& dest) {
  */
 template <typename T, int N>
 void copy(const array_view<const T, N>& src, const array_view<T, N>& dest) {
-    if (is_flat(src)) {
-        if (is_flat(dest))
-            src.internal().copy(dest.internal(), src.get_offset(),
-                                dest.get_offset(), dest.get_extent().size());
-        else {
-            // FIXME: logic here deserve to be reviewed
-            size_t srcSize = src.extent.size();
-            size_t srcOffset = 0;
-            bool srcModify = false;
-            size_t destSize = dest.extent_base.size();
-            size_t destOffset = dest.offset;
-            bool destModify = true;
-
-            const T* pSrc = src.internal().map_ptr(srcModify, srcSize, srcOffset);
-            const T* p = pSrc;
-            T* pDst = dest.internal().map_ptr(destModify, destSize, destOffset);
-            copy_input<const T*, T, N, 1>()(pSrc, pDst, dest.extent, dest.extent_base, dest.index_base);
-            dest.internal().unmap_ptr(pDst, destModify, destSize, destOffset);
-            src.internal().unmap_ptr(p, srcModify, srcSize, srcOffset);
-        }
-    } else {
-        if (is_flat(dest)) {
-            // FIXME: logic here deserve to be reviewed
-            size_t srcSize = src.extent_base.size();
-            size_t srcOffset = src.offset;
-            bool srcModify = false;
-            size_t destSize = dest.extent.size();
-            size_t destOffset = 0;
-            bool destModify = true;
-
-            T* pDst = dest.internal().map_ptr(destModify, destSize, destOffset);
-            T* p = pDst;
-            const T* pSrc = src.internal().map_ptr(srcModify, srcSize, srcOffset);
-            copy_output<T*, T, N, 1>()(pSrc, pDst, src.extent, src.extent_base, src.index_base);
-            dest.internal().unmap_ptr(p, destModify, destSize, destOffset);
-            src.internal().unmap_ptr(pSrc, srcModify, srcSize, srcOffset);
-        } else {
-            // FIXME: logic here deserve to be reviewed
-            size_t srcSize = src.extent_base.size();
-            size_t srcOffset = src.offset;
-            bool srcModify = false;
-            size_t destSize = dest.extent_base.size();
-            size_t destOffset = dest.offset;
-            bool destModify = true;
-
-            const T* pSrc = src.internal().map_ptr(srcModify, srcSize, srcOffset);
-            T* pDst = dest.internal().map_ptr(destModify, destSize, destOffset);
-            copy_bidir<T, N, 1>()(pSrc, pDst, src.extent, src.extent_base,
-                                  src.index_base, dest.extent_base, dest.index_base);
-            dest.internal().unmap_ptr(pDst, destModify, destSize, destOffset);
-            src.internal().unmap_ptr(pSrc, srcModify, srcSize, srcOffset);
-        }
-    }
+    if (is_flat(src) && is_flat(dest))
+        src.internal().copy(dest.internal(), src.get_offset(),
+                            dest.get_offset(), dest.get_extent().size());
+    else
+        copy_rects<T>(src.extent, src.offset, src.extent_base, src.index_base,
+                      dest.offset, dest.extent_base, dest.index_base,
+                      [&](const Kalmar::KalmarRect& rect) {
+            src.internal().copy_rect(dest.internal(), rect);
+        });
 }
 
 template <typename T, int N>
@@ -5993,6 +6326,7 @@ void copy(const array_view<const T, 1>& src, const array_view<T, 1>& dest) {
  */
 template <typename InputIter, typename T, int N>
 void copy(InputIter srcBegin, InputIter srcEnd, array<T, N>& dest) {
+    check_capture(dest);
 #if __KALMAR_ACCELERATOR__ != 1
     if( ( std::distance(srcBegin,srcEnd) <=0 )||( std::distance(srcBegin,srcEnd) < dest.get_extent().size() ))
       throw runtime_exception("errorMsg_throw ,copy between different types", 0);
@@ -6027,14 +6361,20 @@ template <typename InputIter, typename T, int N>
 void copy(InputIter srcBegin, InputIter srcEnd, const array_view<T, N>& dest) {
     if (is_flat(dest))
         do_copy<InputIter, T, N>()(srcBegin, srcEnd, dest);
-    else {
-        size_t size = dest.extent_base.size();
-        size_t offset = dest.offset;
-        bool modify = true;
-
-        T* ptr = dest.internal().map_ptr(modify, size, offset);
-        copy_input<InputIter, T, N, 1>()(srcBegin, ptr, dest.extent, dest.extent_base, dest.index_base);
-        dest.internal().unmap_ptr(ptr, modify, size, offset);
+    else if (dest.extent.size() > 0) {
+        /// elements which are not contiguous in host memory are staged
+        const T* src = contiguous_address<T>(srcBegin);
+        std::vector<T> staged;
+        if (!src) {
+            staged.reserve(dest.extent.size());
+            std::copy_n(srcBegin, dest.extent.size(), std::back_inserter(staged));
+            src = staged.data();
+        }
+        copy_rects<T>(dest.extent, 0, dest.extent, index<N>(),
+                      dest.offset, dest.extent_base, dest.index_base,
+                      [&](const Kalmar::KalmarRect& rect) {
+            dest.internal().write_rect(src, rect, true);
+        });
     }
 }
 
@@ -6059,6 +6399,7 @@ void copy(InputIter srcBegin, const array_view<T, N>& dest) {
  */
 template <typename OutputIter, typename T, int N>
 void copy(const array<T, N> &src, OutputIter destBegin) {
+    check_capture(src);
     do_copy<OutputIter, T, N>()(src, destBegin);
 }
 
@@ -6076,14 +6417,21 @@ template <typename OutputIter, typename T, int N>
 void copy(const array_view<T, N> &src, OutputIter destBegin) {
     if (is_flat(src))
         do_copy<OutputIter, T, N>()(src, destBegin);
-    else {
-        size_t size = src.extent_base.size();
-        size_t offset = src.offset;
-        bool modify = false;
-
-        T* ptr = src.internal().map_ptr(modify, size, offset);
-        copy_output<OutputIter, T, N, 1>()(ptr, destBegin, src.extent, src.extent_base, src.index_base);
-        src.internal().unmap_ptr(ptr, modify, size, offset);
+    else if (src.extent.size() > 0) {
+        /// elements are staged unless @destBegin is contiguous in host memory
+        typedef typename std::remove_const<T>::type U;
+        U* dst = contiguous_address<T>(destBegin);
+        std::vector<U> staged;
+        if (!dst) {
+            staged.resize(src.extent.size());
+            dst = staged.data();
+        }
+        copy_rects<T>(src.extent, src.offset, src.extent_base, src.index_base,
+                      0, src.extent, index<N>(),
+                      [&](const Kalmar::KalmarRect& rect) {
+            src.internal().read_rect(dst, rect);
+        });
+        std::copy(staged.begin(), staged.end(), destBegin);
     }
 }
 
@@ -6091,11 +6439,148 @@ void copy(const array_view<T, N> &src, OutputIter destBegin) {
 // utility function for copy_async
 // ------------------------------------------------------------------------
 
+/// execute @copy before returning, for a copy which can't be enqueued, an
+/// exception it throws is reported by the returned completion_future
+template <typename Copy>
+completion_future copy_eagerly(Copy copy) {
+    std::promise<void> done;
+    try {
+        copy();
+        done.set_value();
+    } catch (...) {
+        done.set_exception(std::current_exception());
+    }
+    return completion_future(done.get_future().share());
+}
+
+template<typename T, int N>
+static inline bool is_flat(const array<T, N>&) noexcept { return true; }
+
+/// first element of a flat array or array_view in its buffer
+template <typename Container>
+static inline size_t flat_offset(const Container& c) {
+    return c.get_offset() + c.get_index_base()[0];
+}
+
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+/// queue of an asynchronous copy on the CPU runtime: the one of the first of
+/// @arrays, the queues of the arrays copied from or to, or the default view
+/// if there is none
+/// return nullptr if the copy can't be enqueued: the CPU runtime is not in
+/// use, or an array lives on the cpu accelerator
+static inline std::shared_ptr<Kalmar::KalmarQueue>
+copy_queue(std::initializer_list<std::shared_ptr<Kalmar::KalmarQueue>> arrays) {
+    if (!Kalmar::CLAMP::is_cpu())
+        return nullptr;
+    for (const auto& pQueue : arrays)
+        if (Kalmar::is_cpu_queue(pQueue))
+            return nullptr;
+    return arrays.size() > 0 ? *arrays.begin() : Kalmar::getContext()->auto_select();
+}
+
+/// a copy which can't be enqueued while @pQueue is capturing, it would not be
+/// part of the graph
+/// return an invalid completion_future if @pQueue is not capturing, the copy
+/// is then done before copy_async returns
+static inline completion_future copy_capture_error(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue) {
+    if (!pQueue->get_capture())
+        return completion_future();
+    return copy_eagerly([] {
+        throw runtime_exception("copy_async can't be captured on this accelerator_view", E_FAIL);
+    });
+}
+
+/// enqueue a Kalmar::CPUCopyTask on @pQueue, whose ends are set by @locate,
+/// or record it in the graph @pQueue is capturing, the returned future is
+/// then ready
+template <typename Locate>
+completion_future copy_launch(const std::shared_ptr<Kalmar::KalmarQueue>& pQueue, Locate locate) {
+    if (const std::shared_ptr<Kalmar::CPUGraph>& graph = pQueue->get_capture()) {
+        std::unique_ptr<Kalmar::CPUCopyStage> stage(new Kalmar::CPUCopyStage());
+        try {
+            locate(*stage);
+        } catch (...) {
+            std::exception_ptr error = std::current_exception();
+            return copy_eagerly([error] { std::rethrow_exception(error); });
+        }
+        const size_t size = stage->getSize();
+        graph->record(stage.release(), size);
+        return copy_eagerly([] {});
+    }
+    auto task = std::make_shared<Kalmar::CPUCopyTask>(pQueue);
+    try {
+        locate(*task);
+    } catch (...) {
+        task->finish();
+        std::exception_ptr error = std::current_exception();
+        return copy_eagerly([error] { std::rethrow_exception(error); });
+    }
+    std::shared_ptr<Kalmar::KalmarAsyncOp> op = Kalmar::launch_cpu_copy_async(pQueue, task);
+    return op ? completion_future(op) : copy_eagerly([] {});
+}
+
+/// enqueue the copy of @src to @dest on the CPU runtime, both of them flat
+/// arrays or array_views of the same extent
+/// @arrays: queues of the arrays among them
+/// return an invalid completion_future if it can't be enqueued
+template <typename Src, typename Dst>
+completion_future copy_enqueue(const Src& src, const Dst& dest,
+                               std::initializer_list<std::shared_ptr<Kalmar::KalmarQueue>> arrays) {
+    std::shared_ptr<Kalmar::KalmarQueue> pQueue = copy_queue(arrays);
+    if (pQueue && (!is_flat(src) || !is_flat(dest) || src.get_extent() != dest.get_extent()))
+        return copy_capture_error(pQueue);
+    if (!pQueue)
+        return completion_future();
+    const size_t count = dest.get_extent().size();
+    return copy_launch(pQueue, [&](Kalmar::CPUCopyEnds& task) {
+        task.set_source(src.internal(), flat_offset(src), count);
+        task.set_dest(dest.internal(), flat_offset(dest), count);
+    });
+}
+
+/// enqueue the copy of contiguous host memory at @src, nullptr if it is not,
+/// to @dest
+template <typename Dst>
+completion_future copy_enqueue(const void* src, const Dst& dest,
+                               std::initializer_list<std::shared_ptr<Kalmar::KalmarQueue>> arrays) {
+    std::shared_ptr<Kalmar::KalmarQueue> pQueue = copy_queue(arrays);
+    if (pQueue && (!src || !is_flat(dest)))
+        return copy_capture_error(pQueue);
+    if (!pQueue)
+        return completion_future();
+    return copy_launch(pQueue, [&](Kalmar::CPUCopyEnds& task) {
+        task.set_dest(dest.internal(), flat_offset(dest), dest.get_extent().size());
+        task.set_source(src);
+    });
+}
+
+/// enqueue the copy of @src to contiguous host memory at @dest, nullptr if it
+/// is not
+template <typename Src>
+completion_future copy_enqueue(const Src& src, void* dest,
+                               std::initializer_list<std::shared_ptr<Kalmar::KalmarQueue>> arrays) {
+    std::shared_ptr<Kalmar::KalmarQueue> pQueue = copy_queue(arrays);
+    if (pQueue && (!dest || !is_flat(src)))
+        return copy_capture_error(pQueue);
+    if (!pQueue)
+        return completion_future();
+    return copy_launch(pQueue, [&](Kalmar::CPUCopyEnds& task) {
+        task.set_source(src.internal(), flat_offset(src), src.get_extent().size());
+        task.set_dest(dest);
+    });
+}
+#endif
 
 // ------------------------------------------------------------------------
 // copy_async
 // ------------------------------------------------------------------------
 
+// On the CPU runtime, a copy between flat arrays and array_views, or between
+// one of them and contiguous host memory, is enqueued on the view of the array
+// it involves, or else on the default view, and executed by the copy workers
+// while the host and the other queues carry on. Other copies are done before
+// copy_async returns.
+
 /**
  * The contents of "src" are copied into "dest". The source and destination may
  * reside on different accelerators. If the extents of "src" and "dest" don't
@@ -6106,8 +6591,12 @@ void copy(const array_view<T, N> &src, OutputIter destBegin) {
  */
 template <typename T, int N>
 completion_future copy_async(const array<T, N>& src, array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av(), src.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 /**
@@ -6119,8 +6608,12 @@ completion_future copy_async(const array<T, N>& src, array<T, N>& dest) {
  */
 template <typename T, int N>
 completion_future copy_async(const array<T, N>& src, const array_view<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {src.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 /** @{ */
@@ -6134,14 +6627,22 @@ completion_future copy_async(const array<T, N>& src, const array_view<T, N>& des
  */
 template <typename T, int N>
 completion_future copy_async(const array_view<const T, N>& src, array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 template <typename T, int N>
 completion_future copy_async(const array_view<T, N>& src, array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 /** @} */
@@ -6157,14 +6658,22 @@ completion_future copy_async(const array_view<T, N>& src, array<T, N>& dest) {
  */
 template <typename T, int N>
 completion_future copy_async(const array_view<const T, N>& src, const array_view<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 template <typename T, int N>
 completion_future copy_async(const array_view<T, N>& src, const array_view<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 /** @} */
@@ -6185,14 +6694,28 @@ completion_future copy_async(const array_view<T, N>& src, const array_view<T, N>
  */
 template <typename InputIter, typename T, int N>
 completion_future copy_async(InputIter srcBegin, InputIter srcEnd, array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&, srcBegin, srcEnd]() mutable { copy(srcBegin, srcEnd, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    const void* src = srcBegin != srcEnd ? contiguous_address<T>(srcBegin) : nullptr;
+    if (src && size_t(std::distance(srcBegin, srcEnd)) == dest.get_extent().size()) {
+        completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av()});
+        if (fut.valid())
+            return fut;
+    }
+#endif
+    return copy_eagerly([&] { copy(srcBegin, srcEnd, dest); });
 }
 
 template <typename InputIter, typename T, int N>
 completion_future copy_async(InputIter srcBegin, array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&, srcBegin]() mutable { copy(srcBegin, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    const void* src = dest.get_extent().size() > 0 ? contiguous_address<T>(srcBegin) : nullptr;
+    if (src) {
+        completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av()});
+        if (fut.valid())
+            return fut;
+    }
+#endif
+    return copy_eagerly([&] { copy(srcBegin, dest); });
 }
 
 /** @} */
@@ -6213,14 +6736,28 @@ completion_future copy_async(InputIter srcBegin, array<T, N>& dest) {
  */
 template <typename InputIter, typename T, int N>
 completion_future copy_async(InputIter srcBegin, InputIter srcEnd, const array_view<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&, srcBegin, srcEnd]() mutable { copy(srcBegin, srcEnd, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    const void* src = srcBegin != srcEnd ? contiguous_address<T>(srcBegin) : nullptr;
+    if (src && size_t(std::distance(srcBegin, srcEnd)) == dest.get_extent().size()) {
+        completion_future fut = copy_enqueue(src, dest, {});
+        if (fut.valid())
+            return fut;
+    }
+#endif
+    return copy_eagerly([&] { copy(srcBegin, srcEnd, dest); });
 }
 
 template <typename InputIter, typename T, int N>
 completion_future copy_async(InputIter srcBegin, const array_view<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&, srcBegin]() mutable { copy(srcBegin, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    const void* src = dest.get_extent().size() > 0 ? contiguous_address<T>(srcBegin) : nullptr;
+    if (src) {
+        completion_future fut = copy_enqueue(src, dest, {});
+        if (fut.valid())
+            return fut;
+    }
+#endif
+    return copy_eagerly([&] { copy(srcBegin, dest); });
 }
 
 /** @} */
@@ -6237,8 +6774,13 @@ completion_future copy_async(InputIter srcBegin, const array_view<T, N>& dest) {
  */
 template <typename OutputIter, typename T, int N>
 completion_future copy_async(const array<T, N>& src, OutputIter destBegin) {
-    std::future<void> fut = std::async(std::launch::deferred, [&, destBegin]() mutable { copy(src, destBegin); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    void* dest = src.get_extent().size() > 0 ? contiguous_address<T>(destBegin) : nullptr;
+    completion_future fut = copy_enqueue(src, dest, {src.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, destBegin); });
 }
 
 /**
@@ -6253,28 +6795,45 @@ completion_future copy_async(const array<T, N>& src, OutputIter destBegin) {
  */
 template <typename OutputIter, typename T, int N>
 completion_future copy_async(const array_view<T, N>& src, OutputIter destBegin) {
-    std::future<void> fut = std::async(std::launch::deferred, [&, destBegin]() mutable { copy(src, destBegin); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    void* dest = src.get_extent().size() > 0 ? contiguous_address<T>(destBegin) : nullptr;
+    completion_future fut = copy_enqueue(src, dest, {});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, destBegin); });
 }
 
 
 // FIXME: consider remove these functions
 template <typename T, int N>
 completion_future copy_async(const array<T, N>& src, const array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av(), src.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 template <typename T, int N>
 completion_future copy_async(const array_view<const T, N>& src, const array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 template <typename T, int N>
 completion_future copy_async(const array_view<T, N>& src, const array<T, N>& dest) {
-    std::future<void> fut = std::async(std::launch::deferred, [&]() mutable { copy(src, dest); });
-    return completion_future(fut.share());
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+    completion_future fut = copy_enqueue(src, dest, {dest.internal().get_av()});
+    if (fut.valid())
+        return fut;
+#endif
+    return copy_eagerly([&] { copy(src, dest); });
 }
 
 // ------------------------------------------------------------------------
@@ -6394,16 +6953,19 @@ int atomic_compare_exchange_int(int *dest, int expected_val, int val);
 uint64_t atomic_compare_exchange_uint64(uint64_t *dest, uint64_t expected_val, uint64_t val);
 
 static inline bool atomic_compare_exchange(unsigned int *dest, unsigned int *expected_val, unsigned int val) __CPU__ __HC__ {
-  *expected_val = atomic_compare_exchange_unsigned(dest, *expected_val, val);
-  return (*dest == val);
+  auto old = *expected_val;
+  *expected_val = atomic_compare_exchange_unsigned(dest, old, val);
+  return (*expected_val == old);
 }
 static inline bool atomic_compare_exchange(int *dest, int *expected_val, int val) __CPU__ __HC__ {
-  *expected_val = atomic_compare_exchange_int(dest, *expected_val, val);
-  return (*dest == val);
+  auto old = *expected_val;
+  *expected_val = atomic_compare_exchange_int(dest, old, val);
+  return (*expected_val == old);
 }
 static inline bool atomic_compare_exchange(uint64_t *dest, uint64_t *expected_val, uint64_t val) __CPU__ __HC__ {
-  *expected_val = atomic_compare_exchange_uint64(dest, *expected_val, val);
-  return (*dest == val);
+  auto old = *expected_val;
+  *expected_val = atomic_compare_exchange_uint64(dest, old, val);
+  return (*expected_val == old);
 }
 #else
 extern bool atomic_compare_exchange(unsigned int *dest, unsigned int *expected_val, unsigned int val) __CPU__ __HC__;
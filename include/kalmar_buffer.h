@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <kalmar_index.h>
 #include <kalmar_runtime.h>
 #include <kalmar_serialize.h>
 
@@ -32,6 +33,8 @@ public:
     T* get_device_pointer() const restrict(cpu, amp) { return p_; }
     std::shared_ptr<KalmarQueue> get_av() const { return nullptr; }
     void reset() const {}
+    template <typename Index, typename Extent>
+        void set_section(int, const Index&, const Extent&, const Extent&) restrict(cpu, amp) {}
 
     T* map_ptr(bool modify, size_t count, size_t offset) const { return nullptr; }
     void unmap_ptr(const void* addr, bool modify, size_t count, size_t offset) const {}
@@ -40,6 +43,9 @@ public:
     void copy(_data<T> other, int, int, int) const {}
     void write(const T*, int , int offset = 0, bool blocking = false) const {}
     void read(T*, int , int offset = 0) const {}
+    void copy_rect(_data<T> other, const KalmarRect&) const {}
+    void write_rect(const T*, const KalmarRect&, bool blocking = false) const {}
+    void read_rect(typename std::remove_const<T>::type*, const KalmarRect&) const {}
     void refresh() const {}
     void set_const() const {}
     access_type get_access() const { return access_type_auto; }
@@ -53,33 +59,52 @@ template <typename T>
 class _data_host {
     mutable std::shared_ptr<rw_info> mm;
     bool isArray;
+    /// byte range of the buffer spanned by the view, coherence actions of the
+    /// view are limited to it
+    size_t begin;
+    size_t end;
     template <typename U> friend class _data_host;
 public:
     _data_host(size_t count, const void* src = nullptr)
         : mm(std::make_shared<rw_info>(count*sizeof(T), const_cast<void*>(src))),
-        isArray(false) {}
+        isArray(false), begin(0), end(SIZE_MAX) {}
 
     _data_host(std::shared_ptr<KalmarQueue> av, std::shared_ptr<KalmarQueue> stage, int count,
                access_type mode)
-        : mm(std::make_shared<rw_info>(av, stage, count*sizeof(T), mode)), isArray(true) {}
+        : mm(std::make_shared<rw_info>(av, stage, count*sizeof(T), mode)), isArray(true),
+        begin(0), end(SIZE_MAX) {}
 
     _data_host(std::shared_ptr<KalmarQueue> av, std::shared_ptr<KalmarQueue> stage, int count,
                void* device_pointer, access_type mode)
-        : mm(std::make_shared<rw_info>(av, stage, count*sizeof(T), device_pointer, mode)), isArray(true) {}
+        : mm(std::make_shared<rw_info>(av, stage, count*sizeof(T), device_pointer, mode)), isArray(true),
+        begin(0), end(SIZE_MAX) {}
 
-    _data_host(const _data_host& other) : mm(other.mm), isArray(false) {}
+    _data_host(const _data_host& other) : mm(other.mm), isArray(false), begin(other.begin), end(other.end) {}
 
     template <typename U>
-        _data_host(const _data_host<U>& other) : mm(other.mm), isArray(false) {}
+        _data_host(const _data_host<U>& other) : mm(other.mm), isArray(false), begin(other.begin), end(other.end) {}
+
+    /// limit the view to the section of extent @ext at @base in a view of
+    /// extent @base_ext starting at element @offset
+    template <typename Index, typename Extent>
+        void set_section(int offset, const Index& base, const Extent& ext, const Extent& base_ext) {
+            if (ext.size() == 0)
+                return;
+            Index last(base);
+            for (int i = 0; i < Index::rank; ++i)
+                last[i] += ext[i] - 1;
+            begin = (offset + amp_helper<Index::rank, Index, Extent>::flatten(base, base_ext)) * sizeof(T);
+            end = (offset + amp_helper<Index::rank, Index, Extent>::flatten(last, base_ext) + 1) * sizeof(T);
+        }
 
     T *get() const { return static_cast<T*>(mm->data); }
     T* get_device_pointer() const { return static_cast<T*>(mm->get_device_pointer()); }
     void synchronize(bool modify = false) const { mm->synchronize(modify); }
-    void discard() const { mm->disc(); }
+    void discard() const { mm->disc(begin, end); }
     void refresh() const {}
     size_t size() const { return mm->count; }
     void reset() const { mm.reset(); }
-    void get_cpu_access(bool modify = false) const { mm->get_cpu_access(modify); }
+    void get_cpu_access(bool modify = false) const { mm->get_cpu_access(modify, begin, end); }
     std::shared_ptr<KalmarQueue> get_av() const { return mm->master; }
     std::shared_ptr<KalmarQueue> get_stage() const { return mm->stage; }
     access_type get_access() const { return mm->mode; }
@@ -92,16 +117,33 @@ public:
     void read(T* dst, int size, int offset = 0) const {
         mm->read(dst, size * sizeof(T), offset * sizeof(T));
     }
+    /// strided copies, @rect is in bytes
+    void copy_rect(_data_host<T> other, const KalmarRect& rect) const {
+        mm->copy_rect(other.mm.get(), rect);
+    }
+    void write_rect(const T* src, const KalmarRect& rect, bool blocking = false) const {
+        mm->write_rect(src, rect, blocking);
+    }
+    void read_rect(typename std::remove_const<T>::type* dst, const KalmarRect& rect) const {
+        mm->read_rect(dst, rect);
+    }
     T* map_ptr(bool modify, size_t count, size_t offset) const {
         return (T*)mm->map(count * sizeof(T), offset * sizeof(T), modify);
     }
     void unmap_ptr(const void* addr, bool modify, size_t count, size_t offset) const { return mm->unmap(const_cast<void*>(addr), count * sizeof(T), offset * sizeof(T), modify); }
-    void sync_to(std::shared_ptr<KalmarQueue> pQueue) const { mm->sync(pQueue, false); }
+    void sync_to(std::shared_ptr<KalmarQueue> pQueue) const { mm->sync(pQueue, false, true, begin, end); }
 
     __attribute__((annotate("serialize")))
         void __cxxamp_serialize(Serialize& s) const {
-            s.visit_buffer(mm.get(), !std::is_const<T>::value, isArray);
+            s.visit_buffer_of(this, &revisit, mm.get(), !std::is_const<T>::value, isArray, begin, end);
         }
+    static void revisit(const void* self, Serialize& s) {
+        static_cast<const _data_host*>(self)->__cxxamp_serialize(s);
+    }
+    /// visit the @count elements at @offset, for a copy using only them
+    void visit_range(Serialize& s, bool modify, size_t offset, size_t count) const {
+        s.visit_buffer(mm.get(), modify, isArray, offset * sizeof(T), (offset + count) * sizeof(T));
+    }
     __attribute__((annotate("user_deserialize")))
         explicit _data_host(typename std::remove_const<T>::type* t) {}
 };
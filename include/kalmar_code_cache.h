@@ -0,0 +1,247 @@
+//===----------------------------------------------------------------------===//
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <kalmar_defines.h>
+
+#include <cstdio>
+#include <functional>
+#include <iostream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** \cond HIDDEN_SYMBOLS */
+namespace Kalmar {
+
+/// on-disk cache of finalized kernel code objects, shared across processes
+///
+/// An entry is addressed by the identity of the embedded program, the target,
+/// i.e. the ISA or name of the device and the version of the driver or runtime
+/// loading the code, and the options given to the finalizer, so a change to
+/// any of them misses the cache instead of loading stale code. Entries are written
+/// to a temporary file and renamed into place, so concurrent processes never
+/// see a partial entry. The cache is trimmed to its capacity after each
+/// store, dropping the entries used least recently first.
+///
+/// Runtimes finalizing kernels at load time call load() before finalizing and
+/// store() after, see HCC_CACHE_DIR and HCC_CACHE_SIZE. An entry the driver
+/// still rejects is finalized again and replaced.
+class KalmarCodeCache
+{
+    /// directory of the entries, empty if the cache is disabled
+    std::string dir;
+    /// maximum total size of the entries in bytes
+    uint64_t capacity;
+
+    static const uint32_t magic = 0x4b434348; // "HCCK"
+    static const uint32_t version = 1;
+
+    /// key of an entry, also stored in the entry to detect hash collisions
+    static std::string key(const std::string& program, const std::string& target,
+                           const std::string& options) {
+        std::string k(program);
+        k.append(1, '\0').append(target).append(1, '\0').append(options);
+        return k;
+    }
+
+    std::string path(const std::string& k) const {
+        // FNV-1a
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (unsigned char c : k) {
+            h ^= c;
+            h *= 0x100000001b3ULL;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(h));
+        return dir + "/" + name;
+    }
+
+    static bool write_all(int fd, const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd, p, size);
+            if (n <= 0)
+                return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    /// create @d and its parents, and check the cache is private to the user
+    static bool prepare(const std::string& d) {
+        for (size_t pos = 1; pos <= d.size(); ++pos) {
+            if (pos == d.size() || d[pos] == '/')
+                mkdir(d.substr(0, pos).c_str(), 0700);
+        }
+        struct stat st;
+        if (stat(d.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+            return false;
+        // never load code objects other users could have planted
+        return st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+    }
+
+public:
+    /// default capacity in MB, see HCC_CACHE_SIZE
+    static const uint64_t defaultCapacityMB = 512;
+
+    KalmarCodeCache(const std::string& dir, uint64_t capacity)
+        : dir(dir), capacity(capacity) {
+        if (this->dir.empty() || capacity == 0 || !prepare(this->dir))
+            this->dir.clear();
+    }
+
+    /// the cache configured by HCC_CACHE_DIR and HCC_CACHE_SIZE
+    static KalmarCodeCache& getInstance() {
+        static KalmarCodeCache cache(DetermineDir(), DetermineCapacity());
+        return cache;
+    }
+
+    static std::string DetermineDir() {
+        char* dir_env = getenv("HCC_CACHE_DIR");
+        if (dir_env != nullptr)
+            return dir_env;
+        return "/tmp/hcc-cache-" + std::to_string(geteuid());
+    }
+
+    static uint64_t DetermineCapacity() {
+        uint64_t mb = defaultCapacityMB;
+        char* size_env = getenv("HCC_CACHE_SIZE");
+        if (size_env != nullptr) {
+            char* end = nullptr;
+            unsigned long long v = strtoull(size_env, &end, 10);
+            if (end != size_env && *end == '\0')
+                mb = v;
+            else
+                std::cerr << "Ignore unknown HCC_CACHE_SIZE environment variable: " << size_env << std::endl;
+        }
+        return mb << 20;
+    }
+
+    bool enabled() const { return !dir.empty(); }
+    const std::string& get_dir() const { return dir; }
+    uint64_t get_capacity() const { return capacity; }
+
+    /// read the code object of @program finalized for @target with @options
+    /// return false if there is no valid entry
+    bool load(const std::string& program, const std::string& target,
+              const std::string& options, std::vector<char>& code) const {
+        if (!enabled())
+            return false;
+        std::string k = key(program, target, options);
+        std::string p = path(k);
+        int fd = open(p.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        bool found = false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            std::vector<char> entry(st.st_size);
+            if (::read(fd, entry.data(), entry.size()) == static_cast<ssize_t>(entry.size())) {
+                const char* e = entry.data();
+                const size_t header = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+                uint32_t m, v;
+                uint64_t klen, clen;
+                if (entry.size() >= header) {
+                    memcpy(&m, e, sizeof(m));
+                    memcpy(&v, e + 4, sizeof(v));
+                    memcpy(&klen, e + 8, sizeof(klen));
+                    memcpy(&clen, e + 16, sizeof(clen));
+                    found = m == magic && v == version && klen == k.size() &&
+                            entry.size() == header + klen + clen &&
+                            memcmp(e + header, k.data(), klen) == 0;
+                    if (found)
+                        code.assign(e + header + klen, e + header + klen + clen);
+                }
+            }
+        }
+        close(fd);
+        // mark the entry as recently used for eviction
+        if (found)
+            utimes(p.c_str(), nullptr);
+        return found;
+    }
+
+    /// add the code object of @program finalized for @target with @options
+    /// return false if the entry could not be written
+    bool store(const std::string& program, const std::string& target,
+               const std::string& options, const void* code, size_t size) {
+        if (!enabled())
+            return false;
+        std::string k = key(program, target, options);
+        std::string p = path(k);
+        std::string tmp = p + "." + std::to_string(getpid()) + "." +
+                          std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            return false;
+        uint32_t m = magic, v = version;
+        uint64_t klen = k.size(), clen = size;
+        bool ok = write_all(fd, &m, sizeof(m)) && write_all(fd, &v, sizeof(v)) &&
+                  write_all(fd, &klen, sizeof(klen)) && write_all(fd, &clen, sizeof(clen)) &&
+                  write_all(fd, k.data(), k.size()) && write_all(fd, code, size);
+        ok = (close(fd) == 0) && ok;
+        if (ok)
+            ok = rename(tmp.c_str(), p.c_str()) == 0;
+        if (!ok) {
+            unlink(tmp.c_str());
+            return false;
+        }
+        trim();
+        return true;
+    }
+
+    /// remove entries used least recently until the cache fits its capacity
+    void trim() {
+        if (!enabled())
+            return;
+        DIR* d = opendir(dir.c_str());
+        if (!d)
+            return;
+        struct Entry {
+            std::string path;
+            struct timespec used;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        while (struct dirent* ent = readdir(d)) {
+            std::string name(ent->d_name);
+            if (name.size() < 4 || name.compare(name.size() - 4, 4, ".bin") != 0)
+                continue;
+            std::string p = dir + "/" + name;
+            struct stat st;
+            if (stat(p.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+                continue;
+            entries.push_back({p, st.st_mtim, static_cast<uint64_t>(st.st_size)});
+            total += st.st_size;
+        }
+        closedir(d);
+        if (total <= capacity)
+            return;
+        std::sort(std::begin(entries), std::end(entries), [](const Entry& a, const Entry& b) {
+            return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec
+                                                  : a.used.tv_nsec < b.used.tv_nsec;
+        });
+        for (const Entry& e : entries) {
+            if (total <= capacity)
+                break;
+            // another process may have evicted it already
+            unlink(e.path.c_str());
+            total -= e.size;
+        }
+    }
+};
+
+} // namespace Kalmar
+/** \endcond */
@@ -15,34 +15,667 @@ namespace Kalmar {
 template <int D0, int D1=0, int D2=0> class tiled_extent;
 
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
-static const unsigned int NTHREAD = std::thread::hardware_concurrency();
+#if defined(__x86_64__)
+#define KALMAR_CPU_FIBER 1
+/// save callee-saved registers on the current stack, store the stack pointer
+/// to *from and resume the fiber whose stack pointer is to
+extern "C" void kalmar_fiber_switch(void **from, void *to);
+/// first frame of a new fiber, calls entry(arg) prepared by CPUFiber::make
+extern "C" void kalmar_fiber_entry();
+#endif
+
+/// user-space context of a work-item in a tile on CPU path
+///
+/// Switching between fibers saves only the callee-saved registers and the
+/// stack pointer, while swapcontext also saves the signal mask with a syscall
+/// at every tile barrier.
+struct CPUFiber
+{
+    void *sp;
+    const void *kernel;
+    void *index;
+
+#if KALMAR_CPU_FIBER
+    /// prepare @stack of @size bytes to call entry(this) on the first resume
+    void make(char *stack, size_t size, void (*entry)(void*)) {
+        /// initial frame popped by kalmar_fiber_switch: SSE and x87 control
+        /// words, r15, r14, r13, r12, rbx, rbp and the return address
+        uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~uintptr_t(15);
+        uint64_t *frame = reinterpret_cast<uint64_t*>(top) - 8;
+        frame[0] = 0x1f80 | (uint64_t(0x037f) << 32);
+        frame[1] = 0;
+        frame[2] = 0;
+        frame[3] = reinterpret_cast<uint64_t>(entry);
+        frame[4] = reinterpret_cast<uint64_t>(this);
+        frame[5] = 0;
+        frame[6] = 0;
+        frame[7] = reinterpret_cast<uint64_t>(&kalmar_fiber_entry);
+        sp = frame;
+    }
+    static void swap(CPUFiber& from, CPUFiber& to) { kalmar_fiber_switch(&from.sp, to.sp); }
+    /// leave a finished fiber for good
+    static void exit(CPUFiber& to) {
+        void *dead;
+        kalmar_fiber_switch(&dead, to.sp);
+    }
+#endif
+};
+
+/// per-thread storage to execute tiles of a given size on CPU path
+///
+/// Coroutine stacks, contexts and tiled_index objects of a tile are kept by
+/// each worker thread and reused by later tiled launches of the same size.
+template <typename Barrier, typename TiledIndex>
+struct CPUTileStorage
+{
+    /// size of the stack of each work-item, see HCC_CPU_TILE_STACK_SIZE
+    const size_t stackSize;
+    std::unique_ptr<char[]> stack;
+    std::unique_ptr<TiledIndex[]> index;
+    std::shared_ptr<Barrier> barrier;
+
+    explicit CPUTileStorage(int count)
+        : stackSize(CLAMP::get_cpu_tile_stack_size()),
+          stack(new char[count * stackSize]),
+          index(new TiledIndex[count]),
+          barrier(std::make_shared<Barrier>(count)) {}
+
+    /// destroy a tiled_index of the previous tile before constructing a new one
+    void release(TiledIndex *tidx) { tidx->~TiledIndex(); }
+
+    /// get storage for tiles of @count work-items on the calling thread
+    static CPUTileStorage& get(int count) {
+        static thread_local std::map<int, std::unique_ptr<CPUTileStorage>> cache;
+        std::unique_ptr<CPUTileStorage>& tile = cache[count];
+        if (!tile)
+            tile.reset(new CPUTileStorage(count));
+        return *tile;
+    }
+};
+
+/// execute work-items of a flat kernel at @idx, with the innermost index
+/// ranging over [first, last)
+///
+/// The row is executed as SIMD lanes without proving the iterations
+/// independent, which miscompiles kernels whose work-items alias, such as
+/// scatter writes, atomics or av[idx[i]]. Only used if HCC_CPU_SIMD=ON, for
+/// programs whose flat kernels are all free of such aliasing.
+template <typename Kernel, typename Index>
+inline void run_cpu_row_simd(Kernel& k, const Index& idx, int first, int last) {
+#if defined(__clang__)
+#pragma clang loop vectorize(assume_safety) interleave(enable)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+    for (int i = first; i < last; ++i) {
+        Index lane(idx);
+        lane[Index::rank - 1] = i;
+        k(lane);
+    }
+}
+
+/// default loop over a row, only vectorized by the compiler when it can
+/// prove that doing so is safe
+template <typename Kernel, typename Index>
+inline void run_cpu_row(Kernel& k, const Index& idx, int first, int last) {
+    for (int i = first; i < last; ++i) {
+        Index lane(idx);
+        lane[Index::rank - 1] = i;
+        k(lane);
+    }
+}
 
-template <typename Kernel>
-class CPUKernelRAII
+/// adapts a partitioned CPU kernel to KalmarCPUTask
+/// a chunk of work units executes partition(f, domain, begin, end)
+///
+/// The kernel and its domain are copied into the task, so it may outlive the
+/// launch when it executes asynchronously. Buffers captured by the kernel are
+/// made resident on the queue when the task is created, and their data
+/// pointers stay swapped to the device copies until finish() is called.
+template <typename Kernel, typename Domain>
+class CPUKernelTask final : public KalmarCPUTask
 {
-    const std::shared_ptr<Kalmar::KalmarQueue> pQueue;
-    const Kernel& f;
-    std::vector<std::thread> th;
+    typedef void (*partition_t)(const Kernel&, const Domain&, size_t, size_t);
+    partition_t partition;
+    const Kernel f;
+    const Domain domain;
+    size_t size;
+    CPUVisitor vis;
 public:
-    CPUKernelRAII(const std::shared_ptr<Kalmar::KalmarQueue> pQueue, const Kernel& f)
-        : pQueue(pQueue), f(f), th(NTHREAD) {
-        CPUVisitor vis(pQueue);
+    CPUKernelTask(const std::shared_ptr<KalmarQueue>& pQueue, partition_t partition,
+                  const Kernel& f, const Domain& domain, size_t size)
+        : partition(partition), f(f), domain(domain), size(size), vis(pQueue) {
         Serialize s(&vis);
-        f.__cxxamp_serialize(s);
-        CLAMP::enter_kernel();
+        this->f.__cxxamp_serialize(s);
+    }
+    size_t getSize() const override { return size; }
+    void run(size_t begin, size_t end) override {
+        CLAMP::kernel_scope scope;
+        partition(f, domain, begin, end);
+    }
+    void finish() override { vis.restore(); }
+    const std::vector<CPUBufferAccess>* getAccesses() const override { return &vis.get_accesses(); }
+
+    /// mark the buffers used by the kernel as in use until @future is ready
+    void set_pending(const std::shared_future<void>& future) { vis.set_pending(future); }
+};
+
+/// execute @size work units of the kernel on @pQueue and wait for them
+template <typename Kernel, typename Domain>
+void launch_cpu_kernel(const std::shared_ptr<KalmarQueue>& pQueue,
+                       void (*partition)(const Kernel&, const Domain&, size_t, size_t),
+                       const Kernel& f, const Domain& domain, size_t size) {
+    CPUKernelTask<Kernel, Domain> task(pQueue, partition, f, domain, size);
+    pQueue->LaunchCPUTask(&task);
+}
+
+/// enqueue @size work units of the kernel on @pQueue without waiting
+/// return nullptr if the queue executed the kernel before returning
+template <typename Kernel, typename Domain>
+std::shared_ptr<KalmarAsyncOp>
+launch_cpu_kernel_async(const std::shared_ptr<KalmarQueue>& pQueue,
+                        void (*partition)(const Kernel&, const Domain&, size_t, size_t),
+                        const Kernel& f, const Domain& domain, size_t size) {
+    auto task = std::make_shared<CPUKernelTask<Kernel, Domain>>(pQueue, partition, f, domain, size);
+    std::shared_ptr<KalmarAsyncOp> op = pQueue->LaunchCPUTaskAsync(task);
+    if (op)
+        task->set_pending(*op->getFuture());
+    return op;
+}
+
+/// kernel recorded in a CPUFusedTask
+class CPUFusedStage
+{
+public:
+    virtual ~CPUFusedStage() {}
+    virtual void serialize(Serialize& s) const = 0;
+    virtual void run(size_t begin, size_t end) const = 0;
+};
+
+template <typename Kernel, typename Domain>
+class CPUKernelStage final : public CPUFusedStage
+{
+    typedef void (*partition_t)(const Kernel&, const Domain&, size_t, size_t);
+    partition_t partition;
+    const Kernel f;
+    const Domain domain;
+public:
+    CPUKernelStage(partition_t partition, const Kernel& f, const Domain& domain)
+        : partition(partition), f(f), domain(domain) {}
+    void serialize(Serialize& s) const override { f.__cxxamp_serialize(s); }
+    void run(size_t begin, size_t end) const override { partition(f, domain, begin, end); }
+};
+
+/// collect the buffers used by a kernel without touching them
+class CPUAccessRecorder : public FunctorBufferWalker
+{
+    std::vector<CPUBufferAccess>& accesses;
+public:
+    explicit CPUAccessRecorder(std::vector<CPUBufferAccess>& accesses) : accesses(accesses) {}
+    void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                      size_t begin, size_t end) override {
+        for (CPUBufferAccess& a : accesses) {
+            if (a.rw == rw && a.begin == begin && a.end == end) {
+                a.modify |= modify;
+                return;
+            }
+        }
+        accesses.push_back({rw, begin, end, modify, isArray});
+    }
+};
+
+/// ends of a copy of a range of bytes between buffers or host memory, see
+/// CPUCopyTask and CPUCopyStage
+class CPUCopyEnds
+{
+    /// keep the buffers alive as long as the copy may execute
+    std::vector<std::shared_ptr<const void>> holders;
+
+protected:
+    const char* src;
+    char* dst;
+    size_t count;
+
+    /// first byte of the range @a of a buffer used by the copy
+    virtual char* place(const CPUBufferAccess& a) = 0;
+
+    /// locate the @count elements at @offset of @data, a _data_host
+    template <typename Data>
+    char* locate(const Data& data, bool modify, size_t offset, size_t count) {
+        std::vector<CPUBufferAccess> found;
+        CPUAccessRecorder recorder(found);
+        Serialize s(&recorder);
+        data.visit_range(s, modify, offset, count);
+        const CPUBufferAccess& a = found.front();
+        holders.push_back(std::make_shared<Data>(data));
+        this->count = a.end - a.begin;
+        return place(a);
+    }
+
+    /// work units copying @count bytes from @from to @to
+    static size_t chunks(const char* from, const char* to, size_t count) {
+        if (count == 0 || from == to)
+            return 0;
+        return overlapping(from, to, count) ? 1 : (count + chunkSize - 1) / chunkSize;
+    }
+
+    /// execute work units [begin, end) of the copy of @count bytes
+    static void copy(const char* from, char* to, size_t count, size_t begin, size_t end) {
+        if (overlapping(from, to, count)) {
+            memmove(to, from, count);
+            return;
+        }
+        for (size_t chunk = begin; chunk < end; ++chunk) {
+            const size_t first = chunk * chunkSize;
+            memcpy(to + first, from + first, std::min(chunkSize, count - first));
+        }
     }
-    std::thread& operator[](int i) { return th[i]; }
-    ~CPUKernelRAII() {
-        for (auto& t : th)
-            if (t.joinable())
-                t.join();
-        CPUVisitor vis(pQueue);
-        Serialize ss(&vis);
-        f.__cxxamp_serialize(ss);
-        CLAMP::leave_kernel();
+
+    /// both ends of a copy within a buffer may overlap, they are then copied
+    /// as a single work unit
+    static bool overlapping(const char* from, const char* to, size_t count) {
+        return from < to + count && to < from + count;
     }
+
+public:
+    /// bytes copied by a work unit, large enough to amortize claiming it
+    static const size_t chunkSize = 1 << 20;
+
+    CPUCopyEnds() : holders(), src(nullptr), dst(nullptr), count(0) {}
+    virtual ~CPUCopyEnds() {}
+
+    /// copy from the @count elements at @offset of @data
+    template <typename Data>
+    void set_source(const Data& data, size_t offset, size_t count) {
+        src = locate(data, false, offset, count);
+    }
+    /// copy to the @count elements at @offset of @data
+    template <typename Data>
+    void set_dest(const Data& data, size_t offset, size_t count) {
+        dst = locate(data, true, offset, count);
+    }
+    /// copy from host memory, as many bytes as the other end holds
+    void set_source(const void* ptr) { src = static_cast<const char*>(ptr); }
+    /// copy to host memory, as many bytes as the other end holds
+    void set_dest(void* ptr) { dst = static_cast<char*>(ptr); }
 };
 
+/// copy of a range of bytes between buffers or host memory, enqueued on a
+/// queue like a kernel and executed by the copy workers of the CPU runtime
+///
+/// The ends of the copy are located when the task is created. A buffer is
+/// made resident on the queue like the ones captured by a kernel, except for
+/// a view of host memory which the device has not used since the host last
+/// did, it is accessed in place. The task then only moves bytes between the
+/// data pointers, in chunks copied concurrently.
+class CPUCopyTask final : public KalmarCPUTask, public CPUCopyEnds
+{
+    CPUVisitor vis;
+    /// views of host memory accessed in place
+    std::vector<struct rw_info*> hosts;
+
+    char* place(const CPUBufferAccess& a) override {
+        if (!a.isArray && (!a.rw->curr || is_cpu_queue(a.rw->curr))) {
+            a.rw->get_cpu_access(a.modify, a.begin, a.end);
+            hosts.push_back(a.rw);
+        } else
+            vis.visit_buffer(a.rw, a.modify, a.isArray, a.begin, a.end);
+        return static_cast<char*>(a.rw->data) + a.begin;
+    }
+
+public:
+    explicit CPUCopyTask(const std::shared_ptr<KalmarQueue>& pQueue) : vis(pQueue), hosts() {}
+
+    size_t getSize() const override { return chunks(src, dst, count); }
+    void run(size_t begin, size_t end) override { copy(src, dst, count, begin, end); }
+    void finish() override { vis.restore(); }
+    const std::vector<CPUBufferAccess>* getAccesses() const override { return &vis.get_accesses(); }
+    bool isCopy() const override { return true; }
+
+    /// the buffers are in use by the copy until @future is ready, views of
+    /// host memory for any queue
+    void set_pending(const std::shared_future<void>& future) {
+        vis.set_pending(future);
+        for (auto rw : hosts)
+            rw->add_pending(nullptr, future);
+    }
+};
+
+/// enqueue @task on @pQueue without waiting
+/// return nullptr if the queue executed the copy before returning
+inline std::shared_ptr<KalmarAsyncOp>
+launch_cpu_copy_async(const std::shared_ptr<KalmarQueue>& pQueue, const std::shared_ptr<CPUCopyTask>& task) {
+    std::shared_ptr<KalmarAsyncOp> op = pQueue->LaunchCPUTaskAsync(task);
+    if (op)
+        task->set_pending(*op->getFuture());
+    return op;
+}
+
+/// copy recorded in a CPUGraph, between the same bytes at every replay
+///
+/// Its buffers are made resident by the replay along with those of the
+/// kernels, so the ends are located from their data pointers when the copy
+/// executes. Host memory copied from or to must stay valid as long as the
+/// graph may be replayed.
+class CPUCopyStage final : public CPUFusedStage, public CPUCopyEnds
+{
+    /// ranges of the buffers copied from and to, rw is null for host memory
+    CPUBufferAccess from;
+    CPUBufferAccess to;
+
+    char* place(const CPUBufferAccess& a) override {
+        (a.modify ? to : from) = a;
+        return nullptr;
+    }
+    const char* source() const { return from.rw ? static_cast<const char*>(from.rw->data) + from.begin : src; }
+    char* dest() const { return to.rw ? static_cast<char*>(to.rw->data) + to.begin : dst; }
+
+public:
+    CPUCopyStage() : from(), to() {}
+
+    /// work units of the copy, 0 if there is nothing to copy
+    size_t getSize() const {
+        if (count == 0 || (from.rw && from.rw == to.rw && from.begin == to.begin))
+            return 0;
+        if (from.rw && from.rw == to.rw && from.begin < to.begin + count && to.begin < from.begin + count)
+            return 1;
+        return (count + chunkSize - 1) / chunkSize;
+    }
+
+    void serialize(Serialize& s) const override {
+        if (from.rw)
+            s.visit_buffer(from.rw, false, from.isArray, from.begin, from.end);
+        if (to.rw)
+            s.visit_buffer(to.rw, true, to.isArray, to.begin, to.end);
+    }
+    void run(size_t begin, size_t end) const override { copy(source(), dest(), count, begin, end); }
+};
+
+/// brings the range of a view back to the host as array_view::synchronize
+/// does, executed by the copy workers of the CPU runtime after the kernels
+/// of the queue the view was last used by
+///
+/// The whole buffer is taken as written, so that no other kernel of the queue
+/// has its data pointer swapped while the task updates it.
+class CPUSyncTask final : public KalmarCPUTask
+{
+    std::shared_ptr<const void> holder;
+    std::vector<CPUBufferAccess> accesses;
+    struct rw_info* rw;
+    size_t begin, end;
+
+public:
+    /// @data: _data_host of the view
+    template <typename Data>
+    explicit CPUSyncTask(const Data& data) : holder(std::make_shared<Data>(data)), accesses() {
+        CPUAccessRecorder recorder(accesses);
+        Serialize s(&recorder);
+        data.__cxxamp_serialize(s);
+        rw = accesses.front().rw;
+        begin = accesses.front().begin;
+        end = accesses.front().end;
+        accesses.front() = {rw, 0, rw->count, true, accesses.front().isArray};
+    }
+
+    /// queue the data has to be brought back from, nullptr if the host has
+    /// it already
+    /// kernels of any other queue using the buffer are waited for
+    std::shared_ptr<KalmarQueue> get_queue() const {
+        rw->flush_deferred();
+        if (!rw->pending_on(rw->curr.get()))
+            rw->wait_pending();
+        if (!rw->curr || is_cpu_queue(rw->curr))
+            return nullptr;
+        return rw->curr;
+    }
+
+    size_t getSize() const override { return 1; }
+    void run(size_t, size_t) override { rw->update(get_cpu_queue(), false, true, begin, end); }
+    const std::vector<CPUBufferAccess>* getAccesses() const override { return &accesses; }
+    bool isCopy() const override { return true; }
+
+    /// the host waits for the task before using the buffer
+    void set_pending(const std::shared_future<void>& future) { rw->add_pending(nullptr, future); }
+};
+
+/// enqueue the synchronization of the view of @data to the host without
+/// waiting
+/// return nullptr if there is nothing to wait for, the caller synchronizes it
+template <typename Data>
+std::shared_ptr<KalmarAsyncOp> launch_cpu_sync_async(const Data& data) {
+    auto task = std::make_shared<CPUSyncTask>(data);
+    std::shared_ptr<KalmarQueue> pQueue = task->get_queue();
+    if (!pQueue)
+        return nullptr;
+    std::shared_ptr<KalmarAsyncOp> op = pQueue->LaunchCPUTaskAsync(task);
+    if (op)
+        task->set_pending(*op->getFuture());
+    return op;
+}
+
+/// non-tiled kernels recorded on a queue in queuing_mode_deferred, executed
+/// in a single pass over their compute domain
+///
+/// Kernels are only fused on a queue in queuing_mode_deferred_elementwise,
+/// whose kernels promise that work-item idx only reads the elements written
+/// at idx by the kernels before it. Those over the same extent are fused as
+/// long as every buffer written by one of them is accessed by the others
+/// through the same range. Each block of work units is executed by every kernel in turn while
+/// its data is still in cache, instead of one pass over memory per kernel.
+/// Buffers are not made resident until the task is enqueued.
+class CPUFusedTask final : public KalmarCPUTask
+{
+    std::shared_ptr<KalmarQueue> pQueue;
+    std::vector<std::unique_ptr<CPUFusedStage>> stages;
+    std::vector<CPUBufferAccess> accesses;
+    size_t size;
+    std::vector<int> shape;
+    CPUVisitor vis;
+
+public:
+    /// work units executed by a kernel before the next one takes over, small
+    /// enough for the data of a block to stay in cache and large enough to
+    /// keep the rows of each kernel vectorized
+    static const size_t blockSize = 2048;
+
+    CPUFusedTask(const std::shared_ptr<KalmarQueue>& pQueue, CPUFusedStage* stage,
+                 size_t size, std::vector<int> shape)
+        : pQueue(pQueue), stages(), accesses(), size(size), shape(std::move(shape)), vis(pQueue) {
+        stages.emplace_back(stage);
+        CPUAccessRecorder recorder(accesses);
+        Serialize s(&recorder);
+        stage->serialize(s);
+    }
+
+    size_t getSize() const override { return size; }
+
+    void run(size_t begin, size_t end) override {
+        CLAMP::kernel_scope scope;
+        for (size_t first = begin; first < end; first += blockSize) {
+            const size_t last = std::min(end, first + blockSize);
+            for (const auto& stage : stages)
+                stage->run(first, last);
+        }
+    }
+
+    void finish() override { vis.restore(); }
+    const std::vector<CPUBufferAccess>* getAccesses() const override { return &accesses; }
+
+    bool fuse(KalmarCPUTask* task) override {
+        CPUFusedTask* next = dynamic_cast<CPUFusedTask*>(task);
+        if (!next || next->pQueue != pQueue || next->shape != shape ||
+            pQueue->get_mode() != queuing_mode_deferred_elementwise)
+            return false;
+        for (const CPUBufferAccess& a : next->accesses) {
+            for (const CPUBufferAccess& b : accesses) {
+                if (a.rw == b.rw && (a.modify || b.modify) && (a.begin != b.begin || a.end != b.end))
+                    return false;
+            }
+        }
+        for (auto& stage : next->stages)
+            stages.push_back(std::move(stage));
+        next->stages.clear();
+        CPUAccessRecorder recorder(accesses);
+        for (const CPUBufferAccess& a : next->accesses)
+            recorder.visit_buffer(a.rw, a.modify, a.isArray, a.begin, a.end);
+        return true;
+    }
+
+    void enqueue(const std::shared_future<void>& future) override {
+        for (const CPUBufferAccess& a : accesses)
+            a.rw->deferred.reset();
+        Serialize s(&vis);
+        for (const auto& stage : stages)
+            stage->serialize(s);
+        vis.set_pending(future);
+    }
+
+    /// enqueue the kernels deferred by other queues on the buffers of this
+    /// task, they execute before it
+    void flush_others() {
+        for (const CPUBufferAccess& a : accesses) {
+            std::shared_ptr<KalmarQueue> q = a.rw->deferred.lock();
+            if (q && q != pQueue)
+                a.rw->flush_deferred();
+        }
+    }
+
+    /// mark the buffers of this task as used by kernels deferred on its queue
+    void mark_deferred() {
+        for (const CPUBufferAccess& a : accesses)
+            a.rw->deferred = pQueue;
+    }
+};
+
+/// record @size work units of a non-tiled kernel over a compute domain of
+/// @shape on @pQueue in queuing_mode_deferred
+/// return nullptr if the queue executed the kernel before returning
+template <typename Kernel, typename Domain>
+std::shared_ptr<KalmarAsyncOp>
+defer_cpu_kernel(const std::shared_ptr<KalmarQueue>& pQueue,
+                 void (*partition)(const Kernel&, const Domain&, size_t, size_t),
+                 const Kernel& f, const Domain& domain, size_t size, std::vector<int> shape) {
+    auto task = std::make_shared<CPUFusedTask>(pQueue, new CPUKernelStage<Kernel, Domain>(partition, f, domain),
+                                               size, std::move(shape));
+    task->flush_others();
+    std::shared_ptr<KalmarAsyncOp> op = pQueue->DeferCPUTask(task);
+    if (op)
+        task->mark_deferred();
+    return op;
+}
+
+/// commands recorded on a queue between accelerator_view::begin_capture and
+/// end_capture on CPU path, replayed as a single task
+///
+/// The buffers used by the recorded kernels are collected once when the
+/// capture ends, so a replay makes them resident in one pass instead of
+/// walking every kernel, then enqueues one task which executes the kernels
+/// in order on the worker pool instead of allocating and enqueuing each of
+/// them. Copies enqueued by copy_async are recorded as nodes too. Markers
+/// order the commands around them, which the task already does.
+class CPUGraph final : public std::enable_shared_from_this<CPUGraph>
+{
+    /// recorded kernel or copy, or marker if size is 0
+    struct Node {
+        std::unique_ptr<CPUFusedStage> stage;
+        size_t size;
+    };
+
+    /// work units of a node executed on the worker pool
+    class NodeTask final : public KalmarCPUTask
+    {
+        const Node& node;
+    public:
+        explicit NodeTask(const Node& node) : node(node) {}
+        size_t getSize() const override { return node.size; }
+        void run(size_t begin, size_t end) override {
+            CLAMP::kernel_scope scope;
+            node.stage->run(begin, end);
+        }
+    };
+
+    /// a replay of the graph, holding its buffers until it completes
+    class Replay final : public KalmarCPUTask
+    {
+        std::shared_ptr<const CPUGraph> graph;
+        CPUVisitor vis;
+    public:
+        Replay(std::shared_ptr<const CPUGraph> graph, const std::shared_ptr<KalmarQueue>& pQueue)
+            : graph(std::move(graph)), vis(pQueue) {
+            for (const CPUBufferAccess& a : this->graph->accesses)
+                vis.visit_buffer(a.rw, a.modify, a.isArray, a.begin, a.end);
+        }
+        size_t getSize() const override { return 1; }
+        void run(size_t begin, size_t end) override {
+            /// kernels launched from a task execute on the pool in place
+            for (const Node& node : graph->nodes) {
+                if (node.size > 0) {
+                    NodeTask task(node);
+                    graph->pQueue->LaunchCPUTask(&task);
+                }
+            }
+        }
+        void finish() override { vis.restore(); }
+        const std::vector<CPUBufferAccess>* getAccesses() const override { return &graph->accesses; }
+        void set_pending(const std::shared_future<void>& future) { vis.set_pending(future); }
+    };
+
+    std::shared_ptr<KalmarQueue> pQueue;
+    std::mutex lock;
+    std::vector<Node> nodes;
+    std::vector<CPUBufferAccess> accesses;
+
+public:
+    explicit CPUGraph(const std::shared_ptr<KalmarQueue>& pQueue)
+        : pQueue(pQueue), lock(), nodes(), accesses() {}
+
+    /// append a kernel or a copy of @size work units
+    void record(CPUFusedStage* stage, size_t size) {
+        std::lock_guard<std::mutex> lck(lock);
+        nodes.push_back({std::unique_ptr<CPUFusedStage>(stage), size});
+    }
+
+    void record_marker() {
+        std::lock_guard<std::mutex> lck(lock);
+        nodes.push_back({nullptr, 0});
+    }
+
+    size_t get_size() const { return nodes.size(); }
+
+    /// called once the capture is over, before the first replay
+    void end() {
+        std::lock_guard<std::mutex> lck(lock);
+        CPUAccessRecorder recorder(accesses);
+        Serialize s(&recorder);
+        for (const Node& node : nodes)
+            if (node.stage)
+                node.stage->serialize(s);
+    }
+
+    /// enqueue the recorded commands on the queue they were captured from
+    /// return nullptr if the queue executed them before returning
+    std::shared_ptr<KalmarAsyncOp> replay() const {
+        auto task = std::make_shared<Replay>(shared_from_this(), pQueue);
+        std::shared_ptr<KalmarAsyncOp> op = pQueue->LaunchCPUTaskAsync(task);
+        if (op)
+            task->set_pending(*op->getFuture());
+        return op;
+    }
+};
+
+/// record the kernel in the graph @pQueue is capturing, if any
+/// return false if the queue is not capturing
+template <typename Kernel, typename Domain>
+bool capture_cpu_kernel(const std::shared_ptr<KalmarQueue>& pQueue,
+                        void (*partition)(const Kernel&, const Domain&, size_t, size_t),
+                        const Kernel& f, const Domain& domain, size_t size) {
+    const std::shared_ptr<CPUGraph>& graph = pQueue->get_capture();
+    if (!graph)
+        return false;
+    graph->record(new CPUKernelStage<Kernel, Domain>(partition, f, domain), size);
+    return true;
+}
+
 #endif
 
 }
@@ -30,12 +30,222 @@ static inline std::string mcw_cxxamp_fixnames(char *f) restrict(cpu) {
     return out;
 }
 
+#if __KALMAR_ACCELERATOR__ != 1
+/// arguments of a kernel functor as laid out in the kernarg segment, recorded
+/// once per functor type from its __cxxamp_serialize
+///
+/// The serializer of a functor type visits the same members in the same
+/// order at every launch, so the scalars are copied from the functor in runs
+/// of contiguous bytes and only the pointers of the buffers are patched,
+/// instead of walking the functor and pushing the arguments one at a time.
+/// Arguments are aligned to their size as HSADispatch lays them out.
+class KernelArgLayout : public FunctorBufferWalker
+{
+    /// bytes [src, src + size) of the functor copied to dst
+    struct Copy { size_t src; size_t dst; size_t size; };
+    /// address of byte src of the functor stored at dst
+    struct Address { size_t src; size_t dst; };
+    /// device pointer of the buffer held by the object at src of the functor,
+    /// stored at dst
+    struct Buffer { size_t src; void (*revisit)(const void*, Serialize&); size_t dst; };
+
+    /// store the device pointer of each buffer visited to dst, and register
+    /// the buffer with the kernel as Push does, so that the queue orders the
+    /// kernel after the kernels using it
+    class BufferPatcher : public FunctorBufferWalker
+    {
+        const std::shared_ptr<KalmarQueue>& pQueue;
+        void* kernel;
+    public:
+        char* dst;
+        BufferPatcher(const std::shared_ptr<KalmarQueue>& pQueue, void* kernel)
+            : pQueue(pQueue), kernel(kernel), dst(nullptr) {}
+        void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                          size_t begin, size_t end) override {
+            check_array_queue(rw, isArray, pQueue);
+            rw->sync(pQueue, modify, false, begin, end);
+            void* device = rw->devs[pQueue->getDev()].data;
+            memcpy(dst, &device, sizeof(device));
+            pQueue->RegisterBuffer(kernel, device, modify);
+        }
+    };
+
+    std::vector<Copy> copies;
+    std::vector<Address> addresses;
+    std::vector<Buffer> buffers;
+    size_t size;
+    int count;
+    /// false if an argument can't be laid out ahead of the launch
+    bool flat;
+
+    /// functor and buffer holder being recorded
+    const char* base;
+    size_t extent;
+    const void* holder;
+    void (*revisit)(const void*, Serialize&);
+
+    bool inside(const void* p, size_t sz) const {
+        const char* c = static_cast<const char*>(p);
+        return c >= base && c + sz <= base + extent;
+    }
+
+    size_t place(size_t sz) {
+        size_t dst = (size + sz - 1) / sz * sz;
+        size = dst + sz;
+        ++count;
+        return dst;
+    }
+
+public:
+    KernelArgLayout()
+        : copies(), addresses(), buffers(), size(0), count(0), flat(true),
+          base(nullptr), extent(0), holder(nullptr), revisit(nullptr) {}
+
+    template <typename Kernel>
+    void record(const Kernel& f) {
+        base = reinterpret_cast<const char*>(&f);
+        extent = sizeof(Kernel);
+        Serialize s(this);
+        f.__cxxamp_serialize(s);
+        base = nullptr;
+        flat = flat && CLAMP::HasPushArgs();
+    }
+
+    void Append(size_t sz, const void* s) override {
+        if ((sz != 1 && sz != 4 && sz != 8) || !inside(s, sz)) {
+            flat = false;
+            return;
+        }
+        size_t src = static_cast<const char*>(s) - base;
+        size_t dst = place(sz);
+        if (!copies.empty() && copies.back().src + copies.back().size == src &&
+            copies.back().dst + copies.back().size == dst)
+            copies.back().size += sz;
+        else
+            copies.push_back({src, dst, sz});
+    }
+    void AppendPtr(size_t sz, const void* s) override {
+        if (!inside(s, 0)) {
+            flat = false;
+            return;
+        }
+        addresses.push_back({static_cast<size_t>(static_cast<const char*>(s) - base), place(sizeof(void*))});
+    }
+    void locate_buffer(const void* obj, void (*r)(const void*, Serialize&)) override {
+        holder = obj;
+        revisit = r;
+    }
+    void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                      size_t begin, size_t end) override {
+        if (!holder || !inside(holder, 0)) {
+            flat = false;
+            return;
+        }
+        buffers.push_back({static_cast<size_t>(static_cast<const char*>(holder) - base), revisit, place(sizeof(void*))});
+        holder = nullptr;
+    }
+
+    /// push the arguments of functor @f to @kernel on @pQueue
+    /// return false if they have to be walked one at a time instead
+    bool append(const std::shared_ptr<KalmarQueue>& pQueue, const void* f, void* kernel) const {
+        if (!flat)
+            return false;
+        const char* src = static_cast<const char*>(f);
+        char local[256];
+        std::unique_ptr<char[]> heap;
+        char* args = local;
+        if (size > sizeof(local)) {
+            heap.reset(new char[size]);
+            args = heap.get();
+        }
+        memset(args, 0, size);
+        for (const Copy& c : copies)
+            memcpy(args + c.dst, src + c.src, c.size);
+        for (const Address& a : addresses) {
+            const void* p = src + a.src;
+            memcpy(args + a.dst, &p, sizeof(p));
+        }
+        BufferPatcher patcher(pQueue, kernel);
+        Serialize s(&patcher);
+        for (const Buffer& b : buffers) {
+            patcher.dst = args + b.dst;
+            b.revisit(src + b.src, s);
+        }
+        CLAMP::PushArgs(kernel, count, size, args);
+        return true;
+    }
+};
+
+/// per-kernel launch state resolved by the first launch of the kernel
+///
+/// The transformed name and the layout of the arguments are computed once
+/// per Kernel type and the code object of the kernel once per device, so
+/// later launches only create a kernel object from the cached handle, copy
+/// the arguments and enqueue.
+template <typename Kernel>
+class KernelLaunchDescriptor
+{
+    const std::string name;
+    std::mutex lock;
+    /// devices seen so far and the handle of the kernel on each of them
+    std::vector<std::pair<KalmarDevice*, void*>> handles;
+    std::once_flag recorded;
+    KernelArgLayout layout;
+
+    explicit KernelLaunchDescriptor(const std::string& name)
+        : name(name), lock(), handles(), recorded(), layout() {}
+
+    void* find(KalmarDevice* pDev) {
+        std::lock_guard<std::mutex> lck(lock);
+        for (const auto& h : handles)
+            if (h.first == pDev)
+                return h.second;
+        return nullptr;
+    }
+
+public:
+    static KernelLaunchDescriptor& get(const Kernel& f) {
+        static KernelLaunchDescriptor desc(mcw_cxxamp_fixnames(f.__cxxamp_trampoline_name()));
+        return desc;
+    }
+
+    /// create a kernel object on the device of @pQueue
+    void* create(KalmarQueue* pQueue) {
+        KalmarDevice* pDev = pQueue->getDev();
+        void* handle = find(pDev);
+        if (!handle) {
+            handle = CLAMP::GetKernelHandle(name.c_str(), pQueue);
+            /// devices without handles go through the full lookup every time
+            if (!handle)
+                return CLAMP::CreateKernel(name, pQueue);
+            std::lock_guard<std::mutex> lck(lock);
+            handles.emplace_back(pDev, handle);
+        }
+        return pDev->CreateKernelFromHandle(name.c_str(), handle);
+    }
+
+    /// append the arguments of @f to @kernel
+    void append(const std::shared_ptr<KalmarQueue>& pQueue, const Kernel& f, void* kernel) {
+        std::call_once(recorded, [&] { layout.record(f); });
+        if (!layout.append(pQueue, &f, kernel)) {
+            Kalmar::BufferArgumentsAppender vis(pQueue, kernel);
+            Kalmar::Serialize s(&vis);
+            f.__cxxamp_serialize(s);
+        }
+    }
+};
+#endif
+
 template <typename Kernel>
 static void append_kernel(const std::shared_ptr<KalmarQueue>& pQueue, const Kernel& f, void* kernel)
 {
+#if __KALMAR_ACCELERATOR__ != 1
+  KernelLaunchDescriptor<Kernel>::get(f).append(pQueue, f, kernel);
+#else
   Kalmar::BufferArgumentsAppender vis(pQueue, kernel);
   Kalmar::Serialize s(&vis);
   f.__cxxamp_serialize(s);
+#endif
 }
 
 template <typename Kernel>
@@ -63,12 +273,7 @@ mcw_cxxamp_launch_kernel_async(const std::shared_ptr<KalmarQueue>& pQueue, size_
   //this triggers the trampoline code being emitted
   // FIXME: implicitly casting to avoid pointer to int error
   int* foo = reinterpret_cast<int*>(&Kernel::__cxxamp_trampoline);
-  void *kernel = NULL;
-  {
-      std::string transformed_kernel_name =
-          mcw_cxxamp_fixnames(f.__cxxamp_trampoline_name());
-      kernel = CLAMP::CreateKernel(transformed_kernel_name, pQueue.get());
-  }
+  void *kernel = KernelLaunchDescriptor<Kernel>::get(f).create(pQueue.get());
   append_kernel(pQueue, f, kernel);
   return pQueue->LaunchKernelAsync(kernel, dim_ext, ext, local_size);
 #endif
@@ -87,12 +292,7 @@ void mcw_cxxamp_launch_kernel(const std::shared_ptr<KalmarQueue>& pQueue, size_t
   //this triggers the trampoline code being emitted
   // FIXME: implicitly casting to avoid pointer to int error
   int* foo = reinterpret_cast<int*>(&Kernel::__cxxamp_trampoline);
-  void *kernel = NULL;
-  {
-      std::string transformed_kernel_name =
-          mcw_cxxamp_fixnames(f.__cxxamp_trampoline_name());
-      kernel = CLAMP::CreateKernel(transformed_kernel_name, pQueue.get());
-  }
+  void *kernel = KernelLaunchDescriptor<Kernel>::get(f).create(pQueue.get());
   append_kernel(pQueue, f, kernel);
   pQueue->LaunchKernel(kernel, dim_ext, ext, local_size);
 #endif // __KALMAR_ACCELERATOR__
@@ -109,11 +309,7 @@ inline void* mcw_cxxamp_get_kernel(const std::shared_ptr<KalmarQueue>& pQueue, c
   //this triggers the trampoline code being emitted
   // FIXME: implicitly casting to avoid pointer to int error
   int* foo = reinterpret_cast<int*>(&Kernel::__cxxamp_trampoline);
-  void *kernel = NULL;
-  std::string transformed_kernel_name =
-      mcw_cxxamp_fixnames(f.__cxxamp_trampoline_name());
-  kernel = CLAMP::CreateKernel(transformed_kernel_name, pQueue.get());
-  return kernel;
+  return KernelLaunchDescriptor<Kernel>::get(f).create(pQueue.get());
 #else
   return NULL;
 #endif
@@ -2,6 +2,7 @@
 
 #include <kalmar_defines.h>
 #include <kalmar_aligned_alloc.h>
+#include <kalmar_staging_pool.h>
 
 namespace Kalmar {
 namespace enums {
@@ -21,7 +22,15 @@ enum access_type
 enum queuing_mode
 {
     queuing_mode_immediate,
-    queuing_mode_automatic
+    queuing_mode_automatic,
+    /// non-tiled kernels are recorded until the queue is flushed or waited
+    /// for, or the host accesses their buffers, on the CPU runtime
+    queuing_mode_deferred,
+    /// as queuing_mode_deferred, and the recorded kernels over the same
+    /// extent are fused into a single pass
+    /// Only for element-wise kernels: work-item idx must not read an element
+    /// written by an earlier kernel at another index.
+    queuing_mode_deferred_elementwise
 };
 
 enum execute_order
@@ -102,8 +111,122 @@ public:
    * @param mode[in] wait mode, must be one of the value in hcWaitMode enum.
    */
   virtual void setWaitMode(hcWaitMode mode) {}
+
+  /**
+   * Call a function once the async operation has completed, on the thread
+   * completing it or right away if it has.
+   *
+   * @param f[in] function to call, it should return quickly.
+   * @return False if the operation can't notify its completion, the caller
+   *         then has to watch it.
+   */
+  virtual bool notify(std::function<void()> f) { return false; }
+};
+
+/// range [begin, end) of a buffer used by a kernel on CPU path
+struct CPUBufferAccess
+{
+    struct rw_info* rw;
+    size_t begin;
+    size_t end;
+    bool modify;
+    bool isArray;
 };
 
+/// KalmarCPUTask
+///
+/// This is an abstraction of a kernel executed on CPU. The compute domain is
+/// linearized into independent work units (work-items or tiles), which are
+/// handed out in chunks to the worker threads of the CPU runtime.
+class KalmarCPUTask {
+public:
+  virtual ~KalmarCPUTask() {}
+
+  /// get number of work units in the linearized compute domain
+  virtual size_t getSize() const = 0;
+
+  /// execute work units [begin, end)
+  virtual void run(size_t begin, size_t end) = 0;
+
+  /// called once all work units have been executed, before the task is
+  /// reported as complete
+  virtual void finish() {}
+
+  /// append the work of @next, launched after this task on a queue in
+  /// queuing_mode_deferred_elementwise, so that both execute in one pass
+  /// return false if they can't
+  virtual bool fuse(KalmarCPUTask* next) { return false; }
+
+  /// called when a task recorded in queuing_mode_deferred is enqueued, it
+  /// completes with @future
+  virtual void enqueue(const std::shared_future<void>& future) {}
+
+  /// get the buffer ranges used by the task, so that a queue executing in any
+  /// order runs it after the tasks writing what it uses or using what it
+  /// writes, return nullptr if unknown, the task then depends on all of them
+  virtual const std::vector<CPUBufferAccess>* getAccesses() const { return nullptr; }
+
+  /// true if the task only moves data, the CPU runtime executes it on its
+  /// copy workers so that it overlaps with kernels of other queues
+  virtual bool isCopy() const { return false; }
+};
+
+/// KalmarRect
+///
+/// Shape of a strided copy of @slices slices of @rows rows of @width bytes.
+/// On each side rows are @pitch bytes apart and slices @slice_pitch bytes
+/// apart, the first row starting @offset bytes into the buffer.
+struct KalmarRect
+{
+    size_t width;
+    size_t rows;
+    size_t slices;
+    size_t src_offset;
+    size_t src_pitch;
+    size_t src_slice_pitch;
+    size_t dst_offset;
+    size_t dst_pitch;
+    size_t dst_slice_pitch;
+
+    size_t bytes() const { return width * rows * slices; }
+
+    /// offset of row @r of slice @s on each side
+    size_t src_row(size_t s, size_t r) const { return src_offset + s * src_slice_pitch + r * src_pitch; }
+    size_t dst_row(size_t s, size_t r) const { return dst_offset + s * dst_slice_pitch + r * dst_pitch; }
+
+    /// end of the byte range spanned by each side, the rect has to be non
+    /// empty
+    size_t src_end() const { return src_row(slices - 1, rows - 1) + width; }
+    size_t dst_end() const { return dst_row(slices - 1, rows - 1) + width; }
+
+    /// merge rows, then slices, which are contiguous on both sides, so that
+    /// a dense box is copied as a single row
+    void coalesce() {
+        if (rows == 1 || (src_pitch == width && dst_pitch == width)) {
+            src_pitch = src_slice_pitch;
+            dst_pitch = dst_slice_pitch;
+            width *= rows;
+            rows = slices;
+            slices = 1;
+            src_slice_pitch = dst_slice_pitch = 0;
+        }
+        if (rows == 1 || (src_pitch == width && dst_pitch == width)) {
+            width *= rows;
+            rows = 1;
+        }
+    }
+
+    /// call @f with the source and destination offsets of each row
+    template <typename F>
+    void for_each_row(F f) const {
+        for (size_t s = 0; s < slices; ++s)
+            for (size_t r = 0; r < rows; ++r)
+                f(src_row(s, r), dst_row(s, r));
+    }
+};
+
+class CPUGraph;
+
 /// KalmarQueue
 /// This is the implementation of accelerator_view
 /// KalamrQueue is responsible for data operations and launch kernel
@@ -112,7 +235,7 @@ class KalmarQueue
 public:
 
   KalmarQueue(KalmarDevice* pDev, queuing_mode mode = queuing_mode_automatic, execute_order order = execute_in_order)
-      : pDev(pDev), mode(mode), order(order) {}
+      : pDev(pDev), mode(mode), order(order), capture() {}
 
   virtual ~KalmarQueue() {}
 
@@ -131,6 +254,35 @@ public:
   // async kernel launch
   virtual std::shared_ptr<KalmarAsyncOp> LaunchKernelAsync(void *kernel, size_t dim_ext, size_t *ext, size_t *local_size) { return LaunchKernelWithDynamicGroupMemoryAsync(kernel, dim_ext, ext, local_size, 0); }
 
+  /// sync kernel launch on CPU path
+  /// the default implementation splits the task evenly among hardware threads,
+  /// CPU runtime overrides it to execute the task on its worker threads
+  virtual void LaunchCPUTask(KalmarCPUTask *task) {
+      const size_t size = task->getSize();
+      std::vector<std::thread> th(std::max(1U, std::thread::hardware_concurrency()));
+      for (size_t i = 0; i < th.size(); ++i)
+          th[i] = std::thread(&KalmarCPUTask::run, task, size * i / th.size(), size * (i + 1) / th.size());
+      for (auto& t : th)
+          t.join();
+      task->finish();
+  }
+
+  /// async kernel launch on CPU path
+  /// the default implementation executes the task before returning and
+  /// returns nullptr, CPU runtime overrides it to run the task in background
+  virtual std::shared_ptr<KalmarAsyncOp> LaunchCPUTaskAsync(const std::shared_ptr<KalmarCPUTask>& task) {
+      LaunchCPUTask(task.get());
+      return nullptr;
+  }
+
+  /// record a kernel launched on CPU path in queuing_mode_deferred, to be
+  /// fused with the kernels recorded before it, see KalmarCPUTask::fuse
+  /// the default implementation launches it right away
+  virtual std::shared_ptr<KalmarAsyncOp> DeferCPUTask(const std::shared_ptr<KalmarCPUTask>& task) {
+      task->enqueue(std::shared_future<void>());
+      return LaunchCPUTaskAsync(task);
+  }
+
   /// read data from device to host
   virtual void read(void* device, void* dst, size_t count, size_t offset) = 0;
 
@@ -140,6 +292,43 @@ public:
   /// copy data between two device pointers
   virtual void copy(void* src, void* dst, size_t count, size_t src_offset, size_t dst_offset, bool blocking) = 0;
 
+  /// read the rows of @rect from device to host, the source side of @rect
+  /// is in @device and the destination side in @dst
+  /// the default implementation reads each row
+  virtual void read_rect(void* device, void* dst, const KalmarRect& rect) {
+      rect.for_each_row([&](size_t src_offset, size_t dst_offset) {
+          read(device, (char*)dst + dst_offset, rect.width, src_offset);
+      });
+  }
+
+  /// write the rows of @rect from host to device, the source side of @rect
+  /// is in @src and the destination side in @device
+  /// the default implementation writes each row
+  virtual void write_rect(void* device, const void* src, const KalmarRect& rect, bool blocking) {
+      rect.for_each_row([&](size_t src_offset, size_t dst_offset) {
+          write(device, (const char*)src + src_offset, rect.width, dst_offset, blocking);
+      });
+  }
+
+  /// copy the rows of @rect between two device pointers
+  /// the default implementation copies each row, through a host mapping of
+  /// the range spanned by @rect if both are in the same buffer
+  virtual void copy_rect(void* src, void* dst, const KalmarRect& rect, bool blocking) {
+      if (src == dst) {
+          const size_t begin = std::min(rect.src_offset, rect.dst_offset);
+          const size_t end = std::max(rect.src_end(), rect.dst_end());
+          char* p = (char*)map(src, end - begin, begin, true);
+          rect.for_each_row([&](size_t src_offset, size_t dst_offset) {
+              memmove(p + dst_offset - begin, p + src_offset - begin, rect.width);
+          });
+          unmap(src, p, end - begin, begin, true);
+          return;
+      }
+      rect.for_each_row([&](size_t src_offset, size_t dst_offset) {
+          copy(src, dst, rect.width, src_offset, dst_offset, blocking);
+      });
+  }
+
   /// map host accessible pointer from device
   virtual void* map(void* device, size_t count, size_t offset, bool modify) = 0;
 
@@ -149,6 +338,10 @@ public:
   /// push device pointer to kernel argument list
   virtual void Push(void *kernel, int idx, void* device, bool modify) = 0;
 
+  /// record that @kernel uses the buffer at @device, for kernels whose
+  /// arguments are pushed all at once instead of by Push, see KernelArgLayout
+  virtual void RegisterBuffer(void *kernel, void* device, bool modify) {}
+
   virtual uint32_t GetGroupSegmentSize(void *kernel) { return 0; }
 
   KalmarDevice* getDev() { return pDev; }
@@ -157,6 +350,11 @@ public:
 
   execute_order get_execute_order() const { return order; }
 
+  /// graph recording the kernels launched on CPU path, null unless between
+  /// accelerator_view::begin_capture and end_capture
+  const std::shared_ptr<CPUGraph>& get_capture() const { return capture; }
+  void set_capture(const std::shared_ptr<CPUGraph>& graph) { capture = graph; }
+
   /// get number of pending async operations in the queue
   virtual int getPendingAsyncOps() { return 0; }
 
@@ -180,6 +378,14 @@ public:
   /// enqueue marker
   virtual std::shared_ptr<KalmarAsyncOp> EnqueueMarker() { return nullptr; }
 
+  /// enqueue marker which also waits for @dep, an operation of any queue
+  /// the default implementation waits for @dep before enqueuing the marker
+  virtual std::shared_ptr<KalmarAsyncOp> EnqueueMarkerWithDependency(const std::shared_ptr<KalmarAsyncOp>& dep) {
+      if (dep && dep->getFuture())
+          dep->getFuture()->wait();
+      return EnqueueMarker();
+  }
+
   /// cleanup internal resource
   /// this function is usually called by dtor of the implementation classes
   /// in rare occasions it may be called by other functions to ensure proper
@@ -190,6 +396,7 @@ private:
   KalmarDevice* pDev;
   queuing_mode mode;
   execute_order order;
+  std::shared_ptr<CPUGraph> capture;
 };
 
 /// KalmarDevice
@@ -212,15 +419,26 @@ private:
     std::mutex tlsDefaultQueueMap_mutex;
 #endif
 
+    /// host buffers staging transfers to and from the device
+    KalmarStagingPool staging;
+
 protected:
     KalmarDevice(access_type type = access_type_read_write)
         : cpu_type(type),
 #if !TLS_QUEUE
-          def(), flag()
+          def(), flag(),
 #else
-          tlsDefaultQueueMap(), tlsDefaultQueueMap_mutex()
+          tlsDefaultQueueMap(), tlsDefaultQueueMap_mutex(),
 #endif
+          staging([this](size_t count) { return allocate_staging(count); },
+                  [this](void* ptr) { free_staging(ptr); },
+                  KalmarStagingPool::DetermineLimit())
           {}
+
+    /// allocate and free a host buffer of the staging pool
+    /// a device overriding them has to clear the pool in its destructor
+    virtual void* allocate_staging(size_t count) { return kalmar_aligned_alloc(0x1000, count); }
+    virtual void free_staging(void* ptr) { kalmar_aligned_free(ptr); }
 public:
     access_type get_access() const { return cpu_type; }
     void set_access(access_type type) { cpu_type = type; }
@@ -243,12 +461,23 @@ public:
     /// @key: used to avoid duplicate release
     virtual void release(void* ptr, struct rw_info* key) = 0;
 
+    /// pool of host buffers staging transfers to and from the device
+    KalmarStagingPool& get_staging_pool() { return staging; }
+
     /// build program
     virtual void BuildProgram(void* size, void* source, bool needsCompilation = true) {}
 
     /// create kernel
     virtual void* CreateKernel(const char* fun, void* size, void* source, bool needsCompilation = true) { return nullptr; }
 
+    /// resolve the code object of kernel @fun once, later launches of the
+    /// kernel pass the handle to CreateKernelFromHandle
+    /// return nullptr if the device has no such handle
+    virtual void* GetKernelHandle(const char* fun, void* size, void* source, bool needsCompilation = true) { return nullptr; }
+
+    /// create kernel from a handle returned by GetKernelHandle
+    virtual void* CreateKernelFromHandle(const char* fun, void* handle) { return nullptr; }
+
     /// check if a given kernel is compatible with the device
     virtual bool IsCompatibleKernel(void* size, void* source) { return true; }
 
@@ -321,6 +550,26 @@ public:
           memmove((char*)dst + dst_offset, (char*)src + src_offset, count);
   }
 
+  /// unlike read, write and copy, rows are moved even when both sides are
+  /// in the same buffer
+  void read_rect(void* device, void* dst, const KalmarRect& rect) override {
+      move_rows(device, dst, rect);
+  }
+
+  void write_rect(void* device, const void* src, const KalmarRect& rect, bool blocking) override {
+      move_rows(src, device, rect);
+  }
+
+  void copy_rect(void* src, void* dst, const KalmarRect& rect, bool blocking) override {
+      move_rows(src, dst, rect);
+  }
+
+  static void move_rows(const void* src, void* dst, const KalmarRect& rect) {
+      rect.for_each_row([&](size_t src_offset, size_t dst_offset) {
+          memmove((char*)dst + dst_offset, (const char*)src + src_offset, rect.width);
+      });
+  }
+
   void* map(void* device, size_t count, size_t offset, bool modify) override {
       return (char*)device + offset;
   }
@@ -422,29 +671,66 @@ namespace CLAMP {
 // used in parallel_for_each.h
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
 extern bool is_cpu();
-extern bool in_cpu_kernel();
-extern void enter_kernel();
-extern void leave_kernel();
+/// set while the calling thread executes a kernel on CPU path
+///
+/// Checked at every array_view access, so it is visible to the compiler to
+/// let the check be hoisted out of vectorized loops.
+extern __thread bool in_kernel;
+inline bool in_cpu_kernel() { return in_kernel; }
+inline void enter_kernel() { in_kernel = true; }
+inline void leave_kernel() { in_kernel = false; }
+/// marks the calling thread as executing a kernel while in scope
+///
+/// The state is per thread, so host threads launching kernels concurrently
+/// do not see each other's kernels, and it is restored on exit so that a
+/// kernel launched from a kernel leaves the outer one marked.
+struct kernel_scope {
+    const bool outer;
+    kernel_scope() : outer(in_kernel) { enter_kernel(); }
+    ~kernel_scope() { in_kernel = outer; }
+};
+/// switch work-items of a tile with CPUFiber instead of ucontext, see
+/// HCC_CPU_TILE_ENGINE
+extern bool use_cpu_tile_fiber();
+/// size of the stack of a work-item in a tile, see HCC_CPU_TILE_STACK_SIZE
+extern size_t get_cpu_tile_stack_size();
+/// execute rows of work-items of flat kernels as SIMD lanes without proving
+/// them independent, opt-in with HCC_CPU_SIMD=ON
+extern bool use_cpu_simd();
 #endif
 
+/// call @f on the continuation executor once @future is ready, @op is the
+/// operation of @future if any, see completion_future::then
+extern void ScheduleContinuation(const std::shared_future<void>& future,
+                                 const std::shared_ptr<KalmarAsyncOp>& op,
+                                 std::function<void()> f);
+
+extern void BuildProgram(KalmarQueue*);
 extern void *CreateKernel(std::string, KalmarQueue*);
+extern void *GetKernelHandle(const char*, KalmarQueue*);
 
 extern void PushArg(void *, int, size_t, const void *);
 extern void PushArgPtr(void *, int, size_t, const void *);
+/// whether the runtime takes the arguments of a kernel laid out at once
+extern bool HasPushArgs();
+/// push @count arguments laid out in a kernarg segment of @size bytes
+extern void PushArgs(void *, int, size_t, const void *);
 
 } // namespace CLAMP
 
-static inline const std::shared_ptr<KalmarQueue> get_cpu_queue() {
-    static auto cpu_queue = getContext()->getDevice(L"cpu")->get_default_queue();
-    return cpu_queue;
+/// never destroyed, buffers released by CPU kernels still in flight at exit
+/// need it
+static inline const std::shared_ptr<KalmarQueue>& get_cpu_queue() {
+    static auto cpu_queue = new std::shared_ptr<KalmarQueue>(getContext()->getDevice(L"cpu")->get_default_queue());
+    return *cpu_queue;
 }
 
 static inline bool is_cpu_queue(const std::shared_ptr<KalmarQueue>& Queue) {
-    return Queue->getDev()->get_path() == L"cpu";
+    return Queue->getDev() == get_cpu_queue()->getDev();
 }
 
-static inline void copy_helper(std::shared_ptr<KalmarQueue>& srcQueue, void* src,
-                               std::shared_ptr<KalmarQueue>& dstQueue, void* dst,
+static inline void copy_helper(const std::shared_ptr<KalmarQueue>& srcQueue, void* src,
+                               const std::shared_ptr<KalmarQueue>& dstQueue, void* dst,
                                size_t cnt, bool block,
                                size_t src_offset = 0, size_t dst_offset = 0) {
     /// In shared memory architecture, src and dst may points to the same buffer
@@ -462,17 +748,96 @@ static inline void copy_helper(std::shared_ptr<KalmarQueue>& srcQueue, void* src
         dstQueue->copy(src, dst, cnt, src_offset, dst_offset, block);
 }
 
-/// software MSI protocol
-/// https://en.wikipedia.org/wiki/MSI_protocol
-/// Used to avoid unnecessary copy when array_view<const, T> is used
-enum states
+/// same as copy_helper for the rows of @rect
+static inline void copy_rect_helper(const std::shared_ptr<KalmarQueue>& srcQueue, void* src,
+                                    const std::shared_ptr<KalmarQueue>& dstQueue, void* dst,
+                                    const KalmarRect& rect, bool block) {
+    if (is_cpu_queue(srcQueue))
+        dstQueue->write_rect(dst, src, rect, block);
+    else if (is_cpu_queue(dstQueue))
+        srcQueue->read_rect(src, dst, rect);
+    else
+        dstQueue->copy_rect(src, dst, rect, block);
+}
+
+/// set of disjoint byte ranges [begin, end) of a buffer
+/// Overlapping and adjacent ranges are merged on insertion.
+class range_set
 {
-    /// exclusive owned data, safe to read and wrtie
-    modified,
-    /// shared on multiple devices, the content are all the same, cannot modify
-    shared,
-    // not able to read and write
-    invalid
+    /// begin -> end
+    std::map<size_t, size_t> ranges;
+
+public:
+    bool empty() const { return ranges.empty(); }
+    void clear() { ranges.clear(); }
+
+    void insert(size_t begin, size_t end) {
+        if (begin >= end)
+            return;
+        auto it = ranges.upper_bound(begin);
+        if (it != std::begin(ranges)) {
+            auto prev = std::prev(it);
+            if (prev->second >= begin) {
+                begin = prev->first;
+                end = std::max(end, prev->second);
+                ranges.erase(prev);
+            }
+        }
+        while (it != std::end(ranges) && it->first <= end) {
+            end = std::max(end, it->second);
+            it = ranges.erase(it);
+        }
+        ranges.emplace_hint(it, begin, end);
+    }
+
+    void erase(size_t begin, size_t end) {
+        if (begin >= end)
+            return;
+        auto it = ranges.upper_bound(begin);
+        if (it != std::begin(ranges)) {
+            auto prev = std::prev(it);
+            if (prev->second > begin) {
+                const size_t prev_end = prev->second;
+                if (prev->first == begin)
+                    ranges.erase(prev);
+                else
+                    prev->second = begin;
+                if (prev_end > end) {
+                    ranges.emplace(end, prev_end);
+                    return;
+                }
+            }
+        }
+        while (it != std::end(ranges) && it->first < end) {
+            if (it->second > end) {
+                const size_t it_end = it->second;
+                ranges.erase(it);
+                ranges.emplace(end, it_end);
+                return;
+            }
+            it = ranges.erase(it);
+        }
+    }
+
+    /// call f(begin, end) for each part of [begin, end) in the set, in order
+    template <typename F>
+    void for_each(size_t begin, size_t end, F f) const {
+        auto it = ranges.upper_bound(begin);
+        if (it != std::begin(ranges))
+            --it;
+        for (; it != std::end(ranges) && it->first < end; ++it) {
+            const size_t b = std::max(begin, it->first);
+            const size_t e = std::min(end, it->second);
+            if (b < e)
+                f(b, e);
+        }
+    }
+
+    bool intersects(size_t begin, size_t end) const {
+        bool found = false;
+        for_each(begin, end, [&](size_t, size_t) { found = true; });
+        return found;
+    }
 };
 
 /// buffer information
@@ -480,11 +845,83 @@ enum states
 /// Whenever rw_info is going to be used on device, it will create a buffer at
 /// that device.
 /// @data: device data pointer
-/// @state: used to implement MSI protocol
+/// @stale: byte ranges whose content on this device is out of date
 struct dev_info
 {
     void* data; /// pointer to device data
-    states state; /// state of the data on current device
+    range_set stale;
+};
+
+/// device buffers of a rw_info
+///
+/// Data rarely lives on more than a few devices, so entries are kept in a
+/// small fixed array searched linearly, starting from the entry of the device
+/// looked up last. Entries beyond the fixed slots spill to a deque. Inserting
+/// never moves an existing entry, so references to them stay valid.
+class dev_table
+{
+    static const int slots = 4;
+    struct entry {
+        KalmarDevice* dev;
+        dev_info info;
+    };
+    entry fixed[slots];
+    int used;
+    std::deque<entry> spill;
+
+public:
+    dev_table() : used(0), spill() {}
+
+    /// return the entry of @dev, nullptr if there is no buffer on it
+    /// a lookup writes nothing, it may run on CPU workers while the host
+    /// looks up the table too
+    dev_info* find(KalmarDevice* dev) {
+        for (int i = 0; i < used; ++i) {
+            if (fixed[i].dev == dev)
+                return &fixed[i].info;
+        }
+        for (auto& e : spill)
+            if (e.dev == dev)
+                return &e.info;
+        return nullptr;
+    }
+
+    /// return the entry of @dev, insert an empty one if there is none
+    dev_info& operator[](KalmarDevice* dev) {
+        if (dev_info* info = find(dev))
+            return *info;
+        if (used < slots) {
+            fixed[used] = {dev, dev_info()};
+            return fixed[used++].info;
+        }
+        spill.push_back({dev, dev_info()});
+        return spill.back().info;
+    }
+
+    /// remove the entry of @dev, only used when the rw_info is destroyed
+    void erase(KalmarDevice* dev) {
+        for (int i = 0; i < used; ++i) {
+            if (fixed[i].dev == dev) {
+                fixed[i] = fixed[--used];
+                return;
+            }
+        }
+        for (auto it = std::begin(spill); it != std::end(spill); ++it) {
+            if (it->dev == dev) {
+                spill.erase(it);
+                return;
+            }
+        }
+    }
+
+    /// call f(dev, info) for each entry
+    template <typename F>
+    void for_each(F f) {
+        for (int i = 0; i < used; ++i)
+            f(fixed[i].dev, fixed[i].info);
+        for (auto& e : spill)
+            f(e.dev, e.info);
+    }
 };
 
 /// rw_info is modeled as multiprocessor without shared cache
@@ -496,6 +933,13 @@ struct dev_info
 ///
 /// Whenever rw_info is going to be used on device, it will allocate memory on
 /// targeting device and do the computation
+///
+/// Coherence follows a software MSI protocol at the granularity of byte
+/// ranges (https://en.wikipedia.org/wiki/MSI_protocol). Each device keeps the
+/// ranges whose content is stale on it. Using a range on a device copies only
+/// its stale parts there, and modifying a range marks it stale on every other
+/// device, so array_view sections and partial updates only move the data
+/// they touch.
 struct rw_info
 {
     /// host accessible pointer, it will be set if
@@ -514,7 +958,7 @@ struct rw_info
     /// This is used as cache for device buffer
     /// When this rw_info is going to be used(computed) on device,
     /// rw_info will allocate buffer for the device
-    std::map<KalmarDevice*, dev_info> devs;
+    dev_table devs;
     access_type mode;
     /// This will be set if this rw_info is constructed with host pointer
     /// because rw_info cannot free host pointer
@@ -525,6 +969,34 @@ struct rw_info
     /// constructed with a given device pointer.
     bool toReleaseDevPointer;
 
+    /// completion of the asynchronous CPU kernels which are using this buffer
+    /// While they run, data and the device buffer are swapped, so the host
+    /// has to wait for them before touching this rw_info. There are several
+    /// of them only if they read it on a queue executing in any order.
+    std::vector<std::shared_future<void>> pending;
+
+    /// queue of the kernels in pending, only compared
+    const KalmarQueue* pending_queue;
+
+    /// guards pending and pending_queue, kernels are launched on a buffer by
+    /// several host threads while others wait for it
+    std::mutex pending_mutex;
+
+    /// number of CPU kernels holding data swapped with the device buffer,
+    /// see CPUVisitor
+    int cpu_users;
+
+    /// queue in queuing_mode_deferred holding kernels which use this buffer
+    /// and are not enqueued yet
+    std::weak_ptr<KalmarQueue> deferred;
+
+    /// [hot_begin, hot_end) is known to be up to date on curr, and stale on
+    /// all other devices if hot_modify is set
+    /// Lets repeated accesses to the same view, e.g. every element access of
+    /// array_view on host, skip the range bookkeeping.
+    size_t hot_begin;
+    size_t hot_end;
+    bool hot_modify;
 
     /// consruct array_view
     /// According to standard, array_view will be constructed by size, or size with
@@ -533,7 +1005,8 @@ struct rw_info
     /// device, set the HostPtr flag to prevent destructor to release it
     rw_info(const size_t count, void* ptr)
         : data(ptr), count(count), curr(nullptr), master(nullptr), stage(nullptr),
-        devs(), mode(access_type_none), HostPtr(ptr != nullptr), toReleaseDevPointer(true) {
+        devs(), mode(access_type_none), HostPtr(ptr != nullptr), toReleaseDevPointer(true),
+        pending(), pending_queue(nullptr), pending_mutex(), cpu_users(0), deferred(), hot_begin(0), hot_end(0), hot_modify(false) {
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
             /// if array_view is constructed in cpu path kernel
             /// allocate memory for it and do nothing
@@ -545,7 +1018,7 @@ struct rw_info
             if (ptr) {
                 mode = access_type_read_write;
                 curr = master = get_cpu_queue();
-                devs[curr->getDev()] = {ptr, modified};
+                add_dev(curr->getDev(), ptr, true);
             }
         }
 
@@ -557,7 +1030,8 @@ struct rw_info
     ///    If it is not, ignore the stage one, fallback to case 1.
     rw_info(const std::shared_ptr<KalmarQueue>& Queue, const std::shared_ptr<KalmarQueue>& Stage,
             const size_t count, access_type mode_) : data(nullptr), count(count),
-    curr(Queue), master(Queue), stage(nullptr), devs(), mode(mode_), HostPtr(false), toReleaseDevPointer(true) {
+    curr(Queue), master(Queue), stage(nullptr), devs(), mode(mode_), HostPtr(false), toReleaseDevPointer(true),
+    pending(), pending_queue(nullptr), pending_mutex(), cpu_users(0), deferred(), hot_begin(0), hot_end(0), hot_modify(false) {
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
         if (CLAMP::in_cpu_kernel() && data == nullptr) {
             data = kalmar_aligned_alloc(0x1000, count);
@@ -566,7 +1040,7 @@ struct rw_info
 #endif
         if (mode == access_type_auto)
             mode = curr->getDev()->get_access();
-        devs[curr->getDev()] = {curr->getDev()->create(count, this), modified};
+        add_dev(curr->getDev(), curr->getDev()->create(count, this), true);
 
         /// set data pointer, if it is accessible from cpu
         if (is_cpu_queue(curr) || (curr->getDev()->is_unified() && mode != access_type_none))
@@ -574,7 +1048,7 @@ struct rw_info
         if (is_cpu_queue(curr)) {
             stage = Stage;
             if (Stage != curr)
-                devs[stage->getDev()] = {stage->getDev()->create(count, this), invalid};
+                add_dev(stage->getDev(), stage->getDev()->create(count, this), false);
         } else
             /// if curr is not cpu, ignore the stage one
             stage = curr;
@@ -588,10 +1062,11 @@ struct rw_info
     rw_info(const std::shared_ptr<KalmarQueue>& Queue, const std::shared_ptr<KalmarQueue>& Stage,
             const size_t count,
             void* device_pointer,
-            access_type mode_) : data(nullptr), count(count), curr(Queue), master(Queue), stage(nullptr), devs(), mode(mode_), HostPtr(false), toReleaseDevPointer(false) {
+            access_type mode_) : data(nullptr), count(count), curr(Queue), master(Queue), stage(nullptr), devs(), mode(mode_), HostPtr(false), toReleaseDevPointer(false),
+            pending(), pending_queue(nullptr), pending_mutex(), cpu_users(0), deferred(), hot_begin(0), hot_end(0), hot_modify(false) {
          if (mode == access_type_auto)
              mode = curr->getDev()->get_access();
-         devs[curr->getDev()] = { device_pointer, modified };
+         add_dev(curr->getDev(), device_pointer, true);
 
          /// set data pointer, if it is accessible from cpu
          if (is_cpu_queue(curr) || (curr->getDev()->is_unified() && mode != access_type_none))
@@ -599,41 +1074,174 @@ struct rw_info
          if (is_cpu_queue(curr)) {
              stage = Stage;
              if (Stage != curr)
-                 devs[stage->getDev()] = {stage->getDev()->create(count, this), invalid};
+                 add_dev(stage->getDev(), stage->getDev()->create(count, this), false);
          } else
              /// if curr is not cpu, ignore the stage one
              stage = curr;
     }
 
+    /// enqueue the deferred kernels using this buffer, if any
+    void flush_deferred() {
+        if (std::shared_ptr<KalmarQueue> q = deferred.lock()) {
+            deferred.reset();
+            q->flush();
+        }
+    }
+
+    /// wait for the asynchronous CPU kernels using this buffer, if any
+    void wait_pending() {
+        flush_deferred();
+        std::vector<std::shared_future<void>> futures;
+        {
+            std::lock_guard<std::mutex> lck(pending_mutex);
+            futures.swap(pending);
+            pending_queue = nullptr;
+        }
+        for (const auto& future : futures)
+            future.wait();
+    }
+
+    /// whether the asynchronous CPU kernels using this buffer, if any, are
+    /// all on @pQueue
+    bool pending_on(const KalmarQueue* pQueue) {
+        std::lock_guard<std::mutex> lck(pending_mutex);
+        return pending.empty() || pending_queue == pQueue;
+    }
+
+    /// whether [begin, end) is up to date on the device of @pQueue, so that
+    /// update copies nothing there
+    /// While a CPU kernel runs, the device buffer is swapped with data, a
+    /// copy into it would land in host memory instead.
+    bool fresh_on(const std::shared_ptr<KalmarQueue>& pQueue, size_t begin, size_t end) {
+        dev_info* info = devs.find(pQueue->getDev());
+        return curr && info && !info->stale.intersects(begin, std::min(end, count));
+    }
+
+    /// the buffer is used by an asynchronous CPU kernel on @pQueue until
+    /// @future is ready
+    void add_pending(const KalmarQueue* pQueue, const std::shared_future<void>& future) {
+        std::lock_guard<std::mutex> lck(pending_mutex);
+        pending.erase(std::remove_if(std::begin(pending), std::end(pending), [](const std::shared_future<void>& f) {
+            return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), std::end(pending));
+        pending.push_back(future);
+        pending_queue = pQueue;
+    }
+
     void* get_device_pointer() {
+        wait_pending();
         return devs[curr->getDev()].data;
     }
 
+    /// add the buffer @ptr on @dev, stale everywhere unless @valid
+    void add_dev(KalmarDevice* dev, void* ptr, bool valid) {
+        dev_info& info = devs[dev];
+        info.data = ptr;
+        info.stale.clear();
+        if (!valid)
+            info.stale.insert(0, count);
+    }
+
     void construct(std::shared_ptr<KalmarQueue> pQueue) {
         curr = pQueue;
-        devs[pQueue->getDev()] = {pQueue->getDev()->create(count, this), invalid};
+        add_dev(pQueue->getDev(), pQueue->getDev()->create(count, this), false);
         if (is_cpu_queue(pQueue))
             data = devs[pQueue->getDev()].data;
+        cool();
+    }
+
+    /// forget the cached hot range, called whenever curr or staleness changes
+    void cool() { hot_begin = hot_end = 0; hot_modify = false; }
+
+    /// mark [begin, end) as stale on all devices, content will be discarded
+    void disc(size_t begin = 0, size_t end = SIZE_MAX) {
+        end = std::min(end, count);
+        devs.for_each([&](KalmarDevice*, dev_info& info) { info.stale.insert(begin, end); });
+        cool();
+    }
+
+    /// [begin, end) has been modified on @dev, mark it as stale elsewhere
+    void mark_modified(KalmarDevice* dev, size_t begin, size_t end) {
+        devs.for_each([&](KalmarDevice* pDev, dev_info& info) {
+            if (pDev == dev)
+                info.stale.erase(begin, end);
+            else
+                info.stale.insert(begin, end);
+        });
     }
 
-    void disc() {
-        for (auto& it : devs)
-            it.second.state = invalid;
+    /// queue used to transfer data from or to @dev
+    std::shared_ptr<KalmarQueue> queue_of(KalmarDevice* dev) {
+        if (curr && curr->getDev() == dev)
+            return curr;
+        if (dev == get_cpu_queue()->getDev())
+            return get_cpu_queue();
+        return dev->get_default_queue();
+    }
+
+    /// bring [begin, end) on the device of pQueue up to date
+    /// Each stale part is copied from a device holding it, trying the cpu
+    /// first to avoid copies between devices, then curr, then any other
+    /// device.
+    /// return parts which are up to date on no device, e.g. after discard
+    std::vector<std::pair<size_t, size_t>>
+    fetch(const std::shared_ptr<KalmarQueue>& pQueue, size_t begin, size_t end, bool block) {
+        KalmarDevice* dev = pQueue->getDev();
+        dev_info& dst = *devs.find(dev);
+        std::vector<std::pair<size_t, size_t>> need;
+        dst.stale.for_each(begin, end, [&](size_t b, size_t e) { need.emplace_back(b, e); });
+        if (need.empty())
+            return need;
+
+        std::vector<KalmarDevice*> sources;
+        KalmarDevice* cpu_dev = get_cpu_queue()->getDev();
+        if (cpu_dev != dev && devs.find(cpu_dev))
+            sources.push_back(cpu_dev);
+        if (curr && curr->getDev() != dev && curr->getDev() != cpu_dev)
+            sources.push_back(curr->getDev());
+        devs.for_each([&](KalmarDevice* pDev, dev_info&) {
+            if (pDev != dev && std::find(std::begin(sources), std::end(sources), pDev) == std::end(sources))
+                sources.push_back(pDev);
+        });
+
+        for (KalmarDevice* src_dev : sources) {
+            if (need.empty())
+                break;
+            const dev_info& src = *devs.find(src_dev);
+            std::shared_ptr<KalmarQueue> srcQueue = queue_of(src_dev);
+            std::vector<std::pair<size_t, size_t>> rest;
+            for (const auto& r : need) {
+                /// the parts of r which are not stale on src are copied
+                size_t pos = r.first;
+                src.stale.for_each(r.first, r.second, [&](size_t b, size_t e) {
+                    if (pos < b)
+                        copy_helper(srcQueue, src.data, pQueue, dst.data, b - pos, block, pos, pos);
+                    rest.emplace_back(b, e);
+                    pos = e;
+                });
+                if (pos < r.second)
+                    copy_helper(srcQueue, src.data, pQueue, dst.data, r.second - pos, block, pos, pos);
+            }
+            need.swap(rest);
+        }
+        dst.stale.erase(begin, end);
+        return need;
     }
 
-    /// optimization: Before performing copy, if the state of cpu accelerator is
-    /// shared, it implies that the data on cpu is the same on device where
-    /// curr located, use data on cpu to perform the later operation
+    /// optimization: Before performing copy, if the cpu holds [begin, end) up
+    /// to date, use data on cpu to perform the later operation
     /// For example, if data on device a is going to be copied to device b
     /// and the data on device a and cpu is the same, it is okay to copy data 
     /// from cpu to device b
-    void try_switch_to_cpu() {
+    void try_switch_to_cpu(size_t begin, size_t end) {
         if (is_cpu_queue(curr))
             return;
-        auto cpu_queue = get_cpu_queue();
-        if (devs.find(cpu_queue->getDev()) != std::end(devs))
-            if (devs[cpu_queue->getDev()].state == shared)
-                curr = cpu_queue;
+        const auto& cpu_queue = get_cpu_queue();
+        dev_info* info = devs.find(cpu_queue->getDev());
+        if (info && !info->stale.intersects(begin, end)) {
+            curr = cpu_queue;
+            cool();
+        }
     }
 
     /// synchronize data to device pQueue belongs to by using pQuquq
@@ -641,61 +1249,65 @@ struct rw_info
     /// @modify: the data will be modified or not
     /// @blcok: this call will be blocking or not
     ///         none blocking occurs in serialization stage
-    void sync(std::shared_ptr<KalmarQueue> pQueue, bool modify, bool block = true) {
+    /// @begin, @end: byte range to synchronize, the whole buffer by default
+    void sync(const std::shared_ptr<KalmarQueue>& pQueue, bool modify, bool block = true,
+              size_t begin = 0, size_t end = SIZE_MAX) {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+        if (CLAMP::in_cpu_kernel())
+            return;
+#endif
+        wait_pending();
+        update(pQueue, modify, block, begin, end);
+    }
+
+    /// same as sync, without waiting for the CPU kernels in pending
+    /// Used for a kernel which pQueue executes after those of them which
+    /// conflict with it. Only kernels of pQueue used the buffer since they
+    /// were last waited for, so it is not stale there.
+    void update(const std::shared_ptr<KalmarQueue>& pQueue, bool modify, bool block = true,
+                size_t begin = 0, size_t end = SIZE_MAX) {
 #if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
         if (CLAMP::in_cpu_kernel())
             return;
 #endif
+        end = std::min(end, count);
         if (!curr) {
             /// This can only happen if array_view is constructed with size and
             /// is not accessed before
-            dev_info dev = {pQueue->getDev()->create(count, this),
-                modify ? modified : shared};
-            devs[pQueue->getDev()] = dev;
+            void* ptr = pQueue->getDev()->create(count, this);
+            add_dev(pQueue->getDev(), ptr, true);
             if (is_cpu_queue(pQueue))
-                data = dev.data;
+                data = ptr;
             curr = pQueue;
+            cool();
             return;
         }
 
-        if (curr == pQueue)
-            return;
-
-        /// If both queues are from the same device, upadte state only
-        if (curr->getDev() == pQueue->getDev()) {
-            // curr->wait();
-            curr = pQueue;
-            if (modify) {
-                disc();
-                devs[curr->getDev()].state = modified;
-            }
+        if (curr == pQueue && begin >= hot_begin && end <= hot_end && (hot_modify || !modify))
             return;
-        }
 
         /// If the buffer on device is not allocated, allocate space for it
-        if (devs.find(pQueue->getDev()) == std::end(devs)) {
-            dev_info dev = {pQueue->getDev()->create(count, this), invalid};
-            devs[pQueue->getDev()] = dev;
+        KalmarDevice* dev = pQueue->getDev();
+        if (!devs.find(dev)) {
+            void* ptr = dev->create(count, this);
+            add_dev(dev, ptr, false);
             if (is_cpu_queue(pQueue))
-                data = dev.data;
+                data = ptr;
         }
 
-        try_switch_to_cpu();
-        dev_info& dst = devs[pQueue->getDev()];
-        dev_info& src = devs[curr->getDev()];
-        if (dst.state == invalid && src.state != invalid)
-            copy_helper(curr, src.data, pQueue, dst.data, count, block);
-        /// if the data on current device is going to be modified
-        /// changed the state of current device as modified
-        curr = pQueue;
-        if (modify) {
-            disc();
-            dst.state = modified;
+        fetch(pQueue, begin, end, block);
+        /// if the data on current device is going to be modified, the range
+        /// is stale on all other devices
+        if (modify)
+            mark_modified(dev, begin, end);
+        if (curr != pQueue || begin < hot_begin || end > hot_end) {
+            hot_begin = begin;
+            hot_end = end;
+            hot_modify = modify;
         } else {
-            dst.state = shared;
-            if (src.state == modified)
-                src.state = shared;
+            hot_modify |= modify;
         }
+        curr = pQueue;
     }
 
     /// return a host accessible pointer from device
@@ -705,46 +1317,55 @@ struct rw_info
     void* map(size_t cnt, size_t offset, bool modify) {
         if (cnt == 0)
             cnt = count;
+        wait_pending();
         /// This can only happen if this rw_info is constructed only with size
         /// and not accessed on any device
         if (!curr) {
             curr = getContext()->auto_select();
-            devs[curr->getDev()] = {curr->getDev()->create(count, this), modify ? modified : shared};
-            return curr->map(data, cnt, offset, modify);
+            add_dev(curr->getDev(), curr->getDev()->create(count, this), true);
+            cool();
+            return curr->map(devs[curr->getDev()].data, cnt, offset, modify);
         }
-        try_switch_to_cpu();
-        dev_info& info = devs[curr->getDev()];
-        if (info.state == shared && modify) {
-            disc();
-            info.state = modified;
+        try_switch_to_cpu(offset, offset + cnt);
+        fetch(curr, offset, offset + cnt, true);
+        if (modify) {
+            mark_modified(curr->getDev(), offset, offset + cnt);
+            cool();
         }
-        return curr->map(info.data, cnt, offset, modify);
+        return curr->map(devs[curr->getDev()].data, cnt, offset, modify);
     }
 
-    void unmap(void* addr, size_t cnt, size_t offset, bool modify) { curr->unmap(devs[curr->getDev()].data, addr, cnt, offset, modify); }
+    void unmap(void* addr, size_t cnt, size_t offset, bool modify) { wait_pending(); curr->unmap(devs[curr->getDev()].data, addr, cnt, offset, modify); }
 
     /// synchronize data to master accelerator
     /// used in array
     /// master is not necessary to be cpu device
     void synchronize(bool modify) { sync(master, modify); }
 
-    /// synchronize data to cpu accelerator
+    /// synchronize [begin, end) to cpu accelerator
     /// used in array_view
-    void get_cpu_access(bool modify) { sync(get_cpu_queue(), modify); }
+    void get_cpu_access(bool modify, size_t begin = 0, size_t end = SIZE_MAX) {
+#if __KALMAR_ACCELERATOR__ == 2 || __KALMAR_CPU__ == 2
+        /// kernels on CPU path access the data in place
+        if (CLAMP::in_cpu_kernel())
+            return;
+#endif
+        sync(get_cpu_queue(), modify, true, begin, end);
+    }
 
     /// Write data from host source pointer to device
-    /// Change state to modified, because the device has exclusive copy of data
+    /// The written range is stale on all other devices
     void write(const void* src, int cnt, int offset, bool blocking) {
+        wait_pending();
         curr->write(devs[curr->getDev()].data, src, cnt, offset, blocking);
-        dev_info& dev = devs[curr->getDev()];
-        if (dev.state != modified) {
-            disc();
-            dev.state = modified;
-        }
+        mark_modified(curr->getDev(), offset, offset + cnt);
+        cool();
     }
 
     /// Read data to host pointer from device
     void read(void* dst, int cnt, int offset) {
+        wait_pending();
+        fetch(curr, offset, offset + cnt, true);
         curr->read(devs[curr->getDev()].data, dst, cnt, offset);
     }
 
@@ -752,6 +1373,8 @@ struct rw_info
     void copy(rw_info* other, int src_offset, int dst_offset, int cnt) {
         if (cnt == 0)
             cnt = count;
+        wait_pending();
+        other->wait_pending();
         if (!curr) {
             if (!other->curr)
                 return;
@@ -761,23 +1384,75 @@ struct rw_info
             if (!other->curr)
                 other->construct(curr);
         }
+        zero_lost(fetch(curr, src_offset, src_offset + cnt, true));
+        dev_info& src = devs[curr->getDev()];
         dev_info& dst = other->devs[other->curr->getDev()];
+        copy_helper(curr, src.data, other->curr, dst.data, cnt, true, src_offset, dst_offset);
+        other->mark_modified(other->curr->getDev(), dst_offset, dst_offset + cnt);
+        other->cool();
+    }
+
+    /// Parts of a source range which are up to date nowhere are zeroed
+    void zero_lost(const std::vector<std::pair<size_t, size_t>>& lost) {
         dev_info& src = devs[curr->getDev()];
-        /// If src.state is invalid, zero the data on it
-        if (src.state == invalid) {
-            src.state = shared;
+        for (const auto& r : lost) {
+            const size_t len = r.second - r.first;
             if (is_cpu_queue(curr))
-                memset((char*)src.data + src_offset, 0, cnt);
+                memset((char*)src.data + r.first, 0, len);
             else {
-                void *ptr = kalmar_aligned_alloc(0x1000, cnt);
-                memset(ptr, 0, cnt);
-                curr->write(src.data, ptr, cnt, src_offset, true);
-                kalmar_aligned_free(ptr);
+                KalmarStagingPool& pool = curr->getDev()->get_staging_pool();
+                void *ptr = pool.acquire(len);
+                memset(ptr, 0, len);
+                curr->write(src.data, ptr, len, r.first, true);
+                pool.release(ptr, len);
             }
         }
-        copy_helper(curr, src.data, other->curr, dst.data, cnt, true, src_offset, dst_offset);
-        other->disc();
-        dst.state = modified;
+    }
+
+    /// Write the rows of @rect from host source pointer to device, the
+    /// destination side of @rect is in this buffer
+    void write_rect(const void* src, const KalmarRect& rect, bool blocking) {
+        wait_pending();
+        curr->write_rect(devs[curr->getDev()].data, src, rect, blocking);
+        rect.for_each_row([&](size_t, size_t offset) {
+            mark_modified(curr->getDev(), offset, offset + rect.width);
+        });
+        cool();
+    }
+
+    /// Read the rows of @rect to host pointer from device, the source side
+    /// of @rect is in this buffer
+    void read_rect(void* dst, const KalmarRect& rect) {
+        wait_pending();
+        rect.for_each_row([&](size_t offset, size_t) {
+            fetch(curr, offset, offset + rect.width, true);
+        });
+        curr->read_rect(devs[curr->getDev()].data, dst, rect);
+    }
+
+    /// copy the rows of @rect from "this" to other, which may be "this"
+    void copy_rect(rw_info* other, const KalmarRect& rect) {
+        wait_pending();
+        other->wait_pending();
+        if (!curr) {
+            if (!other->curr)
+                return;
+            else
+                construct(other->curr);
+        } else {
+            if (!other->curr)
+                other->construct(curr);
+        }
+        rect.for_each_row([&](size_t offset, size_t) {
+            zero_lost(fetch(curr, offset, offset + rect.width, true));
+        });
+        dev_info& src = devs[curr->getDev()];
+        dev_info& dst = other->devs[other->curr->getDev()];
+        copy_rect_helper(curr, src.data, other->curr, dst.data, rect, true);
+        rect.for_each_row([&](size_t, size_t offset) {
+            other->mark_modified(other->curr->getDev(), offset, offset + rect.width);
+        });
+        other->cool();
     }
 
     ~rw_info() {
@@ -788,24 +1463,20 @@ struct rw_info
             return;
         }
 #endif
+        wait_pending();
         /// If this rw_info is constructed by host pointer
         /// 1. synchronize latest data to host pointer
         /// 2. Because the data pointer cannout be released, erase itself from devs
         if (HostPtr)
             synchronize(false);
         auto cpu_dev = get_cpu_queue()->getDev();
-        if (devs.find(cpu_dev) != std::end(devs)) {
+        if (dev_info* info = devs.find(cpu_dev)) {
             if (!HostPtr)
-                cpu_dev->release(devs[cpu_dev].data, this);
+                cpu_dev->release(info->data, this);
             devs.erase(cpu_dev);
         }
-        KalmarDevice* pDev;
-        dev_info info;
-        for (const auto it : devs) {
-            std::tie(pDev, info) = it;
-            if (toReleaseDevPointer)
-                pDev->release(info.data, this);
-        }
+        if (toReleaseDevPointer)
+            devs.for_each([this](KalmarDevice* pDev, dev_info& info) { pDev->release(info.data, this); });
     }
 };
 
@@ -6,12 +6,19 @@
 namespace Kalmar
 {
 
+class Serialize;
+
 /// traverse all the buffers that are going to be used in kernel
 class FunctorBufferWalker {
 public:
     virtual void Append(size_t sz, const void* s) {}
     virtual void AppendPtr(size_t sz, const void* s) {}
-    virtual void visit_buffer(struct rw_info* rw, bool modify, bool isArray) = 0;
+    /// @begin, @end: byte range of the buffer used by the kernel
+    virtual void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                              size_t begin, size_t end) = 0;
+    /// called before visit_buffer with the object holding the buffer, so that
+    /// @revisit(obj, s) visits the same buffer again for another functor
+    virtual void locate_buffer(const void* obj, void (*revisit)(const void*, Serialize&)) {}
 };
 
 /// This is used to avoid incorrect compiler error
@@ -21,37 +28,86 @@ public:
     Serialize(FunctorBufferWalker* vis) : vis(vis) {}
     void Append(size_t sz, const void* s) { vis->Append(sz, s); }
     void AppendPtr(size_t sz, const void* s) { vis->AppendPtr(sz, s); }
-    void visit_buffer(struct rw_info* rw, bool modify, bool isArray) {
-        vis->visit_buffer(rw, modify, isArray);
+    void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                      size_t begin = 0, size_t end = SIZE_MAX) {
+        vis->visit_buffer(rw, modify, isArray, begin, end);
+    }
+    /// visit the buffer held by @obj, see FunctorBufferWalker::locate_buffer
+    void visit_buffer_of(const void* obj, void (*revisit)(const void*, Serialize&),
+                         struct rw_info* rw, bool modify, bool isArray,
+                         size_t begin = 0, size_t end = SIZE_MAX) {
+        vis->locate_buffer(obj, revisit);
+        vis->visit_buffer(rw, modify, isArray, begin, end);
     }
 };
 
+/// arrays on the cpu can only be used by kernels on the accelerator they are
+/// staged to
+static inline void check_array_queue(struct rw_info* rw, bool isArray,
+                                     const std::shared_ptr<KalmarQueue>& pQueue) {
+    if (isArray) {
+        auto curr = pQueue->getDev()->get_path();
+        auto path = rw->master->getDev()->get_path();
+        if (path == L"cpu") {
+            auto asoc = rw->stage->getDev()->get_path();
+            if (asoc == L"cpu" || path != curr)
+                throw runtime_exception(__errorMsg_UnsupportedAccelerator, E_FAIL);
+        }
+    }
+}
+
 /// Change the data pointer with device pointer
-/// before/after kernel launches in cpu path
+/// before kernel launches in cpu path, restore() changes them back
+///
+/// Kernels running concurrently on a queue executing in any order may share
+/// a buffer, the first of them swaps the pointers and the last one to finish
+/// swaps them back.
 class CPUVisitor : public FunctorBufferWalker
 {
     std::shared_ptr<KalmarQueue> pQueue;
-    std::set<struct rw_info*> bufs;
+    /// kernels capture a handful of buffers, a linear search is cheaper than
+    /// a node allocation per buffer at every launch
+    std::vector<struct rw_info*> bufs;
+    std::vector<CPUBufferAccess> accesses;
+
+    /// guards rw_info::cpu_users, restore() is called by CPU workers
+    static std::mutex& swap_lock() {
+        static std::mutex lock;
+        return lock;
+    }
 public:
     CPUVisitor(std::shared_ptr<KalmarQueue> pQueue) : pQueue(pQueue) {}
-    void visit_buffer(struct rw_info* rw, bool modify, bool isArray) override {
-        if (isArray) {
-            auto curr = pQueue->getDev()->get_path();
-            auto path = rw->master->getDev()->get_path();
-            if (path == L"cpu") {
-                auto asoc = rw->stage->getDev()->get_path();
-                if (asoc == L"cpu" || path != curr)
-                    throw runtime_exception(__errorMsg_UnsupportedAccelerator, E_FAIL);
-            }
-        }
-        rw->sync(pQueue, modify, false);
-        if (bufs.find(rw) == std::end(bufs)) {
-            void*& device = rw->devs[pQueue->getDev()].data;
-            void*& data = rw->data;
-            bufs.insert(rw);
-            std::swap(device, data);
+    void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                      size_t begin, size_t end) override {
+        check_array_queue(rw, isArray, pQueue);
+        /// the queue runs the kernel after its own kernels using the buffer,
+        /// in order or by their dependencies, so the host does not wait for
+        /// them, unless part of the buffer has to be copied to the device
+        if (rw->pending_on(pQueue.get()) && rw->fresh_on(pQueue, begin, end)) {
+            rw->flush_deferred();
+            rw->update(pQueue, modify, false, begin, end);
+        } else
+            rw->sync(pQueue, modify, false, begin, end);
+        accesses.push_back({rw, begin, end, modify, isArray});
+        if (std::find(std::begin(bufs), std::end(bufs), rw) == std::end(bufs)) {
+            bufs.push_back(rw);
+            std::lock_guard<std::mutex> lck(swap_lock());
+            if (rw->cpu_users++ == 0)
+                std::swap(rw->devs[pQueue->getDev()].data, rw->data);
         }
     }
+    void restore() {
+        std::lock_guard<std::mutex> lck(swap_lock());
+        for (auto rw : bufs)
+            if (--rw->cpu_users == 0)
+                std::swap(rw->devs[pQueue->getDev()].data, rw->data);
+    }
+    /// buffers are in use by an asynchronous kernel until @future is ready
+    void set_pending(const std::shared_future<void>& future) {
+        for (auto rw : bufs)
+            rw->add_pending(pQueue.get(), future);
+    }
+    const std::vector<CPUBufferAccess>& get_accesses() const { return accesses; }
 };
 
 /// Append kernel argument to kernel
@@ -69,17 +125,10 @@ public:
     void AppendPtr(size_t sz, const void *s) override {
         CLAMP::PushArgPtr(k_, current_idx_++, sz, s);
     }
-    void visit_buffer(struct rw_info* rw, bool modify, bool isArray) override {
-        if (isArray) {
-            auto curr = pQueue->getDev()->get_path();
-            auto path = rw->master->getDev()->get_path();
-            if (path == L"cpu") {
-                auto asoc = rw->stage->getDev()->get_path();
-                if (asoc == L"cpu" || path != curr)
-                    throw runtime_exception(__errorMsg_UnsupportedAccelerator, E_FAIL);
-            }
-        }
-        rw->sync(pQueue, modify, false);
+    void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                      size_t begin, size_t end) override {
+        check_array_queue(rw, isArray, pQueue);
+        rw->sync(pQueue, modify, false, begin, end);
         pQueue->Push(k_, current_idx_++, rw->devs[pQueue->getDev()].data, modify);
     }
 };
@@ -95,7 +144,8 @@ class QueueSearcher : public FunctorBufferWalker
     std::shared_ptr<KalmarQueue> pQueue;
 public:
     QueueSearcher() = default;
-    void visit_buffer(struct rw_info* rw, bool modify, bool isArray) override {
+    void visit_buffer(struct rw_info* rw, bool modify, bool isArray,
+                      size_t begin, size_t end) override {
         if (isArray && !pQueue) {
             if (rw->master->getDev()->get_path() != L"cpu")
                 pQueue = rw->master;
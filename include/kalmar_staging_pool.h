@@ -0,0 +1,217 @@
+//===----------------------------------------------------------------------===//
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <kalmar_defines.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+/** \cond HIDDEN_SYMBOLS */
+namespace Kalmar {
+
+/// pool of host buffers staging transfers between host memory and a device
+///
+/// Requests are rounded up to a size class, a power of two from 4 KB to
+/// 64 MB, and buffers released to the pool are kept per class for later
+/// requests, so transfers do not pay an allocation and page faults each.
+/// Larger requests are allocated and freed directly.
+///
+/// The pool holds at most its limit of released buffers. In addition, every
+/// few releases it is trimmed to its high-water mark: buffers beyond what was
+/// in use at the busiest moment since the previous trim, less what is in use
+/// now, are freed, the largest first. A burst of transfers therefore does not
+/// pin its buffers forever.
+///
+/// The buffers come from the allocation functions given to the pool, the
+/// device may hand out memory pinned for its DMA engines. See
+/// HCC_STAGING_POOL_SIZE for the limit.
+class KalmarStagingPool
+{
+public:
+    /// log2 of the smallest and of the largest size class
+    static const int minClassLog2 = 12;
+    static const int maxClassLog2 = 26;
+    static const int classes = maxClassLog2 - minClassLog2 + 1;
+    /// number of releases between two trims to the high-water mark
+    static const uint64_t trimPeriod = 64;
+    /// default limit in MB, see HCC_STAGING_POOL_SIZE
+    static const size_t defaultLimitMB = 64;
+
+    struct Stats {
+        /// requests served by a buffer of the pool, and allocated
+        uint64_t hits;
+        uint64_t misses;
+        /// kept buffers freed by the pool
+        uint64_t trimmed;
+        /// bytes of the buffers handed out, and kept by the pool
+        size_t in_use;
+        size_t cached;
+        /// largest number of bytes handed out at once
+        size_t high_water;
+    };
+
+private:
+    std::function<void*(size_t)> allocate;
+    std::function<void(void*)> deallocate;
+    /// maximum bytes of the buffers kept by the pool
+    size_t limit;
+
+    std::mutex mutex;
+    std::vector<void*> free_lists[classes];
+    Stats stats;
+    /// largest number of bytes handed out since the last trim
+    size_t period_peak;
+    uint64_t releases;
+
+    /// take buffers from the largest classes until at most @keep bytes are
+    /// kept, called with the mutex locked
+    void evict(size_t keep, std::vector<void*>& victims) {
+        for (int c = classes - 1; c >= 0 && stats.cached > keep; --c) {
+            auto& list = free_lists[c];
+            while (!list.empty() && stats.cached > keep) {
+                victims.push_back(list.back());
+                list.pop_back();
+                stats.cached -= class_size(c);
+                ++stats.trimmed;
+            }
+        }
+    }
+
+    void free_all(const std::vector<void*>& victims) {
+        for (void* p : victims)
+            deallocate(p);
+    }
+
+public:
+    KalmarStagingPool(std::function<void*(size_t)> allocate,
+                      std::function<void(void*)> deallocate, size_t limit)
+        : allocate(allocate), deallocate(deallocate), limit(limit),
+          stats(), period_peak(0), releases(0) {}
+
+    ~KalmarStagingPool() { clear(); }
+
+    KalmarStagingPool(const KalmarStagingPool&) = delete;
+    KalmarStagingPool& operator=(const KalmarStagingPool&) = delete;
+
+    static size_t DetermineLimit() {
+        size_t mb = defaultLimitMB;
+        char* size_env = getenv("HCC_STAGING_POOL_SIZE");
+        if (size_env != nullptr) {
+            char* end = nullptr;
+            unsigned long long v = strtoull(size_env, &end, 10);
+            if (end != size_env && *end == '\0')
+                mb = v;
+            else
+                std::cerr << "Ignore unknown HCC_STAGING_POOL_SIZE environment variable: " << size_env << std::endl;
+        }
+        return mb << 20;
+    }
+
+    /// size class of a request of @count bytes, -1 if it has none
+    static int size_class(size_t count) {
+        int c = 0;
+        while (c < classes && class_size(c) < count)
+            ++c;
+        return c < classes ? c : -1;
+    }
+
+    static size_t class_size(int c) { return size_t(1) << (minClassLog2 + c); }
+
+    size_t get_limit() const { return limit; }
+
+    /// a buffer of at least @count bytes, nullptr if it can't be allocated
+    void* acquire(size_t count) {
+        const int c = size_class(count);
+        const size_t size = c < 0 ? count : class_size(c);
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            stats.in_use += size;
+            stats.high_water = std::max(stats.high_water, stats.in_use);
+            period_peak = std::max(period_peak, stats.in_use);
+            if (c >= 0 && !free_lists[c].empty()) {
+                void* p = free_lists[c].back();
+                free_lists[c].pop_back();
+                stats.cached -= size;
+                ++stats.hits;
+                return p;
+            }
+            ++stats.misses;
+        }
+        void* p = allocate(size);
+        if (!p) {
+            // give the kept buffers back and retry once
+            clear();
+            p = allocate(size);
+        }
+        if (!p) {
+            std::lock_guard<std::mutex> lck(mutex);
+            stats.in_use -= size;
+        }
+        return p;
+    }
+
+    /// give back @ptr, acquired for @count bytes
+    void release(void* ptr, size_t count) {
+        if (!ptr)
+            return;
+        const int c = size_class(count);
+        const size_t size = c < 0 ? count : class_size(c);
+        std::vector<void*> victims;
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            stats.in_use -= size;
+            if (c < 0)
+                victims.push_back(ptr);
+            else {
+                free_lists[c].push_back(ptr);
+                stats.cached += size;
+                evict(limit, victims);
+            }
+            if (++releases % trimPeriod == 0) {
+                evict(period_peak - stats.in_use, victims);
+                period_peak = stats.in_use;
+            }
+        }
+        free_all(victims);
+    }
+
+    /// free the buffers kept beyond the high-water mark since the last trim
+    void trim() {
+        std::vector<void*> victims;
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            evict(period_peak - stats.in_use, victims);
+            period_peak = stats.in_use;
+        }
+        free_all(victims);
+    }
+
+    /// free all the buffers kept by the pool
+    void clear() {
+        std::vector<void*> victims;
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            evict(0, victims);
+        }
+        free_all(victims);
+    }
+
+    Stats get_stats() {
+        std::lock_guard<std::mutex> lck(mutex);
+        return stats;
+    }
+};
+
+} // namespace Kalmar
+/** \endcond */
@@ -5,12 +5,34 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
 #include <cassert>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <sstream>
 #include <map>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <kalmar_runtime.h>
 #include <kalmar_aligned_alloc.h>
 
@@ -18,25 +40,1138 @@ extern "C" void PushArgImpl(void *ker, int idx, size_t sz, const void *v) {}
 
 namespace Kalmar {
 
+/// scheduling policy of work units of a KalmarCPUTask among CPU workers
+enum CPUSchedule
+{
+    /// each runner executes one contiguous slice of equal size
+    schedule_static,
+    /// runners grab chunks of grain size until the domain is exhausted
+    schedule_dynamic,
+    /// like dynamic, but chunk size decreases with the remaining work
+    schedule_guided
+};
+
+/// scheduling parameters, set from HCC_CPU_SCHEDULE and HCC_CPU_GRAIN
+struct CPUScheduleConfig
+{
+    CPUSchedule policy;
+    /// number of work units per chunk, 0 to let the runtime decide
+    size_t grain;
+
+    CPUScheduleConfig() : policy(schedule_dynamic), grain(0) {
+        char* schedule_env = getenv("HCC_CPU_SCHEDULE");
+        if (schedule_env != nullptr) {
+            if (std::string("STATIC") == schedule_env)
+                policy = schedule_static;
+            else if (std::string("DYNAMIC") == schedule_env)
+                policy = schedule_dynamic;
+            else if (std::string("GUIDED") == schedule_env)
+                policy = schedule_guided;
+            else
+                std::cerr << "Ignore unknown HCC_CPU_SCHEDULE environment variable: " << schedule_env << std::endl;
+        }
+        char* grain_env = getenv("HCC_CPU_GRAIN");
+        if (grain_env != nullptr)
+            grain = strtoul(grain_env, nullptr, 10);
+    }
+};
+
+/// NUMA layout used by the CPU runtime, set from HCC_CPU_NUMA
+///
+/// When enabled, the CPUs of each NUMA node listed under sysfs form one node.
+/// CPUs outside the affinity mask of the process and nodes without any CPU
+/// are left out. When disabled there are no nodes, workers are not pinned and
+/// a single fallback device is exposed.
+struct CPUTopology
+{
+    /// CPUs of each node
+    std::vector<std::vector<int>> nodes;
+    /// sysfs id of each node, ids may be sparse
+    std::vector<int> ids;
+
+    CPUTopology() : nodes(), ids() {
+        char* numa_env = getenv("HCC_CPU_NUMA");
+        if (numa_env == nullptr || std::string("OFF") == numa_env)
+            return;
+        if (std::string("ON") != numa_env) {
+            std::cerr << "Ignore unknown HCC_CPU_NUMA environment variable: " << numa_env << std::endl;
+            return;
+        }
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+            return;
+        for (int node : listNodes()) {
+            std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if (!in)
+                continue;
+            std::string list;
+            std::getline(in, list);
+            std::vector<int> cpus;
+            for (int cpu : parseCPUList(list))
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+            if (!cpus.empty()) {
+                nodes.push_back(cpus);
+                ids.push_back(node);
+            }
+        }
+    }
+
+    /// ids of the nodes in sysfs, in increasing order
+    static std::vector<int> listNodes() {
+        std::vector<int> ids;
+        DIR* d = opendir("/sys/devices/system/node");
+        if (!d)
+            return ids;
+        while (struct dirent* ent = readdir(d)) {
+            int id;
+            char rest;
+            if (sscanf(ent->d_name, "node%d%c", &id, &rest) == 1)
+                ids.push_back(id);
+        }
+        closedir(d);
+        std::sort(std::begin(ids), std::end(ids));
+        return ids;
+    }
+
+    /// parse a sysfs CPU list such as "0-3,8-11"
+    static std::vector<int> parseCPUList(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+            int first, last;
+            char dash;
+            std::stringstream rs(range);
+            if (!(rs >> first))
+                continue;
+            if (!(rs >> dash >> last))
+                last = first;
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    static const CPUTopology& getInstance() {
+        static const CPUTopology topology;
+        return topology;
+    }
+};
+
+/// CPUTaskGroup
+///
+/// Tracks progress of all work units of one KalmarCPUTask
+struct CPUTaskGroup
+{
+    KalmarCPUTask* task;
+    const CPUSchedule policy;
+    /// total number of work units
+    const size_t size;
+    /// minimal number of work units handed out at once
+    const size_t grain;
+    /// number of runners sharing the task
+    const size_t runners;
+    /// next work unit to be handed out (dynamic and guided)
+    std::atomic<size_t> cursor;
+
+    /// number of runners not yet finished
+    std::atomic<size_t> remaining;
+    std::mutex mutex;
+    std::condition_variable done;
+    /// first exception thrown by any runner, rethrown to the launching thread
+    std::exception_ptr error;
+    /// called by the last runner with error instead of notifying done, for a
+    /// group nobody waits for, which is then deleted
+    std::function<void(std::exception_ptr)> callback;
+
+    CPUTaskGroup(KalmarCPUTask* task, CPUSchedule policy, size_t size, size_t grain, size_t runners)
+        : task(task), policy(policy), size(size), grain(grain), runners(runners),
+          cursor(0), remaining(runners), mutex(), done(), error(nullptr), callback() {}
+
+    /// claim the next chunk of work units [begin, end) for runner
+    /// @first: true if this is the first claim of the runner
+    bool next(size_t runner, bool first, size_t& begin, size_t& end) {
+        switch (policy) {
+        case schedule_static:
+            if (!first)
+                return false;
+            begin = size * runner / runners;
+            end = size * (runner + 1) / runners;
+            return begin < end;
+        case schedule_dynamic:
+            begin = cursor.fetch_add(grain);
+            if (begin >= size)
+                return false;
+            end = std::min(size, begin + grain);
+            return true;
+        case schedule_guided:
+            begin = cursor.load();
+            do {
+                if (begin >= size)
+                    return false;
+                end = begin + std::max(grain, (size - begin) / (2 * runners));
+                end = std::min(size, end);
+            } while (!cursor.compare_exchange_weak(begin, end));
+            return true;
+        }
+        return false;
+    }
+};
+
+/// one runner of a KalmarCPUTask queued on a worker
+struct CPUWorkItem
+{
+    size_t runner;
+    CPUTaskGroup* group;
+};
+
+/// CPUWorkerPool
+///
+/// Pool of persistent worker threads used to execute kernels on CPU path.
+/// Each worker owns a deque of work items. A worker pops from the back of its
+/// own deque and steals from the front of other deques when its own deque
+/// runs dry. The launching thread also helps to execute work items until its
+/// own task completes, which keeps nested launches deadlock free.
+///
+/// There is one pool per NUMA node when HCC_CPU_NUMA is enabled, with each
+/// worker pinned to one CPU of the node. Threads outside a pinned pool do not
+/// help executing its work items, so all of them run on the node.
+class CPUWorkerPool
+{
+    struct Worker {
+        std::deque<CPUWorkItem> items;
+        std::mutex mutex;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    /// number of queued work items not yet picked up by any thread
+    std::atomic<size_t> queued;
+    /// used to put idle workers to sleep
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    bool stop;
+    /// CPUs the workers are pinned to, empty if not pinned
+    const std::vector<int> cpus;
+
+    /// pool and index of the worker owned by the calling thread, -1 if not a
+    /// worker
+    static thread_local CPUWorkerPool* currentPool;
+    static thread_local int currentWorker;
+    /// number of work items the calling thread is executing, more than one
+    /// for kernels launched from a kernel
+    static thread_local int executing;
+
+    bool pop(int idx, CPUWorkItem& item) {
+        Worker& w = *workers[idx];
+        std::lock_guard<std::mutex> lck(w.mutex);
+        if (w.items.empty())
+            return false;
+        item = w.items.back();
+        w.items.pop_back();
+        return true;
+    }
+
+    bool steal(int idx, CPUWorkItem& item) {
+        Worker& w = *workers[idx];
+        std::unique_lock<std::mutex> lck(w.mutex, std::try_to_lock);
+        if (!lck.owns_lock() || w.items.empty())
+            return false;
+        item = w.items.front();
+        w.items.pop_front();
+        return true;
+    }
+
+    /// count a work item as picked up, the counter never wraps below zero
+    void picked() {
+        size_t n = queued.load(std::memory_order_relaxed);
+        while (n > 0 && !queued.compare_exchange_weak(n, n - 1))
+            ;
+    }
+
+    /// find a work item, starting from the deque of worker idx
+    bool acquire(int idx, CPUWorkItem& item) {
+        if (queued.load(std::memory_order_acquire) == 0)
+            return false;
+        const int n = workers.size();
+        if (idx >= 0 && pop(idx, item)) {
+            picked();
+            return true;
+        }
+        int start = idx >= 0 ? idx + 1 : 0;
+        for (int i = 0; i < n; ++i) {
+            int victim = (start + i) % n;
+            if (victim != idx && steal(victim, item)) {
+                picked();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void execute(const CPUWorkItem& item) {
+        CPUTaskGroup* group = item.group;
+        ++executing;
+        try {
+            size_t begin, end;
+            bool first = true;
+            while (group->next(item.runner, first, begin, end)) {
+                group->task->run(begin, end);
+                first = false;
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lck(group->mutex);
+            if (!group->error)
+                group->error = std::current_exception();
+        }
+        /// the group may be gone once remaining reaches 0, unless this runner
+        /// deletes it: a waiting thread returns as soon as it sees 0, so it is
+        /// decremented under the mutex the waiter holds
+        if (group->callback) {
+            if (--group->remaining == 0) {
+                group->callback(group->error);
+                delete group;
+            }
+        } else {
+            std::lock_guard<std::mutex> lck(group->mutex);
+            if (--group->remaining == 0)
+                group->done.notify_all();
+        }
+        --executing;
+    }
+
+    void workerLoop(int idx) {
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[idx], &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+        currentPool = this;
+        currentWorker = idx;
+        CPUWorkItem item;
+        while (true) {
+            if (acquire(idx, item)) {
+                execute(item);
+                continue;
+            }
+            std::unique_lock<std::mutex> lck(sleepMutex);
+            wakeup.wait(lck, [&] { return stop || queued.load() > 0; });
+            if (stop && queued.load() == 0)
+                return;
+        }
+    }
+
+    /// @cpus: one worker is pinned to each of them, or @count unpinned
+    ///        workers are created if empty, hardware_concurrency if 0
+    explicit CPUWorkerPool(const std::vector<int>& cpus, unsigned int count = 0)
+        : workers(), threads(), queued(0), sleepMutex(), wakeup(), stop(false), cpus(cpus) {
+        unsigned int n = cpus.size();
+        if (n == 0)
+            n = count;
+        if (n == 0)
+            n = std::thread::hardware_concurrency();
+        if (n == 0)
+            n = 1;
+        for (unsigned int i = 0; i < n; ++i)
+            workers.emplace_back(new Worker);
+        for (unsigned int i = 0; i < n; ++i)
+            threads.emplace_back(&CPUWorkerPool::workerLoop, this, i);
+    }
+
+public:
+    ~CPUWorkerPool() {
+        {
+            std::lock_guard<std::mutex> lck(sleepMutex);
+            stop = true;
+        }
+        wakeup.notify_all();
+        for (auto& t : threads)
+            t.join();
+    }
+
+    /// pool of the given NUMA node, node 0 if NUMA is disabled
+    static CPUWorkerPool& getInstance(int node = 0) {
+        static std::vector<std::unique_ptr<CPUWorkerPool>> pools = [] {
+            std::vector<std::unique_ptr<CPUWorkerPool>> p;
+            for (const auto& cpus : CPUTopology::getInstance().nodes)
+                p.emplace_back(new CPUWorkerPool(cpus));
+            if (p.empty())
+                p.emplace_back(new CPUWorkerPool(std::vector<int>()));
+            return p;
+        }();
+        return *pools[node];
+    }
+
+    /// pool of the copy workers, which execute the copies enqueued on any
+    /// queue while the other pools run kernels, HCC_CPU_COPY_THREADS of
+    /// them, 2 by default
+    static CPUWorkerPool& getCopyInstance() {
+        static CPUWorkerPool pool(std::vector<int>(), [] {
+            char* threads_env = getenv("HCC_CPU_COPY_THREADS");
+            unsigned int n = threads_env ? strtoul(threads_env, nullptr, 10) : 0;
+            return n > 0 ? n : 2u;
+        }());
+        return pool;
+    }
+
+    size_t size() const { return workers.size(); }
+
+    /// true if the calling thread is executing a kernel of any pool
+    static bool inTask() { return executing > 0; }
+
+    /// scheduling of @size work units among the workers
+    void plan(size_t size, CPUSchedule& policy, size_t& grain, size_t& runners) const {
+        static const CPUScheduleConfig config;
+        const size_t n = workers.size();
+
+        /// by default hand out chunks small enough to balance irregular
+        /// kernels, but big enough to amortize the cost of claiming them
+        policy = config.policy;
+        grain = config.grain;
+        if (grain == 0)
+            grain = config.policy == schedule_guided ? 1 : std::max<size_t>(1, size / (n * 8));
+        const size_t chunks = (size + grain - 1) / grain;
+        runners = std::min(n, config.policy == schedule_static ? size : chunks);
+    }
+
+    /// distribute the runners of @group round-robin, starting from worker
+    /// @self of the calling thread if any
+    void dispatch(CPUTaskGroup* group, int self) {
+        const size_t n = workers.size();
+        const int first = self >= 0 ? self : 0;
+        /// counted before they are pushed, so that a thread picking one up
+        /// right away never decrements the counter before it is incremented
+        {
+            std::lock_guard<std::mutex> lck(sleepMutex);
+            queued += group->runners;
+        }
+        for (size_t i = 0; i < group->runners; ++i) {
+            Worker& w = *workers[(first + i) % n];
+            std::lock_guard<std::mutex> lck(w.mutex);
+            w.items.push_back({i, group});
+        }
+        wakeup.notify_all();
+    }
+
+    /// execute all work units of the task and block until they are done
+    void run(KalmarCPUTask* task) {
+        const size_t size = task->getSize();
+        if (size == 0)
+            return;
+        CPUSchedule policy;
+        size_t grain, runners;
+        plan(size, policy, grain, runners);
+        CPUTaskGroup group(task, policy, size, grain, runners);
+        const int self = currentPool == this ? currentWorker : -1;
+        dispatch(&group, self);
+
+        /// help executing queued work until this task completes
+        CPUWorkItem item;
+        if (self >= 0 || cpus.empty())
+            while (group.remaining.load() > 0 && acquire(self, item))
+                execute(item);
+
+        std::unique_lock<std::mutex> lck(group.mutex);
+        group.done.wait(lck, [&] { return group.remaining.load() == 0; });
+        if (group.error)
+            std::rethrow_exception(group.error);
+    }
+
+    /// execute all work units of the task on the workers without waiting for
+    /// them, the last one calls @done with the exception thrown by the
+    /// kernel, if any, on the calling thread if the task has no work unit
+    void submit(KalmarCPUTask* task, std::function<void(std::exception_ptr)> done) {
+        const size_t size = task->getSize();
+        if (size == 0) {
+            done(nullptr);
+            return;
+        }
+        CPUSchedule policy;
+        size_t grain, runners;
+        plan(size, policy, grain, runners);
+        CPUTaskGroup* group = new CPUTaskGroup(task, policy, size, grain, runners);
+        group->callback = std::move(done);
+        dispatch(group, currentPool == this ? currentWorker : -1);
+    }
+};
+
+thread_local CPUWorkerPool* CPUWorkerPool::currentPool = nullptr;
+thread_local int CPUWorkerPool::currentWorker = -1;
+thread_local int CPUWorkerPool::executing = 0;
+
+/// timestamps of CPU runtime are in nanoseconds of a steady clock
+static inline uint64_t getCPUTicks() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const uint64_t CPUTickFrequency = 1000000000L;
+
+/// asynchronous kernel launched on a CPUFallbackQueue
+class CPUFallbackOp final : public KalmarAsyncOp
+{
+    std::promise<void> promise;
+    /// ready once the kernel has completed
+    std::shared_future<void> done;
+    /// future handed to waiters, enqueues a deferred kernel first
+    std::shared_future<void> future;
+    std::function<void()> flush;
+    std::atomic<uint64_t> beginTimestamp;
+    std::atomic<uint64_t> endTimestamp;
+    std::mutex mutex;
+    bool completed;
+    /// called once the kernel has completed, see then
+    std::vector<std::function<void()>> continuations;
+
+public:
+    CPUFallbackOp() : promise(), done(promise.get_future().share()), future(done),
+        flush(), beginTimestamp(0), endTimestamp(0), mutex(), completed(false), continuations() {}
+
+    std::shared_future<void>* getFuture() override { return &future; }
+
+    uint64_t getBeginTimestamp() override { return beginTimestamp.load(); }
+    uint64_t getEndTimestamp() override { return endTimestamp.load(); }
+    uint64_t getTimestampFrequency() override { return CPUTickFrequency; }
+
+    bool isReady() override {
+        if (flush)
+            flush();
+        return done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    const std::shared_future<void>& get_done() const { return done; }
+
+    /// the kernel is deferred until @f enqueues it, waiting for it calls @f
+    void defer(std::function<void()> f) {
+        flush = f;
+        std::shared_future<void> d = done;
+        future = std::async(std::launch::deferred, [f, d] { f(); d.get(); }).share();
+    }
+
+    /// call @f once the kernel has completed, right away if it has
+    void then(std::function<void()> f) {
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            if (!completed) {
+                continuations.push_back(std::move(f));
+                return;
+            }
+        }
+        f();
+    }
+
+    /// a deferred kernel is enqueued first, otherwise it might never complete
+    bool notify(std::function<void()> f) override {
+        if (flush)
+            flush();
+        then(std::move(f));
+        return true;
+    }
+
+    void begin() { beginTimestamp = getCPUTicks(); }
+
+    void complete(std::exception_ptr error) {
+        endTimestamp = getCPUTicks();
+        if (error)
+            promise.set_exception(error);
+        else
+            promise.set_value();
+        std::vector<std::function<void()>> next;
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            completed = true;
+            next.swap(continuations);
+        }
+        for (auto& f : next)
+            f();
+    }
+};
+
+/// execute all work units of the task on the worker pool, then finish it
+/// return the exception thrown by the kernel, if any
+static std::exception_ptr runCPUTask(CPUWorkerPool& pool, KalmarCPUTask *task) {
+    std::exception_ptr error;
+    try {
+        pool.run(task);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    task->finish();
+    return error;
+}
+
+/// marker enqueued on a CPUFallbackQueue, it has no work units and completes
+/// once the kernels before it are done
+///
+/// No thread waits for the operation the marker depends on, the queue
+/// completes the marker from a continuation of it, see ScheduleContinuation.
+class CPUMarkerTask final : public KalmarCPUTask
+{
+    /// operation of any queue the marker also waits for, if any
+    std::shared_ptr<KalmarAsyncOp> dependency;
+public:
+    explicit CPUMarkerTask(const std::shared_ptr<KalmarAsyncOp>& dependency = nullptr)
+        : dependency(dependency && dependency->getFuture() ? dependency : nullptr) {}
+    size_t getSize() const override { return 0; }
+    void run(size_t begin, size_t end) override {}
+    const std::shared_ptr<KalmarAsyncOp>& getDependency() const { return dependency; }
+};
+
+/// call @f once @op has completed, on the continuation executor unless it is
+/// ready already
+static void whenComplete(const std::shared_ptr<KalmarAsyncOp>& op, std::function<void()> f) {
+    CLAMP::ScheduleContinuation(*op->getFuture(), op, std::move(f));
+}
+
+/// kernels launched asynchronously on a CPUFallbackQueue, executed in order
+/// by a dispatcher thread
+///
+/// The list is shared by the queue and its dispatcher, so the dispatcher stays
+/// valid when the last reference to the queue is dropped by a finished kernel.
+/// Kernels launched synchronously run on the launching thread, but also take
+/// the list as busy, so a queue shared by several host threads executes one
+/// kernel at a time. Kernels of different queues run concurrently on the
+/// worker pool.
+///
+/// A queue executing in any order has no dispatcher. Each kernel starts on
+/// the worker pool as soon as the kernels it depends on have completed: the
+/// ones before it writing a buffer range it uses or using a range it writes,
+/// and the last marker. A marker depends on every kernel before it.
+///
+/// Copies are ordered the same way, but their work units are executed by the
+/// copy workers instead of the worker pool of the queue.
+struct CPUDispatchList : public std::enable_shared_from_this<CPUDispatchList>
+{
+    struct PendingTask {
+        std::shared_ptr<KalmarCPUTask> task;
+        std::shared_ptr<CPUFallbackOp> op;
+    };
+    /// kernel of a queue executing in any order which has not completed
+    struct Inflight {
+        std::shared_ptr<CPUFallbackOp> op;
+        std::vector<CPUBufferAccess> accesses;
+        /// set if the buffers used by the kernel are unknown
+        bool all;
+    };
+    const bool ordered;
+    std::deque<PendingTask> pending;
+    std::vector<Inflight> inflight;
+    /// last marker of a queue executing in any order, until it completes
+    std::shared_ptr<CPUFallbackOp> barrier;
+    /// kernels recorded in queuing_mode_deferred and not enqueued yet
+    PendingTask deferred;
+    /// set while the dispatcher executes a kernel taken from pending
+    bool busy;
+    /// operation of that kernel
+    std::shared_ptr<CPUFallbackOp> running;
+    bool stop;
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::thread::id dispatcher;
+    CPUWorkerPool& pool;
+    CPUWorkerPool& copyPool;
+
+    CPUDispatchList(CPUWorkerPool& pool, CPUWorkerPool& copyPool, bool ordered)
+        : ordered(ordered), pending(), inflight(), barrier(), deferred(), busy(false), running(), stop(false),
+          mutex(), cond(), dispatcher(), pool(pool), copyPool(copyPool) {}
+
+    /// pool executing the work units of @task
+    CPUWorkerPool& poolFor(const KalmarCPUTask* task) { return task->isCopy() ? copyPool : pool; }
+
+    void loop() {
+        std::unique_lock<std::mutex> lck(mutex);
+        while (true) {
+            cond.wait(lck, [&] { return (stop && pending.empty()) || (!pending.empty() && !busy); });
+            if (pending.empty())
+                return;
+            PendingTask item = std::move(pending.front());
+            pending.pop_front();
+            busy = true;
+            running = item.op;
+            lck.unlock();
+
+            item.op->begin();
+            std::exception_ptr error = runCPUTask(poolFor(item.task.get()), item.task.get());
+            /// release the kernel before it is reported complete, its captured
+            /// buffers may be destroyed here and synchronize to host memory
+            /// the waiting thread is about to free
+            std::shared_ptr<CPUFallbackOp> op = std::move(item.op);
+            std::shared_ptr<KalmarAsyncOp> dependency;
+            if (auto marker = std::dynamic_pointer_cast<CPUMarkerTask>(item.task))
+                dependency = marker->getDependency();
+            item = PendingTask();
+
+            /// the queue stays busy until the operation a marker depends on
+            /// has completed, without the dispatcher waiting for it
+            if (dependency) {
+                std::shared_ptr<CPUDispatchList> self = shared_from_this();
+                whenComplete(dependency, [self, op] {
+                    op->complete(nullptr);
+                    self->idle();
+                });
+                lck.lock();
+                continue;
+            }
+            op->complete(error);
+
+            lck.lock();
+            busy = false;
+            running.reset();
+            cond.notify_all();
+        }
+    }
+
+    /// let the dispatcher take the next kernel
+    void idle() {
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            busy = false;
+            running.reset();
+        }
+        cond.notify_all();
+    }
+
+    /// true if a kernel using @accesses, all buffers if null, has to run
+    /// after @prev
+    static bool conflicts(const Inflight& prev, const std::vector<CPUBufferAccess>* accesses) {
+        if (prev.all || !accesses)
+            return true;
+        for (const CPUBufferAccess& a : *accesses) {
+            for (const CPUBufferAccess& b : prev.accesses) {
+                if (a.rw == b.rw && (a.modify || b.modify) && a.begin < b.end && b.begin < a.end)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    /// start @item on the worker pool once the kernels it depends on have
+    /// completed, a marker also waits for @dependency unless null
+    void schedule(PendingTask item, bool marker = false,
+                  const std::shared_ptr<KalmarAsyncOp>& dependency = nullptr) {
+        std::vector<std::shared_ptr<CPUFallbackOp>> deps;
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            const std::vector<CPUBufferAccess>* accesses = marker ? nullptr : item.task->getAccesses();
+            if (barrier)
+                deps.push_back(barrier);
+            for (const Inflight& prev : inflight) {
+                if (marker || conflicts(prev, accesses))
+                    deps.push_back(prev.op);
+            }
+            if (marker) {
+                inflight.push_back({item.op, std::vector<CPUBufferAccess>(), false});
+                barrier = item.op;
+            } else
+                inflight.push_back({item.op, accesses ? *accesses : std::vector<CPUBufferAccess>(), !accesses});
+        }
+
+        /// the kernel is only held by @slot, moved out when it is launched
+        auto waiting = std::make_shared<std::atomic<size_t>>(deps.size() + (dependency ? 2 : 1));
+        auto slot = std::make_shared<PendingTask>(std::move(item));
+        std::shared_ptr<CPUDispatchList> self = shared_from_this();
+        std::function<void()> release = [self, slot, waiting] {
+            if (--*waiting == 0)
+                self->launch(std::move(*slot));
+        };
+        for (const auto& dep : deps)
+            dep->then(release);
+        /// an operation of any queue, a kernel deferred on its queue is
+        /// enqueued first
+        if (dependency)
+            whenComplete(dependency, release);
+        release();
+    }
+
+    /// execute @item on the worker pool without waiting for it
+    void launch(PendingTask item) {
+        KalmarCPUTask* task = item.task.get();
+        std::shared_ptr<CPUDispatchList> self = shared_from_this();
+        item.op->begin();
+        auto slot = std::make_shared<PendingTask>(std::move(item));
+        poolFor(task).submit(task, [self, slot](std::exception_ptr error) {
+            slot->task->finish();
+            /// release the kernel before it is reported complete, its
+            /// captured buffers may be destroyed here
+            std::shared_ptr<CPUFallbackOp> op = std::move(slot->op);
+            *slot = PendingTask();
+            op->complete(error);
+            {
+                std::lock_guard<std::mutex> lck(self->mutex);
+                auto& v = self->inflight;
+                v.erase(std::find_if(std::begin(v), std::end(v), [&](const Inflight& i) { return i.op == op; }));
+                if (self->barrier == op)
+                    self->barrier.reset();
+            }
+            self->cond.notify_all();
+        });
+    }
+
+    /// execute @task on the calling thread after the kernels in the list and
+    /// any other kernel executing on the queue
+    /// on a queue executing in any order, only after those it depends on,
+    /// the calling thread waits for the worker pool to execute it
+    std::exception_ptr run(KalmarCPUTask *task) {
+        if (!ordered) {
+            auto op = std::make_shared<CPUFallbackOp>();
+            /// the task lives until the caller is done waiting for it
+            schedule({std::shared_ptr<KalmarCPUTask>(task, [](KalmarCPUTask*) {}), op});
+            try {
+                op->get_done().get();
+            } catch (...) {
+                return std::current_exception();
+            }
+            return nullptr;
+        }
+        {
+            std::unique_lock<std::mutex> lck(mutex);
+            cond.wait(lck, [&] { return pending.empty() && !busy; });
+            busy = true;
+        }
+        std::exception_ptr error = runCPUTask(poolFor(task), task);
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            busy = false;
+            running.reset();
+        }
+        cond.notify_all();
+        return error;
+    }
+
+    /// enqueue the deferred kernels, only if they complete @op unless null
+    void flush(const KalmarAsyncOp* op = nullptr) {
+        PendingTask item;
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            if (!deferred.task || (op && op != deferred.op.get()))
+                return;
+            std::swap(item, deferred);
+        }
+        try {
+            item.task->enqueue(item.op->get_done());
+        } catch (...) {
+            item.task->finish();
+            item.op->complete(std::current_exception());
+            return;
+        }
+        if (!ordered) {
+            schedule(std::move(item));
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lck(mutex);
+            pending.push_back(std::move(item));
+        }
+        cond.notify_all();
+    }
+
+    /// block until all kernels in the list are done
+    void wait() {
+        std::unique_lock<std::mutex> lck(mutex);
+        /// the dispatcher never waits for the kernel it is executing
+        if (std::this_thread::get_id() == dispatcher)
+            return;
+        cond.wait(lck, [&] { return pending.empty() && !busy && inflight.empty(); });
+    }
+
+    /// number of kernels and markers not completed yet
+    /// an operation is reported complete before it leaves the list
+    int count() {
+        auto done = [](const std::shared_ptr<CPUFallbackOp>& op) {
+            return op->get_done().wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        };
+        std::lock_guard<std::mutex> lck(mutex);
+        return pending.size() + (busy && !done(running)) + (deferred.task ? 1 : 0) +
+               std::count_if(inflight.begin(), inflight.end(), [&](const Inflight& i) { return !done(i.op); });
+    }
+};
+
+/// settings of the copies done by CPUFallbackQueue, set from
+/// HCC_CPU_COPY_THRESHOLD and HCC_CPU_STREAM_THRESHOLD, in bytes
+struct CPUCopyConfig
+{
+    /// copies from this size are split among the workers of the queue
+    size_t threshold;
+    /// copies from this size write with non-temporal stores, their
+    /// destination would be evicted from the caches before it is read anyway,
+    /// the size of the last level cache by default
+    size_t streaming;
+
+    CPUCopyConfig() : threshold(1 << 20), streaming(8 << 20) {
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+        long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (llc > 0)
+            streaming = llc;
+#endif
+        char* threshold_env = getenv("HCC_CPU_COPY_THRESHOLD");
+        if (threshold_env != nullptr)
+            threshold = strtoull(threshold_env, nullptr, 10);
+        char* streaming_env = getenv("HCC_CPU_STREAM_THRESHOLD");
+        if (streaming_env != nullptr)
+            streaming = strtoull(streaming_env, nullptr, 10);
+    }
+};
+
+/// copy @count bytes with non-temporal stores, which do not bring the
+/// destination into the caches
+static void streamCopy(char* dst, const char* src, size_t count) {
+#if defined(__SSE2__)
+    const size_t head = std::min(count, size_t(-reinterpret_cast<uintptr_t>(dst) & 15));
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    count -= head;
+    const size_t lines = count / 64;
+    __m128i* d = reinterpret_cast<__m128i*>(dst);
+    const __m128i* s = reinterpret_cast<const __m128i*>(src);
+    for (size_t i = 0; i < lines; ++i, d += 4, s += 4) {
+        __m128i v0 = _mm_loadu_si128(s);
+        __m128i v1 = _mm_loadu_si128(s + 1);
+        __m128i v2 = _mm_loadu_si128(s + 2);
+        __m128i v3 = _mm_loadu_si128(s + 3);
+        _mm_stream_si128(d, v0);
+        _mm_stream_si128(d + 1, v1);
+        _mm_stream_si128(d + 2, v2);
+        _mm_stream_si128(d + 3, v3);
+    }
+    // make the stores visible to the thread waiting for the copy
+    _mm_sfence();
+    memcpy(dst + lines * 64, src + lines * 64, count - lines * 64);
+#else
+    memcpy(dst, src, count);
+#endif
+}
+
+/// copy of a large range split among the workers of a pool
+///
+/// Chunks are aligned on the destination address, so that each page of it
+/// is written by one worker, and the pool of a fallback device on a NUMA node
+/// only has workers on that node.
+class CPUMemcpyTask final : public KalmarCPUTask
+{
+    char* dst;
+    const char* src;
+    size_t count;
+    bool streaming;
+    /// bytes before dst in its first chunk
+    size_t skew;
+public:
+    /// bytes copied by a work unit, a multiple of the page size
+    static const size_t chunkSize = 256 * 1024;
+
+    CPUMemcpyTask(void* dst, const void* src, size_t count, bool streaming)
+        : dst(static_cast<char*>(dst)), src(static_cast<const char*>(src)), count(count),
+          streaming(streaming), skew(reinterpret_cast<uintptr_t>(dst) % chunkSize) {}
+
+    size_t getSize() const override { return (skew + count + chunkSize - 1) / chunkSize; }
+
+    void run(size_t begin, size_t end) override {
+        const size_t first = begin == 0 ? 0 : begin * chunkSize - skew;
+        const size_t len = std::min(end * chunkSize - skew, count) - first;
+        if (streaming)
+            streamCopy(dst + first, src + first, len);
+        else
+            memcpy(dst + first, src + first, len);
+    }
+};
+
+/// memmove @count bytes from @src to @dst, on the workers of @pool from the
+/// copy threshold unless the ranges overlap
+static void copyBytes(CPUWorkerPool& pool, void* dst, const void* src, size_t count) {
+    static const CPUCopyConfig config;
+    const char* d = static_cast<const char*>(dst);
+    const char* s = static_cast<const char*>(src);
+    if (count < config.threshold || (d < s + count && s < d + count)) {
+        memmove(dst, src, count);
+        return;
+    }
+    CPUMemcpyTask task(dst, src, count, count >= config.streaming);
+    pool.run(&task);
+}
+
+/// strided copy with rows split among the workers of a pool, in units of
+/// about CPUMemcpyTask::chunkSize bytes
+class CPURectTask final : public KalmarCPUTask
+{
+    char* dst;
+    const char* src;
+    const KalmarRect& rect;
+    bool streaming;
+    /// rows copied by a work unit
+    size_t rowsPerUnit;
+public:
+    CPURectTask(void* dst, const void* src, const KalmarRect& rect, bool streaming)
+        : dst(static_cast<char*>(dst)), src(static_cast<const char*>(src)), rect(rect),
+          streaming(streaming), rowsPerUnit(std::max<size_t>(1, CPUMemcpyTask::chunkSize / rect.width)) {}
+
+    size_t getSize() const override {
+        return (rect.rows * rect.slices + rowsPerUnit - 1) / rowsPerUnit;
+    }
+
+    void run(size_t begin, size_t end) override {
+        const size_t last = std::min(end * rowsPerUnit, rect.rows * rect.slices);
+        for (size_t i = begin * rowsPerUnit; i < last; ++i) {
+            const size_t s = i / rect.rows, r = i % rect.rows;
+            if (streaming)
+                streamCopy(dst + rect.dst_row(s, r), src + rect.src_row(s, r), rect.width);
+            else
+                memcpy(dst + rect.dst_row(s, r), src + rect.src_row(s, r), rect.width);
+        }
+    }
+};
+
+/// copy the rows of @rect from @src to @dst, on the workers of @pool from the
+/// copy threshold unless the ranges spanned by both sides overlap
+static void copyRect(CPUWorkerPool& pool, void* dst, const void* src, KalmarRect rect) {
+    static const CPUCopyConfig config;
+    if (rect.bytes() == 0)
+        return;
+    rect.coalesce();
+    const char* d = static_cast<const char*>(dst);
+    const char* s = static_cast<const char*>(src);
+    if (rect.bytes() < config.threshold ||
+        (d + rect.dst_offset < s + rect.src_end() && s + rect.src_offset < d + rect.dst_end())) {
+        rect.for_each_row([&](size_t src_offset, size_t dst_offset) {
+            memmove((char*)dst + dst_offset, s + src_offset, rect.width);
+        });
+        return;
+    }
+    CPURectTask task(dst, src, rect, rect.bytes() >= config.streaming);
+    pool.run(&task);
+}
+
 class CPUFallbackQueue final : public KalmarQueue
 {
+    std::shared_ptr<CPUDispatchList> list;
+    std::thread dispatcher;
+
 public:
 
-  CPUFallbackQueue(KalmarDevice* pDev) : KalmarQueue(pDev) {}
+  /// the worker pools are created before any queue running on them, so that
+  /// they are destroyed after the queues have drained their pending kernels
+  CPUFallbackQueue(KalmarDevice* pDev, CPUWorkerPool& pool, CPUWorkerPool& copyPool, execute_order order)
+      : KalmarQueue(pDev, queuing_mode_automatic, order),
+        list(std::make_shared<CPUDispatchList>(pool, copyPool, order == execute_in_order)), dispatcher() {}
+
+  ~CPUFallbackQueue() {
+      list->flush();
+      /// a worker dropping the last reference does not wait for itself
+      if (!list->ordered && !CPUWorkerPool::inTask())
+          list->wait();
+      {
+          std::lock_guard<std::mutex> lck(list->mutex);
+          list->stop = true;
+      }
+      list->cond.notify_all();
+      if (dispatcher.joinable()) {
+          if (std::this_thread::get_id() == dispatcher.get_id())
+              dispatcher.detach();
+          else
+              dispatcher.join();
+      }
+  }
+
+  void flush() override { list->flush(); }
+
+  void wait(hcWaitMode mode = hcWaitModeBlocked) override {
+      list->flush();
+      list->wait();
+  }
+
+  void LaunchCPUTask(KalmarCPUTask *task) override {
+      list->flush();
+      /// kernels in the same queue execute in order, except for those
+      /// launched from a kernel, the queue is busy with the outer one
+      std::exception_ptr error = CPUWorkerPool::inTask() ? runCPUTask(list->poolFor(task), task) : list->run(task);
+      if (error)
+          std::rethrow_exception(error);
+  }
+
+  std::shared_ptr<KalmarAsyncOp> LaunchCPUTaskAsync(const std::shared_ptr<KalmarCPUTask>& task) override {
+      list->flush();
+      auto op = std::make_shared<CPUFallbackOp>();
+      if (!list->ordered) {
+          list->schedule({task, op});
+          return op;
+      }
+      {
+          std::lock_guard<std::mutex> lck(list->mutex);
+          start();
+          list->pending.push_back({task, op});
+      }
+      list->cond.notify_all();
+      return op;
+  }
+
+  std::shared_ptr<KalmarAsyncOp> EnqueueMarker() override {
+      return EnqueueMarkerWithDependency(nullptr);
+  }
+
+  /// the marker completes once the kernels before it and @dep have, and on a
+  /// queue executing in any order the kernels after it wait for it
+  std::shared_ptr<KalmarAsyncOp> EnqueueMarkerWithDependency(const std::shared_ptr<KalmarAsyncOp>& dep) override {
+      auto task = std::make_shared<CPUMarkerTask>(dep);
+      if (list->ordered)
+          return LaunchCPUTaskAsync(task);
+      list->flush();
+      auto op = std::make_shared<CPUFallbackOp>();
+      list->schedule({task, op}, true, task->getDependency());
+      return op;
+  }
+
+  int getPendingAsyncOps() override { return list->count(); }
+
+  /// kernels deferred on the queue are fused until one can't be, and
+  /// enqueued when the queue is flushed or their completion is waited for
+  std::shared_ptr<KalmarAsyncOp> DeferCPUTask(const std::shared_ptr<KalmarCPUTask>& task) override {
+      {
+          std::lock_guard<std::mutex> lck(list->mutex);
+          if (list->deferred.task && list->deferred.task->fuse(task.get()))
+              return list->deferred.op;
+      }
+      list->flush();
+      auto op = std::make_shared<CPUFallbackOp>();
+      std::weak_ptr<CPUDispatchList> l = list;
+      const KalmarAsyncOp* p = op.get();
+      op->defer([l, p] {
+          if (std::shared_ptr<CPUDispatchList> list = l.lock())
+              list->flush(p);
+      });
+      std::lock_guard<std::mutex> lck(list->mutex);
+      start();
+      list->deferred = {task, op};
+      return op;
+  }
 
   void read(void* device, void* dst, size_t count, size_t offset) override {
       if (dst != device)
-          memmove(dst, (char*)device + offset, count);
+          copyBytes(list->pool, dst, (char*)device + offset, count);
   }
 
   void write(void* device, const void* src, size_t count, size_t offset, bool blocking) override {
       if (src != device)
-          memmove((char*)device + offset, src, count);
+          copyBytes(list->pool, (char*)device + offset, src, count);
   }
 
   void copy(void* src, void* dst, size_t count, size_t src_offset, size_t dst_offset, bool blocking) override {
       if (src != dst)
-          memmove((char*)dst + dst_offset, (char*)src + src_offset, count);
+          copyBytes(list->pool, (char*)dst + dst_offset, (char*)src + src_offset, count);
+  }
+
+  void read_rect(void* device, void* dst, const KalmarRect& rect) override {
+      copyRect(list->pool, dst, device, rect);
+  }
+
+  void write_rect(void* device, const void* src, const KalmarRect& rect, bool blocking) override {
+      copyRect(list->pool, device, src, rect);
+  }
+
+  void copy_rect(void* src, void* dst, const KalmarRect& rect, bool blocking) override {
+      copyRect(list->pool, dst, src, rect);
   }
 
   void* map(void* device, size_t count, size_t offset, bool modify) override {
@@ -46,15 +1181,67 @@ public:
   void unmap(void* device, void* addr, size_t count, size_t offset, bool modify) override {}
 
   void Push(void *kernel, int idx, void* device, bool isConst) override {}
+
+private:
+  /// start the dispatcher on the first asynchronous kernel, a queue
+  /// executing in any order has none
+  /// called with the lock of the list held
+  void start() {
+      if (list->ordered && !dispatcher.joinable()) {
+          std::shared_ptr<CPUDispatchList> l = list;
+          dispatcher = std::thread([l] { l->loop(); });
+          list->dispatcher = dispatcher.get_id();
+      }
+  }
+};
+
+/// touch one byte of each page of a new buffer from the workers of a pinned
+/// pool, so that the kernel places the pages on their NUMA node
+class CPUFirstTouchTask final : public KalmarCPUTask
+{
+    char* ptr;
+    size_t pages;
+public:
+    static const size_t pageSize = 0x1000;
+
+    CPUFirstTouchTask(void* ptr, size_t count)
+        : ptr(static_cast<char*>(ptr)), pages((count + pageSize - 1) / pageSize) {}
+
+    size_t getSize() const override { return pages; }
+
+    void run(size_t begin, size_t end) override {
+        for (size_t page = begin; page < end; ++page)
+            ptr[page * pageSize] = 0;
+    }
 };
 
 class CPUFallbackDevice final : public KalmarDevice
 {
+    /// position of the NUMA node of the device among the nodes, -1 if NUMA
+    /// is disabled
+    const int node;
+    /// sysfs id of the node
+    const int nodeId;
+    CPUWorkerPool& pool;
+    CPUWorkerPool& copyPool;
+
+    /// queues created on the device, drained before the context goes away
+    std::mutex queuesMutex;
+    std::vector<std::weak_ptr<KalmarQueue>> queues;
+
 public:
-    CPUFallbackDevice() : KalmarDevice() {}
+    CPUFallbackDevice(int node = -1)
+        : KalmarDevice(), node(node),
+          nodeId(node < 0 ? -1 : CPUTopology::getInstance().ids[node]),
+          pool(CPUWorkerPool::getInstance(node < 0 ? 0 : node)),
+          copyPool(CPUWorkerPool::getCopyInstance()), queuesMutex(), queues() {}
 
-    std::wstring get_path() const override { return L"fallback"; }
-    std::wstring get_description() const override { return L"CPU Fallback"; }
+    std::wstring get_path() const override {
+        return node <= 0 ? L"fallback" : L"fallback:" + std::to_wstring(nodeId);
+    }
+    std::wstring get_description() const override {
+        return node < 0 ? L"CPU Fallback" : L"CPU Fallback (NUMA node " + std::to_wstring(nodeId) + L")";
+    }
     size_t get_mem() const override { return 0; }
     bool is_double() const override { return true; }
     bool is_lim_double() const override { return true; }
@@ -62,13 +1249,34 @@ public:
     bool is_emulated() const override { return true; }
 
     void* create(size_t count, struct rw_info* /* not used */) override {
-        return kalmar_aligned_alloc(0x1000, count);
+        void* ptr = kalmar_aligned_alloc(CPUFirstTouchTask::pageSize, count);
+        if (node >= 0 && ptr && count > 0) {
+            CPUFirstTouchTask task(ptr, count);
+            pool.run(&task);
+        }
+        return ptr;
     }
     void release(void *device, struct rw_info* /* not used */ ) override { 
         kalmar_aligned_free(device);
     }
     std::shared_ptr<KalmarQueue> createQueue(execute_order order = execute_in_order) override {
-        return std::shared_ptr<KalmarQueue>(new CPUFallbackQueue(this));
+        std::shared_ptr<KalmarQueue> q(new CPUFallbackQueue(this, pool, copyPool, order));
+        std::lock_guard<std::mutex> lck(queuesMutex);
+        queues.erase(std::remove_if(std::begin(queues), std::end(queues), [](const std::weak_ptr<KalmarQueue>& w) {
+            return w.expired();
+        }), std::end(queues));
+        queues.push_back(q);
+        return q;
+    }
+
+    std::vector<std::shared_ptr<KalmarQueue>> get_all_queues() override {
+        std::vector<std::shared_ptr<KalmarQueue>> result;
+        std::lock_guard<std::mutex> lck(queuesMutex);
+        for (const auto& w : queues) {
+            if (auto q = w.lock())
+                result.push_back(q);
+        }
+        return result;
     }
 };
 
@@ -77,8 +1285,26 @@ template <typename T> inline void deleter(T* ptr) { delete ptr; }
 class CPUContext final : public KalmarContext
 {
 public:
-    CPUContext() { Devices.push_back(new CPUFallbackDevice); }
-    ~CPUContext() { std::for_each(std::begin(Devices), std::end(Devices), deleter<KalmarDevice>); }
+    /// one fallback device per NUMA node, the first one being the default
+    CPUContext() {
+        const size_t nodes = CPUTopology::getInstance().nodes.size();
+        if (nodes == 0)
+            Devices.push_back(new CPUFallbackDevice);
+        for (size_t i = 0; i < nodes; ++i)
+            Devices.push_back(new CPUFallbackDevice(i));
+    }
+    ~CPUContext() {
+        /// drain kernels still in flight on any queue, they may drop the last
+        /// reference to buffers whose release needs all devices alive
+        for (auto dev : Devices) {
+            for (const auto& q : dev->get_all_queues())
+                q->wait();
+        }
+        std::for_each(std::begin(Devices), std::end(Devices), deleter<KalmarDevice>);
+    }
+
+    uint64_t getSystemTicks() override { return getCPUTicks(); }
+    uint64_t getSystemTickFrequency() override { return CPUTickFrequency; }
 };
 
 
@@ -28,9 +28,11 @@
 #include <hsa_ext_finalize.h>
 #include <hsa_ext_amd.h>
 
-#include <md5.h>
 #include <kalmar_runtime.h>
 #include <kalmar_aligned_alloc.h>
+#include <kalmar_code_cache.h>
+
+#include "../mcwamp_program.hpp"
 
 #include <time.h>
 #include <iomanip>
@@ -66,6 +68,11 @@
 // default set as 0 (NOT print out kernel dispatch time)
 #define KALMAR_DISPATCH_TIME_PRINTOUT (0)
 
+// largest part of a transfer between host memory and a device without
+// unified memory staged through one buffer of the staging pool of the device
+// default set as 4MB
+#define STAGING_CHUNK_SIZE (4 << 20)
+
 
 
 static const char* getHSAErrorString(hsa_status_t s) {
@@ -119,6 +126,7 @@ static const char* getHSAErrorString(hsa_status_t s) {
 
 extern "C" void PushArgImpl(void *ker, int idx, size_t sz, const void *v);
 extern "C" void PushArgPtrImpl(void *ker, int idx, size_t sz, const void *v);
+extern "C" void PushArgsImpl(void *ker, int count, size_t sz, const void *v);
 
 // forward declaration
 namespace Kalmar {
@@ -346,6 +354,16 @@ public:
     hsa_status_t pushDoubleArg(double d) { return pushArgPrivate(d); }
     hsa_status_t pushPointerArg(void *addr) { return pushArgPrivate(addr); }
 
+    /// append @count arguments already laid out in @size bytes at @args, each
+    /// aligned to its size from the start of the kernarg segment
+    hsa_status_t pushArgs(const void* args, size_t size, int count) {
+        assert(arg_vec.empty() && "Arguments laid out after the start of the kernarg segment");
+        const uint8_t* ptr = static_cast<const uint8_t*>(args);
+        arg_vec.insert(arg_vec.end(), ptr, ptr + size);
+        arg_count += count;
+        return HSA_STATUS_SUCCESS;
+    }
+
     hsa_status_t clearArgs() {
         arg_count = 0;
         arg_vec.clear();
@@ -720,6 +738,21 @@ public:
                 std::cerr << "read(" << device << "," << dst << "," << count << "," << offset << "): use HSA memory copy\n";
 #endif
                 hsa_status_t status = HSA_STATUS_SUCCESS;
+                // stage through pinned host buffers reused across transfers,
+                // instead of locking the host memory for each of them
+                KalmarStagingPool& pool = getDev()->get_staging_pool();
+                const size_t chunk = std::min<size_t>(count, STAGING_CHUNK_SIZE);
+                void* stage = pool.acquire(chunk);
+                if (stage != nullptr) {
+                    for (size_t done = 0; done < count; done += chunk) {
+                        const size_t n = std::min(chunk, count - done);
+                        status = hsa_memory_copy(stage, (char*)device + offset + done, n);
+                        STATUS_CHECK(status, __LINE__);
+                        memcpy((char*)dst + done, stage, n);
+                    }
+                    pool.release(stage, chunk);
+                    return;
+                }
                 // Make sure host memory is accessible to gpu
                 // FIXME: host memory is allocated through OS allocator, if not, correct it.
                 hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent()); 
@@ -750,6 +783,21 @@ public:
                 std::cerr << "write(" << device << "," << src << "," << count << "," << offset << "," << blocking << "): use HSA memory copy\n";
 #endif
                 hsa_status_t status = HSA_STATUS_SUCCESS;
+                // stage through pinned host buffers reused across transfers,
+                // instead of locking the host memory for each of them
+                KalmarStagingPool& pool = getDev()->get_staging_pool();
+                const size_t chunk = std::min<size_t>(count, STAGING_CHUNK_SIZE);
+                void* stage = pool.acquire(chunk);
+                if (stage != nullptr) {
+                    for (size_t done = 0; done < count; done += chunk) {
+                        const size_t n = std::min(chunk, count - done);
+                        memcpy(stage, (const char*)src + done, n);
+                        status = hsa_memory_copy((char*)device + offset + done, stage, n);
+                        STATUS_CHECK(status, __LINE__);
+                    }
+                    pool.release(stage, chunk);
+                    return;
+                }
                 // Make sure host memory is accessible to gpu
                 // FIXME: host memory is allocated through OS allocator, if not, correct it.
                 hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent()); 
@@ -802,7 +850,7 @@ public:
         // do map
 
         // as HSA runtime doesn't have map/unmap facility at this moment,
-        // we explicitly allocate a host memory buffer in this case 
+        // we explicitly take a host memory buffer of the staging pool in this case
         if (!getDev()->is_unified()) {
 #if KALMAR_DEBUG
             std::cerr << "map(" << device << "," << count << "," << offset << "," << modify << "): use HSA memory map\n";
@@ -811,15 +859,9 @@ public:
             // allocate a host buffer
             // TODO: for safety, we copy to host, but we can map device memory to host through hsa_amd_agents_allow_access
             // withouth copying data.
-            void* data = nullptr;
-            hsa_amd_memory_pool_t* am_host_region = static_cast<hsa_amd_memory_pool_t*>(getHSAAMHostRegion());
-            status = hsa_amd_memory_pool_allocate(*am_host_region, count, 0, &data);
-            STATUS_CHECK(status, __LINE__);
+            void* data = getDev()->get_staging_pool().acquire(count);
             if (data != nullptr) {
               // copy data from device buffer to host buffer
-              hsa_agent_t* agent = static_cast<hsa_agent_t*>(getHSAAgent()); 
-              status = hsa_amd_agents_allow_access(1, agent, NULL, data);
-              STATUS_CHECK(status, __LINE__);
               status = hsa_memory_copy(data, (char*)device + offset, count);
               STATUS_CHECK(status, __LINE__);
             } else {
@@ -850,7 +892,7 @@ public:
         // do unmap
 
         // as HSA runtime doesn't have map/unmap facility at this moment,
-        // we free the host memory buffer allocated in map()
+        // we give back the host memory buffer taken in map()
         if (!getDev()->is_unified()) {
 #if KALMAR_DEBUG
             std::cerr << "unmap(" << device << "," << addr << "," << count << "," << offset << "," << modify << "): use HSA memory unmap\n";
@@ -865,8 +907,8 @@ public:
                 STATUS_CHECK(status, __LINE__);
             }
 
-            // deallocate the host buffer
-            hsa_amd_memory_pool_free(addr);
+            // give the host buffer back to the staging pool
+            getDev()->get_staging_pool().release(addr, count);
         } else {
 #if KALMAR_DEBUG
             std::cerr << "unmap(" << device << "," << addr << "," << count << "," << offset << "," << modify << "): use host memory unmap\n";
@@ -877,7 +919,10 @@ public:
 
     void Push(void *kernel, int idx, void *device, bool modify) override {
         PushArgImpl(kernel, idx, sizeof(void*), &device);
+        RegisterBuffer(kernel, device, modify);
+    }
 
+    void RegisterBuffer(void *kernel, void *device, bool modify) override {
         // register the buffer with the kernel
         // when the buffer may be read/written by the kernel
         // the buffer is not registered if it's only read by the kernel
@@ -954,6 +999,9 @@ private:
     uint16_t workgroup_max_dim[3];
 
     std::map<std::string, HSAExecutable*> executables;
+    /// guards programs and executables, kernels may be built on first launch
+    /// while HCC_PREWARM builds the others
+    std::mutex executables_mutex;
 
     hsa_isa_t agentISA;
 
@@ -1215,6 +1263,10 @@ public:
         queues.clear();
         queues_mutex.unlock();
 
+        // deallocate host buffers kept by the staging pool, while the
+        // allocator of this device can still be called
+        get_staging_pool().clear();
+
         // deallocate kernarg buffers in the pool
         if (hasHSAKernargRegion() && USE_KERNARG_REGION) {
 #if KERNARG_POOL_SIZE > 0
@@ -1310,56 +1362,31 @@ public:
         }
     }
 
-    // calculate MD5 checksum
-    std::string MD5Sum(size_t size, void* source) {
-        unsigned char md5_hash[16];
-        memset(md5_hash, 0, sizeof(unsigned char) * 16);
-        MD5_CTX md5ctx;
-        MD5_Init(&md5ctx);
-        MD5_Update(&md5ctx, source, size);
-        MD5_Final(md5_hash, &md5ctx);
-
-        std::stringstream checksum;
-        checksum << std::setbase(16);
-        for (int i = 0; i < 16; ++i) {
-            checksum << static_cast<unsigned int>(md5_hash[i]);
-        }
-
-        return checksum.str();
-    }
-
     void BuildProgram(void* size, void* source, bool needsCompilation = true) override {
-        if (executables.find(MD5Sum((size_t)size, source)) == executables.end()) {
+        const ProgramBlob& blob = ProgramBlob::get(size, source);
+        std::lock_guard<std::mutex> l(executables_mutex);
+        if (executables.find(blob.id) == executables.end()) {
             bool use_amdgpu = false;
 #ifdef HSA_USE_AMDGPU_BACKEND
             const char *km_use_amdgpu = getenv("KM_USE_AMDGPU");
             use_amdgpu = !km_use_amdgpu || km_use_amdgpu[0] != '0';
 #endif
-            size_t kernel_size = (size_t)((void *)size);
-            char *kernel_source = (char*)malloc(kernel_size+1);
-            memcpy(kernel_source, source, kernel_size);
-            kernel_source[kernel_size] = '\0';
             if (needsCompilation && !use_amdgpu) {
-              BuildProgramImpl(kernel_source, kernel_size);
+              BuildProgramImpl(blob);
             } else {
-              BuildOfflineFinalizedProgramImpl(kernel_source, kernel_size);
+              BuildOfflineFinalizedProgramImpl(blob);
             }
-            free(kernel_source);
         }
     }
 
     bool IsCompatibleKernel(void* size, void* source) override {
         hsa_status_t status;
 
-        // Allocate memory for kernel source
-        size_t kernel_size = (size_t)((void *)size);
-        char *kernel_source = (char*)malloc(kernel_size+1);
-        memcpy(kernel_source, source, kernel_size);
-        kernel_source[kernel_size] = '\0';
+        const ProgramBlob& blob = ProgramBlob::get(size, source);
 
         // Deserialize code object.
         hsa_code_object_t code_object = {0};
-        status = hsa_code_object_deserialize(kernel_source, kernel_size, NULL, &code_object);
+        status = hsa_code_object_deserialize(const_cast<char*>(blob.data), blob.size, NULL, &code_object);
         STATUS_CHECK(status, __LINE__);
         assert(0 != code_object.handle);
 
@@ -1377,14 +1404,12 @@ public:
         status = hsa_code_object_destroy(code_object);
         STATUS_CHECK(status, __LINE__);
 
-        // release allocated memory
-        free(kernel_source);
-
         return isCompatible;
     }
 
-    void* CreateKernel(const char* fun, void* size, void* source, bool needsCompilation = true) override {
+    void* GetKernelHandle(const char* fun, void* size, void* source, bool needsCompilation = true) override {
         std::string str(fun);
+        std::lock_guard<std::mutex> l(executables_mutex);
         HSAKernel *kernel = programs[str];
         if (!kernel) {
             bool use_amdgpu = false;
@@ -1392,10 +1417,7 @@ public:
             const char *km_use_amdgpu = getenv("KM_USE_AMDGPU");
             use_amdgpu = !km_use_amdgpu || km_use_amdgpu[0] != '0';
 #endif
-            size_t kernel_size = (size_t)((void *)size);
-            char *kernel_source = (char*)malloc(kernel_size+1);
-            memcpy(kernel_source, source, kernel_size);
-            kernel_source[kernel_size] = '\0';
+            const ProgramBlob& blob = ProgramBlob::get(size, source);
             std::string kname;
             if (use_amdgpu) {
               kname = fun;
@@ -1404,11 +1426,10 @@ public:
             }
             //std::cerr << "HSADevice::CreateKernel(): Creating kernel: " << kname << "\n";
             if (needsCompilation && !use_amdgpu) {
-              kernel = CreateKernelImpl(kernel_source, kernel_size, kname.c_str());
+              kernel = CreateKernelImpl(blob, kname.c_str());
             } else {
-              kernel = CreateOfflineFinalizedKernelImpl(kernel_source, kernel_size, kname.c_str());
+              kernel = CreateOfflineFinalizedKernelImpl(blob, kname.c_str());
             }
-            free(kernel_source);
             if (!kernel) {
                 std::cerr << "HSADevice::CreateKernel(): Unable to create kernel\n";
                 abort();
@@ -1418,6 +1439,16 @@ public:
             programs[str] = kernel;
         }
 
+        return kernel;
+    }
+
+    void* CreateKernel(const char* fun, void* size, void* source, bool needsCompilation = true) override {
+        return CreateKernelFromHandle(fun, GetKernelHandle(fun, size, source, needsCompilation));
+    }
+
+    void* CreateKernelFromHandle(const char* fun, void* handle) override {
+        HSAKernel *kernel = static_cast<HSAKernel*>(handle);
+
         // HSADispatch instance will be deleted in:
         // HSAQueue::LaunchKernel()
         // or it will be created as a shared_ptr<KalmarAsyncOp> in:
@@ -1460,6 +1491,23 @@ public:
         return result;
     }
 
+protected:
+    /// host buffers of the staging pool are pinned and accessible to the agent
+    void* allocate_staging(size_t count) override {
+        void* data = nullptr;
+        hsa_status_t status = hsa_amd_memory_pool_allocate(getHSAAMHostRegion(), count, 0, &data);
+        if (status != HSA_STATUS_SUCCESS)
+            return nullptr;
+        status = hsa_amd_agents_allow_access(1, &agent, NULL, data);
+        STATUS_CHECK(status, __LINE__);
+        return data;
+    }
+
+    void free_staging(void* ptr) override {
+        hsa_amd_memory_pool_free(ptr);
+    }
+
+public:
     hsa_amd_memory_pool_t& getHSAKernargRegion() {
         return ri._kernarg_memory_pool;
     }
@@ -1732,16 +1780,59 @@ public:
 
 private:
 
-    void BuildOfflineFinalizedProgramImpl(void* kernelBuffer, int kernelSize) {
+    /// name of the ISA of the agent
+    std::string GetISAName() {
+        uint32_t length = 0;
+        if (hsa_isa_get_info(agentISA, HSA_ISA_INFO_NAME_LENGTH, 0, &length) != HSA_STATUS_SUCCESS)
+            return std::string();
+        std::vector<char> name(length + 1, '\0');
+        if (hsa_isa_get_info(agentISA, HSA_ISA_INFO_NAME, 0, name.data()) != HSA_STATUS_SUCCESS)
+            return std::string();
+        return std::string(name.data());
+    }
+
+    /// ISA of the agent and version of the runtime loading the code objects,
+    /// the target of cached code objects, so that a runtime upgrade misses
+    /// the entries of the previous one
+    std::string GetCacheTarget() {
+        uint16_t major = 0, minor = 0;
+        hsa_system_get_info(HSA_SYSTEM_INFO_VERSION_MAJOR, &major);
+        hsa_system_get_info(HSA_SYSTEM_INFO_VERSION_MINOR, &minor);
+        return GetISAName() + " hsa " + std::to_string(major) + "." + std::to_string(minor);
+    }
+
+    static hsa_status_t AllocateSerializedCodeObject(size_t size, hsa_callback_data_t data, void **address) {
+        *address = malloc(size);
+        return *address ? HSA_STATUS_SUCCESS : HSA_STATUS_ERROR_OUT_OF_RESOURCES;
+    }
+
+    /// save a finalized code object to the on-disk cache, failures only cost
+    /// finalizing again in the next process
+    void StoreCodeObject(const std::string& program, const std::string& target,
+                         const std::string& options, hsa_code_object_t codeObject) {
+        KalmarCodeCache& cache = KalmarCodeCache::getInstance();
+        if (!cache.enabled())
+            return;
+        void* serialized = nullptr;
+        size_t size = 0;
+        hsa_callback_data_t data = {0};
+        if (hsa_code_object_serialize(codeObject, AllocateSerializedCodeObject, data, NULL,
+                                      &serialized, &size) == HSA_STATUS_SUCCESS) {
+            cache.store(program, target, options, serialized, size);
+        }
+        free(serialized);
+    }
+
+    void BuildOfflineFinalizedProgramImpl(const ProgramBlob& blob) {
         hsa_status_t status;
 
-        std::string index = MD5Sum((size_t)kernelSize, kernelBuffer);
+        const std::string& index = blob.id;
 
         // load HSA program if we haven't done so
         if (executables.find(index) == executables.end()) {
             // Deserialize code object.
             hsa_code_object_t code_object = {0};
-            status = hsa_code_object_deserialize(kernelBuffer, kernelSize, NULL, &code_object);
+            status = hsa_code_object_deserialize(const_cast<char*>(blob.data), blob.size, NULL, &code_object);
             STATUS_CHECK(status, __LINE__);
             assert(0 != code_object.handle);
 
@@ -1764,14 +1855,14 @@ private:
         }
     }
 
-    HSAKernel* CreateOfflineFinalizedKernelImpl(void *kernelBuffer, int kernelSize, const char *entryName) {
+    HSAKernel* CreateOfflineFinalizedKernelImpl(const ProgramBlob& blob, const char *entryName) {
         hsa_status_t status;
 
-        std::string index = MD5Sum((size_t)kernelSize, kernelBuffer);
+        const std::string& index = blob.id;
 
         // load HSA program if we haven't done so
         if (executables.find(index) == executables.end()) {
-            BuildOfflineFinalizedProgramImpl(kernelBuffer, kernelSize);
+            BuildOfflineFinalizedProgramImpl(blob);
         }
 
         // fetch HSAExecutable*
@@ -1790,81 +1881,121 @@ private:
         return new HSAKernel(executable, kernelSymbol, kernelCodeHandle);
     }
 
-    void BuildProgramImpl(const char* hsailBuffer, int hsailSize) {
+    /// finalize the BRIG module of @blob for the agent
+    hsa_code_object_t FinalizeProgram(const ProgramBlob& blob, const char* extra_finalizer_opt) {
         hsa_status_t status;
+        hsa_code_object_t hsaCodeObject = {0};
+
+        /*
+         * Load BRIG, encapsulated in an ELF container, into a BRIG module.
+         */
+        hsa_ext_module_t hsaModule = 0;
+        hsaModule = (hsa_ext_module_t)blob.data;
+
+        /*
+         * Create hsa program.
+         */
+        hsa_ext_program_t hsaProgram = {0};
+        status = hsa_ext_program_create(HSA_MACHINE_MODEL_LARGE, HSA_PROFILE_FULL,
+                                        HSA_DEFAULT_FLOAT_ROUNDING_MODE_ZERO, NULL, &hsaProgram);
+        STATUS_CHECK(status, __LINE__);
 
-        std::string index = MD5Sum((size_t)hsailSize, (void*)hsailBuffer);
+        /*
+         * Add the BRIG module to hsa program.
+         */
+        status = hsa_ext_program_add_module(hsaProgram, hsaModule);
+        STATUS_CHECK(status, __LINE__);
 
-        // finalize HSA program if we haven't done so
-        if (executables.find(index) == executables.end()) {
-            /*
-             * Load BRIG, encapsulated in an ELF container, into a BRIG module.
-             */
-            hsa_ext_module_t hsaModule = 0;
-            hsaModule = (hsa_ext_module_t)hsailBuffer;
-
-            /*
-             * Create hsa program.
-             */
-            hsa_ext_program_t hsaProgram = {0};
-            status = hsa_ext_program_create(HSA_MACHINE_MODEL_LARGE, HSA_PROFILE_FULL,
-                                            HSA_DEFAULT_FLOAT_ROUNDING_MODE_ZERO, NULL, &hsaProgram);
-            STATUS_CHECK(status, __LINE__);
+        /*
+         * Finalize the hsa program.
+         */
+        hsa_isa_t isa = {0};
+        status = hsa_agent_get_info(agent, HSA_AGENT_INFO_ISA, &isa);
+        STATUS_CHECK(status, __LINE__);
 
-            /*
-             * Add the BRIG module to hsa program.
-             */
-            status = hsa_ext_program_add_module(hsaProgram, hsaModule);
-            STATUS_CHECK(status, __LINE__);
+        hsa_ext_control_directives_t control_directives;
+        memset(&control_directives, 0, sizeof(hsa_ext_control_directives_t));
+
+        status = hsa_ext_program_finalize(hsaProgram, isa, 0, control_directives,
+                                          extra_finalizer_opt, HSA_CODE_OBJECT_TYPE_PROGRAM, &hsaCodeObject);
+        STATUS_CHECK(status, __LINE__);
 
-            /*
-             * Finalize the hsa program.
-             */
-            hsa_isa_t isa = {0};
-            status = hsa_agent_get_info(agent, HSA_AGENT_INFO_ISA, &isa);
+        if (hsaProgram.handle != 0) {
+            status = hsa_ext_program_destroy(hsaProgram);
             STATUS_CHECK(status, __LINE__);
+        }
+        return hsaCodeObject;
+    }
 
-            hsa_ext_control_directives_t control_directives;
-            memset(&control_directives, 0, sizeof(hsa_ext_control_directives_t));
+    /// load @codeObject into a new executable and freeze it
+    /// the executable is destroyed again if the runtime rejects the code object
+    hsa_status_t LoadCodeObject(hsa_code_object_t codeObject, hsa_executable_t& hsaExecutable) {
+        hsa_status_t status;
+
+        // Create the executable.
+        status = hsa_executable_create(HSA_PROFILE_FULL, HSA_EXECUTABLE_STATE_UNFROZEN,
+                                       NULL, &hsaExecutable);
+        STATUS_CHECK(status, __LINE__);
 
+        // Load the code object.
+        status = hsa_executable_load_code_object(hsaExecutable, agent, codeObject, NULL);
+
+        // Freeze the executable.
+        if (status == HSA_STATUS_SUCCESS)
+            status = hsa_executable_freeze(hsaExecutable, NULL);
+
+        if (status != HSA_STATUS_SUCCESS)
+            hsa_executable_destroy(hsaExecutable);
+        return status;
+    }
+
+    void BuildProgramImpl(const ProgramBlob& blob) {
+        hsa_status_t status;
+
+        const std::string& index = blob.id;
+
+        // finalize HSA program if we haven't done so
+        if (executables.find(index) == executables.end()) {
             const char* extra_finalizer_opt = getenv("HCC_FINALIZE_OPT");
+            std::string options = extra_finalizer_opt ? extra_finalizer_opt : "";
+
+            // reuse the code object finalized by an earlier process, if any
+            KalmarCodeCache& cache = KalmarCodeCache::getInstance();
+            std::string target = GetCacheTarget();
             hsa_code_object_t hsaCodeObject = {0};
-            status = hsa_ext_program_finalize(hsaProgram, isa, 0, control_directives,
-                                              extra_finalizer_opt, HSA_CODE_OBJECT_TYPE_PROGRAM, &hsaCodeObject);
-            STATUS_CHECK(status, __LINE__);
+            hsa_executable_t hsaExecutable;
+            std::vector<char> cached;
+            if (cache.load(index, target, options, cached)) {
+                status = hsa_code_object_deserialize(cached.data(), cached.size(), NULL, &hsaCodeObject);
+                if (status != HSA_STATUS_SUCCESS) {
+                    hsaCodeObject.handle = 0;
+                } else if (LoadCodeObject(hsaCodeObject, hsaExecutable) != HSA_STATUS_SUCCESS) {
+                    // rejected by this runtime, finalized again and replaced
+                    hsa_code_object_destroy(hsaCodeObject);
+                    hsaCodeObject.handle = 0;
+                }
+            }
 
-            if (hsaProgram.handle != 0) {
-                status = hsa_ext_program_destroy(hsaProgram);
+            if (hsaCodeObject.handle == 0) {
+                hsaCodeObject = FinalizeProgram(blob, extra_finalizer_opt);
+                status = LoadCodeObject(hsaCodeObject, hsaExecutable);
                 STATUS_CHECK(status, __LINE__);
+                StoreCodeObject(index, target, options, hsaCodeObject);
             }
 
-            // Create the executable.
-            hsa_executable_t hsaExecutable;
-            status = hsa_executable_create(HSA_PROFILE_FULL, HSA_EXECUTABLE_STATE_UNFROZEN,
-                                           NULL, &hsaExecutable);
-            STATUS_CHECK(status, __LINE__);
-
-            // Load the code object.
-            status = hsa_executable_load_code_object(hsaExecutable, agent, hsaCodeObject, NULL);
-            STATUS_CHECK(status, __LINE__);
-
-            // Freeze the executable.
-            status = hsa_executable_freeze(hsaExecutable, NULL);
-            STATUS_CHECK(status, __LINE__);
-
             // save everything as an HSAExecutable instance
             executables[index] = new HSAExecutable(hsaExecutable, hsaCodeObject);
         }
     }
 
-    HSAKernel* CreateKernelImpl(const char *hsailBuffer, int hsailSize, const char *entryName) {
+    HSAKernel* CreateKernelImpl(const ProgramBlob& blob, const char *entryName) {
         hsa_status_t status;
   
-        std::string index = MD5Sum((size_t)hsailSize, (void*)hsailBuffer);
+        const std::string& index = blob.id;
 
         // finalize HSA program if we haven't done so
         if (executables.find(index) == executables.end()) {
-            BuildProgramImpl(hsailBuffer, hsailSize);
+            BuildProgramImpl(blob);
         }
   
         // fetch HSAExecutable*
@@ -2685,3 +2816,9 @@ extern "C" void PushArgPtrImpl(void *ker, int idx, size_t sz, const void *v) {
   void *val = const_cast<void*>(v);
   dispatch->pushPointerArg(val);
 }
+
+extern "C" void PushArgsImpl(void *ker, int count, size_t sz, const void *v) {
+  HSADispatch *dispatch =
+      reinterpret_cast<HSADispatch*>(ker);
+  dispatch->pushArgs(v, sz, count);
+}
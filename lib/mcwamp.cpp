@@ -6,8 +6,12 @@
 //===----------------------------------------------------------------------===//
 
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
 #include <cassert>
+#include <condition_variable>
+#include <thread>
 #include <tuple>
 
 #include <amp.h>
@@ -44,6 +48,13 @@ extern "C" char * hsa_kernel_end[] asm ("_binary_kernel_brig_end") __attribute__
 extern "C" char * hsa_offline_finalized_kernel_source[] asm ("_binary_kernel_isa_start") __attribute__((weak));
 extern "C" char * hsa_offline_finalized_kernel_end[] asm ("_binary_kernel_isa_end") __attribute__((weak));
 
+// HSA kernel codes split per translation unit, and the index of the kernels
+// in each of them, see SplitProgram
+extern "C" char * hsa_split_kernel_source[] asm ("_binary_kernel_split_start") __attribute__((weak));
+extern "C" char * hsa_split_kernel_end[] asm ("_binary_kernel_split_end") __attribute__((weak));
+extern "C" char * hsa_split_index_source[] asm ("_binary_kernel_index_start") __attribute__((weak));
+extern "C" char * hsa_split_index_end[] asm ("_binary_kernel_index_end") __attribute__((weak));
+
 // interface of C++AMP runtime implementation
 struct RuntimeImpl {
   RuntimeImpl(const char* libraryName) :
@@ -51,6 +62,7 @@ struct RuntimeImpl {
     m_RuntimeHandle(nullptr),
     m_PushArgImpl(nullptr),
     m_PushArgPtrImpl(nullptr),
+    m_PushArgsImpl(nullptr),
     m_GetContextImpl(nullptr),
     isCPU(false) {
     //std::cout << "dlopen(" << libraryName << ")\n";
@@ -72,6 +84,8 @@ struct RuntimeImpl {
   void LoadSymbols() {
     m_PushArgImpl = (PushArgImpl_t) dlsym(m_RuntimeHandle, "PushArgImpl");
     m_PushArgPtrImpl = (PushArgPtrImpl_t) dlsym(m_RuntimeHandle, "PushArgPtrImpl");
+    // optional, runtimes without it get the arguments one at a time
+    m_PushArgsImpl = (PushArgsImpl_t) dlsym(m_RuntimeHandle, "PushArgsImpl");
     m_GetContextImpl= (GetContextImpl_t) dlsym(m_RuntimeHandle, "GetContextImpl");
   }
 
@@ -82,6 +96,7 @@ struct RuntimeImpl {
   void* m_RuntimeHandle;
   PushArgImpl_t m_PushArgImpl;
   PushArgPtrImpl_t m_PushArgPtrImpl;
+  PushArgsImpl_t m_PushArgsImpl;
   GetContextImpl_t m_GetContextImpl;
   bool isCPU;
 };
@@ -184,7 +199,8 @@ public:
  */
 class HSAPlatformDetect : public PlatformDetect {
 public:
-  HSAPlatformDetect() : PlatformDetect("HSA", "libmcwamp_hsa.so", "libhsa-runtime64.so", hsa_kernel_source) {}
+  HSAPlatformDetect() : PlatformDetect("HSA", "libmcwamp_hsa.so", "libhsa-runtime64.so",
+                                       hsa_kernel_source ? (void*)hsa_kernel_source : (void*)hsa_split_kernel_source) {}
 };
 
 
@@ -297,12 +313,149 @@ bool is_cpu()
     return GetOrInitRuntime()->is_cpu();
 }
 
-static bool in_kernel = false;
-bool in_cpu_kernel() { return in_kernel; }
-void enter_kernel() { in_kernel = true; }
-void leave_kernel() { in_kernel = false; }
+// kernels on CPU path may run on a background thread while the host keeps
+// going, so whether the current thread executes a kernel is per thread
+__thread bool in_kernel = false;
+
+// tiled kernels on CPU path switch work-items at barriers with user-space
+// fibers where available, HCC_CPU_TILE_ENGINE=UCONTEXT selects ucontext
+static bool DetermineCPUTileFiber() {
+#if defined(__x86_64__)
+  bool fiber = true;
+#else
+  bool fiber = false;
+#endif
+  char* engine_env = getenv("HCC_CPU_TILE_ENGINE");
+  if (engine_env != nullptr) {
+    if (std::string("UCONTEXT") == engine_env) {
+      fiber = false;
+    } else if (std::string("FIBER") == engine_env) {
+#if !defined(__x86_64__)
+      std::cerr << "Ignore unsupported HCC_CPU_TILE_ENGINE environment variable: " << engine_env << std::endl;
+#endif
+    } else {
+      std::cerr << "Ignore unknown HCC_CPU_TILE_ENGINE environment variable: " << engine_env << std::endl;
+    }
+  }
+  return fiber;
+}
+
+bool use_cpu_tile_fiber() {
+  static const bool fiber = DetermineCPUTileFiber();
+  return fiber;
+}
+
+// stack size of a work-item in a tile on CPU path, in bytes
+// HCC_CPU_TILE_STACK_SIZE overrides the default for kernels with deep calls
+// or large locals
+static size_t DetermineCPUTileStackSize() {
+  const size_t min_size = 4096;
+  size_t size = 1024 * 10;
+  char* size_env = getenv("HCC_CPU_TILE_STACK_SIZE");
+  if (size_env != nullptr) {
+    char* end = nullptr;
+    unsigned long long value = strtoull(size_env, &end, 10);
+    if (end != size_env && *end == '\0' && value >= min_size) {
+      size = value;
+    } else {
+      std::cerr << "Ignore invalid HCC_CPU_TILE_STACK_SIZE environment variable: " << size_env << std::endl;
+    }
+  }
+  // keep every stack 16-byte aligned
+  return (size + 15) & ~size_t(15);
+}
 
-void DetermineAndGetProgram(KalmarQueue* pQueue, size_t* kernel_size, void** kernel_source, bool* needs_compilation) {
+// flat kernels on CPU path execute rows of work-items in loops only
+// vectorized when proven safe, HCC_CPU_SIMD=ON executes them as SIMD lanes
+// without proof, asserting that no flat kernel of the program has aliasing
+// work-items
+static bool DetermineCPUSimd() {
+  bool simd = false;
+  char* simd_env = getenv("HCC_CPU_SIMD");
+  if (simd_env != nullptr) {
+    if (std::string("ON") == simd_env) {
+      simd = true;
+    } else if (std::string("OFF") != simd_env) {
+      std::cerr << "Ignore unknown HCC_CPU_SIMD environment variable: " << simd_env << std::endl;
+    }
+  }
+  return simd;
+}
+
+bool use_cpu_simd() {
+  static const bool simd = DetermineCPUSimd();
+  return simd;
+}
+
+size_t get_cpu_tile_stack_size() {
+  static const size_t size = DetermineCPUTileStackSize();
+  return size;
+}
+
+// BRIG modules lowered from each translation unit with kernels, embedded by
+// clamp-link next to a text index with one line per module:
+//   <offset> <size> <symbol>...
+// where the symbols are the kernels defined by the module. Only the modules of
+// the kernels launched are finalized, on their first launch.
+class SplitProgram {
+  struct Module {
+    size_t offset;
+    size_t size;
+  };
+  std::vector<Module> modules;
+  /// transformed kernel name to index in modules
+  std::map<std::string, size_t> kernels;
+
+  SplitProgram() : modules(), kernels() {
+    if (!hsa_split_kernel_source || !hsa_split_index_source)
+      return;
+    const size_t total = (ptrdiff_t)((void *)hsa_split_kernel_end) -
+                         (ptrdiff_t)((void *)hsa_split_kernel_source);
+    std::istringstream index(std::string((const char*)hsa_split_index_source,
+                                         (const char*)hsa_split_index_end));
+    std::string line;
+    while (std::getline(index, line)) {
+      std::istringstream entry(line);
+      Module m;
+      if (!(entry >> m.offset >> m.size) || m.offset + m.size > total)
+        continue;
+      std::string symbol;
+      while (entry >> symbol)
+        kernels[mcw_cxxamp_fixnames(&symbol[0])] = modules.size();
+      modules.push_back(m);
+    }
+  }
+
+public:
+  static const SplitProgram& getInstance() {
+    static SplitProgram program;
+    return program;
+  }
+
+  size_t size() const { return modules.size(); }
+
+  void get(size_t i, size_t* kernel_size, void** kernel_source) const {
+    *kernel_size = modules[i].size;
+    *kernel_source = (char*)hsa_split_kernel_source + modules[i].offset;
+  }
+
+  /// the module defining kernel @name, if any
+  bool find(const char* name, size_t* kernel_size, void** kernel_source) const {
+    auto it = kernels.find(name);
+    if (it == kernels.end())
+      return false;
+    get(it->second, kernel_size, kernel_source);
+    return true;
+  }
+};
+
+// @name selects the module of a kernel when the program was split per
+// translation unit, the whole program is returned otherwise
+void DetermineAndGetProgram(KalmarQueue* pQueue, size_t* kernel_size, void** kernel_source, bool* needs_compilation,
+                            const char* name = nullptr) {
+  // the first lookup may race with the build started by HCC_PREWARM
+  static std::mutex lock;
+  std::lock_guard<std::mutex> lck(lock);
   static bool firstTime = true;
   static bool hasSPIR = false;
   static bool hasFinalized = false;
@@ -385,6 +538,12 @@ void DetermineAndGetProgram(KalmarQueue* pQueue, size_t* kernel_size, void** ker
         (ptrdiff_t)((void *)hsa_kernel_source);
       *kernel_source = hsa_kernel_source;
       *needs_compilation = true;
+      const SplitProgram& split = SplitProgram::getInstance();
+      // a program linked split embeds no whole program to fall back to
+      if (name != nullptr && !split.find(name, kernel_size, kernel_source) && split.size() > 0) {
+        std::cerr << "kernel " << name << " not found in split program" << std::endl;
+        exit(-1);
+      }
     }
   }
 }
@@ -395,6 +554,16 @@ void BuildProgram(KalmarQueue* pQueue) {
   bool needs_compilation = true;
 
   DetermineAndGetProgram(pQueue, &kernel_size, &kernel_source, &needs_compilation);
+
+  // a program split per translation unit is built module by module
+  const SplitProgram& split = SplitProgram::getInstance();
+  if (kernel_source == hsa_kernel_source && split.size() > 0) {
+    for (size_t i = 0; i < split.size(); ++i) {
+      split.get(i, &kernel_size, &kernel_source);
+      pQueue->getDev()->BuildProgram((void*)kernel_size, kernel_source, needs_compilation);
+    }
+    return;
+  }
   pQueue->getDev()->BuildProgram((void*)kernel_size, kernel_source, needs_compilation);
 }
 
@@ -404,17 +573,193 @@ void *CreateKernel(std::string s, KalmarQueue* pQueue) {
   void* kernel_source = nullptr;
   bool needs_compilation = true;
 
-  DetermineAndGetProgram(pQueue, &kernel_size, &kernel_source, &needs_compilation);
+  DetermineAndGetProgram(pQueue, &kernel_size, &kernel_source, &needs_compilation, s.c_str());
 
   return pQueue->getDev()->CreateKernel(s.c_str(), (void *)kernel_size, kernel_source, needs_compilation);
 }
 
+// used in kalmar_launch.h, resolved once per kernel and device
+void *GetKernelHandle(const char* s, KalmarQueue* pQueue) {
+  size_t kernel_size = 0;
+  void* kernel_source = nullptr;
+  bool needs_compilation = true;
+
+  DetermineAndGetProgram(pQueue, &kernel_size, &kernel_source, &needs_compilation, s);
+
+  return pQueue->getDev()->GetKernelHandle(s, (void *)kernel_size, kernel_source, needs_compilation);
+}
+
 void PushArg(void *k_, int idx, size_t sz, const void *s) {
   GetOrInitRuntime()->m_PushArgImpl(k_, idx, sz, s);
 }
 void PushArgPtr(void *k_, int idx, size_t sz, const void *s) {
   GetOrInitRuntime()->m_PushArgPtrImpl(k_, idx, sz, s);
 }
+bool HasPushArgs() {
+  return GetOrInitRuntime()->m_PushArgsImpl != nullptr;
+}
+void PushArgs(void *k_, int count, size_t sz, const void *s) {
+  GetOrInitRuntime()->m_PushArgsImpl(k_, count, sz, s);
+}
+
+// number of threads running the callbacks of completion_future::then,
+// HCC_CONTINUATION_THREADS overrides the default
+static size_t DetermineContinuationThreads() {
+  size_t count = 2;
+  char* count_env = getenv("HCC_CONTINUATION_THREADS");
+  if (count_env != nullptr) {
+    char* end = nullptr;
+    unsigned long long value = strtoull(count_env, &end, 10);
+    if (end != count_env && *end == '\0' && value > 0) {
+      count = value;
+    } else {
+      std::cerr << "Ignore invalid HCC_CONTINUATION_THREADS environment variable: " << count_env << std::endl;
+    }
+  }
+  return count;
+}
+
+// runs the callbacks of completion_future::then on a few threads once their
+// futures are ready
+// Operations which notify their completion hand their callbacks over right
+// away. The futures of the others are polled by one watcher thread, backing
+// off while none of them gets ready. Threads start on the first callback. The
+// callbacks still pending at exit get a short time to run, the others are
+// dropped, so an operation which never completes does not hang the process.
+class ContinuationExecutor {
+  struct Watched {
+    std::shared_future<void> future;
+    std::function<void()> f;
+  };
+
+  std::mutex mutex;
+  std::condition_variable ready_cv;
+  std::condition_variable watch_cv;
+  std::condition_variable idle_cv;
+  std::deque<std::function<void()>> ready;
+  std::vector<Watched> watched;
+  // callbacks scheduled and not run yet
+  size_t pending;
+  bool stop;
+  std::vector<std::thread> threads;
+
+  void start() {
+    if (!threads.empty())
+      return;
+    size_t count = DetermineContinuationThreads();
+    for (size_t i = 0; i < count; ++i)
+      threads.emplace_back(&ContinuationExecutor::work, this);
+    threads.emplace_back(&ContinuationExecutor::watch, this);
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lck(mutex);
+    while (true) {
+      ready_cv.wait(lck, [this] { return stop || !ready.empty(); });
+      if (ready.empty())
+        return;
+      std::function<void()> f = std::move(ready.front());
+      ready.pop_front();
+      lck.unlock();
+      f();
+      f = nullptr;
+      lck.lock();
+      if (--pending == 0)
+        idle_cv.notify_all();
+    }
+  }
+
+  void watch() {
+    const auto min_delay = std::chrono::microseconds(50);
+    const auto max_delay = std::chrono::microseconds(1000);
+    auto delay = min_delay;
+    std::unique_lock<std::mutex> lck(mutex);
+    while (true) {
+      if (watched.empty()) {
+        watch_cv.wait(lck, [this] { return stop || !watched.empty(); });
+        if (watched.empty())
+          return;
+        delay = min_delay;
+      }
+      auto still = std::partition(std::begin(watched), std::end(watched), [](const Watched& w) {
+        return w.future.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+      });
+      if (still != std::end(watched)) {
+        for (auto it = still; it != std::end(watched); ++it)
+          ready.push_back(std::move(it->f));
+        watched.erase(still, std::end(watched));
+        ready_cv.notify_all();
+        delay = min_delay;
+      } else {
+        delay = std::min<std::chrono::microseconds>(delay * 2, max_delay);
+      }
+      watch_cv.wait_for(lck, delay);
+    }
+  }
+
+  void post(std::function<void()> f) {
+    std::lock_guard<std::mutex> lck(mutex);
+    ready.push_back(std::move(f));
+    ready_cv.notify_one();
+  }
+
+public:
+  ContinuationExecutor() : pending(0), stop(false) {}
+
+  // called at exit, the threads are detached rather than joined since a
+  // callback may not return, so the executor itself is never destroyed
+  void shutdown() {
+    std::unique_lock<std::mutex> lck(mutex);
+    idle_cv.wait_for(lck, std::chrono::seconds(1), [this] { return pending == 0; });
+    stop = true;
+    // destroyed once unlocked, they may hold the last reference to a queue
+    std::deque<std::function<void()>> dropped;
+    std::vector<Watched> dropped_watched;
+    dropped.swap(ready);
+    dropped_watched.swap(watched);
+    ready_cv.notify_all();
+    watch_cv.notify_all();
+    lck.unlock();
+    for (auto& t : threads)
+      t.detach();
+  }
+
+  void schedule(const std::shared_future<void>& future, const std::shared_ptr<KalmarAsyncOp>& op,
+                std::function<void()> f) {
+    {
+      std::lock_guard<std::mutex> lck(mutex);
+      start();
+      ++pending;
+    }
+    const std::future_status status = future.wait_for(std::chrono::seconds(0));
+    if (status == std::future_status::ready) {
+      post(std::move(f));
+      return;
+    }
+    // shared, so that it is still at hand if the operation can't notify
+    auto shared = std::make_shared<std::function<void()>>(std::move(f));
+    if (op && op->notify([this, shared] { post(std::move(*shared)); }))
+      return;
+    if (status == std::future_status::deferred) {
+      // only gets ready once waited for
+      post([future, shared] { future.wait(); (*shared)(); });
+      return;
+    }
+    std::lock_guard<std::mutex> lck(mutex);
+    watched.push_back(Watched{future, std::move(*shared)});
+    watch_cv.notify_one();
+  }
+};
+
+void ScheduleContinuation(const std::shared_future<void>& future,
+                          const std::shared_ptr<KalmarAsyncOp>& op,
+                          std::function<void()> f) {
+  static ContinuationExecutor* executor = new ContinuationExecutor;
+  static struct Shutdown {
+    ~Shutdown() { executor->shutdown(); }
+  } shutdown;
+  executor->schedule(future, op, std::move(f));
+}
 
 } // namespace CLAMP
 
@@ -422,12 +767,28 @@ KalmarContext *getContext() {
   return static_cast<KalmarContext*>(CLAMP::GetOrInitRuntime()->m_GetContextImpl());
 }
 
+// kernels are finalized on their first launch, HCC_PREWARM=ON also builds
+// all of them on a background thread as soon as the runtime is loaded
+static bool DeterminePrewarm() {
+  bool prewarm = false;
+  char* prewarm_env = getenv("HCC_PREWARM");
+  if (prewarm_env != nullptr) {
+    if (std::string("ON") == prewarm_env) {
+      prewarm = true;
+    } else if (std::string("OFF") != prewarm_env) {
+      std::cerr << "Ignore unknown HCC_PREWARM environment variable: " << prewarm_env << std::endl;
+    }
+  }
+  return prewarm;
+}
+
 // Kalmar runtime bootstrap logic
 class KalmarBootstrap {
 private:
   RuntimeImpl* runtime;
+  std::thread prewarm;
 public:
-  KalmarBootstrap() : runtime(nullptr) {
+  KalmarBootstrap() : runtime(nullptr), prewarm() {
     bool to_init = true;
     char* lazyinit_env = getenv("HCC_LAZYINIT");
     if (lazyinit_env != nullptr) {
@@ -446,10 +807,20 @@ public:
       // get default queue on the default device
       std::shared_ptr<KalmarQueue> queue = context->auto_select();
   
-      // build kernels on the default queue on the default device
-      CLAMP::BuildProgram(queue.get());
+      // build kernels on the default queue on the default device, once even
+      // if both the executable and a shared library bootstrap
+      static std::once_flag started;
+      std::call_once(started, [&] {
+        if (DeterminePrewarm())
+          prewarm = std::thread([queue] { CLAMP::BuildProgram(queue.get()); });
+      });
     }
   }
+
+  ~KalmarBootstrap() {
+    if (prewarm.joinable())
+      prewarm.join();
+  }
 };
 
 // this would initialize Kalmar runtime before main() in user program begins
@@ -464,3 +835,44 @@ extern "C" void __attribute__((constructor)) __hcc_shared_library_init() {
 
 extern "C" void __attribute__((destructor)) __hcc_shared_library_fini() {
 }
+
+#if defined(__x86_64__)
+// context switch of Kalmar::CPUFiber, used by tiled kernels on CPU path
+// only callee-saved registers and the SSE/x87 control words are preserved,
+// everything else is clobbered by the call anyway
+asm(
+  "  .text\n"
+  "  .globl kalmar_fiber_switch\n"
+  "  .type kalmar_fiber_switch, @function\n"
+  "kalmar_fiber_switch:\n"
+  "  pushq %rbp\n"
+  "  pushq %rbx\n"
+  "  pushq %r12\n"
+  "  pushq %r13\n"
+  "  pushq %r14\n"
+  "  pushq %r15\n"
+  "  subq $8, %rsp\n"
+  "  stmxcsr (%rsp)\n"
+  "  fnstcw 4(%rsp)\n"
+  "  movq %rsp, (%rdi)\n"
+  "  movq %rsi, %rsp\n"
+  "  ldmxcsr (%rsp)\n"
+  "  fldcw 4(%rsp)\n"
+  "  addq $8, %rsp\n"
+  "  popq %r15\n"
+  "  popq %r14\n"
+  "  popq %r13\n"
+  "  popq %r12\n"
+  "  popq %rbx\n"
+  "  popq %rbp\n"
+  "  ret\n"
+  "  .size kalmar_fiber_switch, .-kalmar_fiber_switch\n"
+  "  .globl kalmar_fiber_entry\n"
+  "  .type kalmar_fiber_entry, @function\n"
+  "kalmar_fiber_entry:\n"
+  "  movq %r12, %rdi\n"
+  "  callq *%r13\n"
+  "  ud2\n"
+  "  .size kalmar_fiber_entry, .-kalmar_fiber_entry\n"
+);
+#endif
@@ -1,183 +1,215 @@
-#include <mutex>
-#include <algorithm>
+#include <cstdint>
+#include <cstring>
 
-// FIXME : need to consider how to let hc namespace could also use functions here
-namespace Concurrency {
+// Atomic functions used by kernels running on the CPU path.
+//
+// All operations map to hardware atomics on the target address, so kernel
+// threads only contend with each other when they touch the same location.
+// Operations without a native fetch-and-op instruction (floating point
+// arithmetic, min and max) are implemented as compare-and-swap loops.
 
-std::mutex afx_u, afx_i, afx_f;
-unsigned int atomic_exchange_unsigned(unsigned int *x, unsigned int y) {
-    std::lock_guard<std::mutex> guard(afx_u);
-    unsigned int old = *x;
-    *x = y;
-    return old;
-}
-int atomic_exchange_int(int *x, int y) {
-    std::lock_guard<std::mutex> guard(afx_i);
-    int old = *x;
-    *x = y;
-    return old;
-}
-float atomic_exchange_float(float* x, float y) {
-    std::lock_guard<std::mutex> guard(afx_f);
-    int old = *x;
-    *x = y;
-    return old;
-}
+namespace {
 
-std::mutex afcas_u, afcas_i;
-unsigned int atomic_compare_exchange_unsigned(unsigned int *x, unsigned int y, unsigned int z) {
-    std::lock_guard<std::mutex> guard(afcas_u);
-    unsigned int old = *x;
-    if (*x == y) {
-        *x = z;
-    }
-    return old;
-}
-int atomic_compare_exchange_int(int *x, int y, int z) {
-    std::lock_guard<std::mutex> guard(afcas_i);
-    int old = *x;
-    if (*x == y) {
-        *x = z;
-    }
-    return old;
+template <typename T>
+inline T atomic_exchange_impl(T *p, T val) {
+    return __atomic_exchange_n(p, val, __ATOMIC_SEQ_CST);
 }
 
-std::mutex afa_u, afa_i, afa_f;
-unsigned int atomic_add_unsigned(unsigned int *x, unsigned int y) {
-    std::lock_guard<std::mutex> guard(afa_u);
-    unsigned int old = *x;
-    *x += y;
-    return old;
-}
-int atomic_add_int(int *x, int y) {
-    std::lock_guard<std::mutex> guard(afa_i);
-    int old = *x;
-    *x += y;
-    return old;
-}
-float atomic_add_float(float* x, float y) {
-    std::lock_guard<std::mutex> guard(afa_f);
-    float old = *x;
-    *x += y;
-    return old;
+template <typename T>
+inline T atomic_compare_exchange_impl(T *p, T expected_val, T val) {
+    __atomic_compare_exchange_n(p, &expected_val, val, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    // on failure expected_val is updated with the current value
+    return expected_val;
 }
 
-std::mutex afs_u, afs_i, afs_f;
-unsigned int atomic_sub_unsigned(unsigned int *x, unsigned int y) {
-    std::lock_guard<std::mutex> guard(afa_u);
-    unsigned int old = *x;
-    *x -= y;
-    return old;
-}
-int atomic_sub_int(int *x, int y) {
-    std::lock_guard<std::mutex> guard(afa_i);
-    int old = *x;
-    *x -= y;
-    return old;
-}
-float atomic_sub_float(float* x, float y) {
-    std::lock_guard<std::mutex> guard(afa_f);
-    float old = *x;
-    *x -= y;
+template <typename T>
+inline T atomic_max_impl(T *p, T val) {
+    T old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (old < val &&
+           !__atomic_compare_exchange_n(p, &old, val, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
     return old;
 }
 
-std::mutex afand_u, afand_i;
-unsigned int atomic_and_unsigned(unsigned int *x, unsigned int y) {
-    std::lock_guard<std::mutex> guard(afand_u);
-    unsigned int old = *x;
-    *x &= y;
-    return old;
-}
-int atomic_and_int(int *x, int y) {
-    std::lock_guard<std::mutex> guard(afand_i);
-    int old = *x;
-    *x &= y;
+template <typename T>
+inline T atomic_min_impl(T *p, T val) {
+    T old = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (val < old &&
+           !__atomic_compare_exchange_n(p, &old, val, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
     return old;
 }
 
-std::mutex afor_u, afor_i;
-unsigned int atomic_or_unsigned(unsigned int *x, unsigned int y) {
-    std::lock_guard<std::mutex> guard(afor_u);
-    unsigned int old = *x;
-    *x |= y;
-    return old;
+// floating point values are operated on through their bit pattern, since
+// CAS compares representations rather than values
+static_assert(sizeof(float) == sizeof(uint32_t), "unexpected float size");
+
+inline uint32_t float_as_bits(float f) {
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
 }
-int atomic_or_int(int *x, int y) {
-    std::lock_guard<std::mutex> guard(afor_i);
-    int old = *x;
-    *x |= y;
-    return old;
+
+inline float bits_as_float(uint32_t u) {
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
 }
 
-std::mutex afxor_u, afxor_i;
-unsigned int atomic_xor_unsigned(unsigned int *x, unsigned int y) {
-    std::lock_guard<std::mutex> guard(afxor_u);
-    unsigned int old = *x;
-    *x ^= y;
-    return old;
+inline float atomic_exchange_float_impl(float *p, float val) {
+    uint32_t *q = reinterpret_cast<uint32_t *>(p);
+    return bits_as_float(__atomic_exchange_n(q, float_as_bits(val), __ATOMIC_SEQ_CST));
 }
-int atomic_xor_int(int *x, int y) {
-    std::lock_guard<std::mutex> guard(afxor_i);
-    int old = *x;
-    *x ^= y;
-    return old;
+
+template <typename Op>
+inline float atomic_update_float_impl(float *p, float val, Op op) {
+    uint32_t *q = reinterpret_cast<uint32_t *>(p);
+    uint32_t old = __atomic_load_n(q, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(q, &old, float_as_bits(op(bits_as_float(old), val)),
+                                        true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return bits_as_float(old);
 }
 
-std::mutex afmax_u, afmax_i;
-unsigned int atomic_max_unsigned(unsigned int *p, unsigned int val) {
-    std::lock_guard<std::mutex> guard(afmax_u);
-    unsigned int old = *p;
-    *p = std::max(*p, val);
-    return old;
+struct float_add { float operator()(float a, float b) const { return a + b; } };
+struct float_sub { float operator()(float a, float b) const { return a - b; } };
+
+} // anonymous namespace
+
+// The same set of functions is declared by both amp.h and hc.hpp for the CPU
+// path, each in its own namespace.  Define them once and emit them into both.
+#define DEFINE_CPU_ATOMICS                                                                      \
+unsigned int atomic_exchange_unsigned(unsigned int *p, unsigned int val) {                      \
+    return atomic_exchange_impl(p, val);                                                        \
+}                                                                                               \
+int atomic_exchange_int(int *p, int val) {                                                      \
+    return atomic_exchange_impl(p, val);                                                        \
+}                                                                                               \
+float atomic_exchange_float(float *p, float val) {                                              \
+    return atomic_exchange_float_impl(p, val);                                                  \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_compare_exchange_unsigned(unsigned int *p, unsigned int expected_val,        \
+                                              unsigned int val) {                               \
+    return atomic_compare_exchange_impl(p, expected_val, val);                                  \
+}                                                                                               \
+int atomic_compare_exchange_int(int *p, int expected_val, int val) {                            \
+    return atomic_compare_exchange_impl(p, expected_val, val);                                  \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_add_unsigned(unsigned int *p, unsigned int val) {                           \
+    return __atomic_fetch_add(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+int atomic_add_int(int *p, int val) {                                                           \
+    return __atomic_fetch_add(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+float atomic_add_float(float *p, float val) {                                                   \
+    return atomic_update_float_impl(p, val, float_add());                                       \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_sub_unsigned(unsigned int *p, unsigned int val) {                           \
+    return __atomic_fetch_sub(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+int atomic_sub_int(int *p, int val) {                                                           \
+    return __atomic_fetch_sub(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+float atomic_sub_float(float *p, float val) {                                                   \
+    return atomic_update_float_impl(p, val, float_sub());                                       \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_and_unsigned(unsigned int *p, unsigned int val) {                           \
+    return __atomic_fetch_and(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+int atomic_and_int(int *p, int val) {                                                           \
+    return __atomic_fetch_and(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_or_unsigned(unsigned int *p, unsigned int val) {                            \
+    return __atomic_fetch_or(p, val, __ATOMIC_SEQ_CST);                                         \
+}                                                                                               \
+int atomic_or_int(int *p, int val) {                                                            \
+    return __atomic_fetch_or(p, val, __ATOMIC_SEQ_CST);                                         \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_xor_unsigned(unsigned int *p, unsigned int val) {                           \
+    return __atomic_fetch_xor(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+int atomic_xor_int(int *p, int val) {                                                           \
+    return __atomic_fetch_xor(p, val, __ATOMIC_SEQ_CST);                                        \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_max_unsigned(unsigned int *p, unsigned int val) {                           \
+    return atomic_max_impl(p, val);                                                             \
+}                                                                                               \
+int atomic_max_int(int *p, int val) {                                                           \
+    return atomic_max_impl(p, val);                                                             \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_min_unsigned(unsigned int *p, unsigned int val) {                           \
+    return atomic_min_impl(p, val);                                                             \
+}                                                                                               \
+int atomic_min_int(int *p, int val) {                                                           \
+    return atomic_min_impl(p, val);                                                             \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_inc_unsigned(unsigned int *p) {                                             \
+    return __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);                                          \
+}                                                                                               \
+int atomic_inc_int(int *p) {                                                                    \
+    return __atomic_fetch_add(p, 1, __ATOMIC_SEQ_CST);                                          \
+}                                                                                               \
+                                                                                                \
+unsigned int atomic_dec_unsigned(unsigned int *p) {                                             \
+    return __atomic_fetch_sub(p, 1, __ATOMIC_SEQ_CST);                                          \
+}                                                                                               \
+int atomic_dec_int(int *p) {                                                                    \
+    return __atomic_fetch_sub(p, 1, __ATOMIC_SEQ_CST);                                          \
 }
-int atomic_max_int(int *p, int val) {
-    std::lock_guard<std::mutex> guard(afmax_i);
-    int old = *p;
-    *p = std::max(*p, val);
-    return old;
+
+namespace Concurrency {
+
+DEFINE_CPU_ATOMICS
+
+} // namespace Concurrency
+
+namespace hc {
+
+DEFINE_CPU_ATOMICS
+
+// 64-bit variants are only exposed by hc.hpp
+
+uint64_t atomic_exchange_uint64(uint64_t *p, uint64_t val) {
+    return atomic_exchange_impl(p, val);
 }
 
-std::mutex afmin_u, afmin_i;
-unsigned int atomic_min_unsigned(unsigned int *p, unsigned int val) {
-    std::lock_guard<std::mutex> guard(afmin_u);
-    unsigned int old = *p;
-    *p = std::min(*p, val);
-    return old;
+uint64_t atomic_compare_exchange_uint64(uint64_t *p, uint64_t expected_val, uint64_t val) {
+    return atomic_compare_exchange_impl(p, expected_val, val);
 }
-int atomic_min_int(int *p, int val) {
-    std::lock_guard<std::mutex> guard(afmin_i);
-    int old = *p;
-    *p = std::min(*p, val);
-    return old;
+
+uint64_t atomic_add_uint64(uint64_t *p, uint64_t val) {
+    return __atomic_fetch_add(p, val, __ATOMIC_SEQ_CST);
 }
 
-std::mutex afi_u, afi_i;
-unsigned int atomic_inc_unsigned(unsigned int *p) {
-    std::lock_guard<std::mutex> guard(afi_u);
-    unsigned int old = *p;
-    *p += 1;
-    return old;
+uint64_t atomic_and_uint64(uint64_t *p, uint64_t val) {
+    return __atomic_fetch_and(p, val, __ATOMIC_SEQ_CST);
 }
-int atomic_inc_int(int *p) {
-    std::lock_guard<std::mutex> guard(afi_i);
-    int old = *p;
-    *p += 1;
-    return old;
+
+uint64_t atomic_or_uint64(uint64_t *p, uint64_t val) {
+    return __atomic_fetch_or(p, val, __ATOMIC_SEQ_CST);
 }
 
-std::mutex afd_u, afd_i;
-unsigned int atomic_dec_unsigned(unsigned int *p) {
-    std::lock_guard<std::mutex> guard(afd_u);
-    unsigned int old = *p;
-    *p -= 1;
-    return old;
+uint64_t atomic_xor_uint64(uint64_t *p, uint64_t val) {
+    return __atomic_fetch_xor(p, val, __ATOMIC_SEQ_CST);
 }
-int atomic_dec_int(int *p) {
-    std::lock_guard<std::mutex> guard(afd_i);
-    int old = *p;
-    *p -= 1;
-    return old;
+
+uint64_t atomic_max_uint64(uint64_t *p, uint64_t val) {
+    return atomic_max_impl(p, val);
 }
 
+uint64_t atomic_min_uint64(uint64_t *p, uint64_t val) {
+    return atomic_min_impl(p, val);
 }
+
+} // namespace hc
+
+#undef DEFINE_CPU_ATOMICS
@@ -0,0 +1,87 @@
+//===----------------------------------------------------------------------===//
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include <md5.h>
+
+namespace Kalmar {
+
+/// kernel program embedded in the executable, as handed to
+/// KalmarDevice::BuildProgram and KalmarDevice::CreateKernel
+///
+/// Embedded programs never move nor change, so the MD5 digest of each one is
+/// computed the first time it is looked up and kept for the lifetime of the
+/// process, keyed by its address. The bytes are used in place unless they
+/// are not aligned for the loaders of the runtime, in which case a single
+/// aligned copy is made at the same time.
+class ProgramBlob
+{
+    std::unique_ptr<char[]> copy;
+public:
+    /// alignment expected by the code object and BRIG loaders
+    static const size_t alignment = 16;
+
+    const char* data;
+    size_t size;
+    unsigned char digest[16];
+    /// hex string of digest, 32 digits
+    std::string id;
+
+    ProgramBlob(const void* source, size_t size)
+        : copy(), data(static_cast<const char*>(source)), size(size), digest(), id() {
+        if (reinterpret_cast<uintptr_t>(source) % alignment != 0) {
+            copy.reset(new char[size + alignment]);
+            char* aligned = copy.get() + (alignment - reinterpret_cast<uintptr_t>(copy.get()) % alignment) % alignment;
+            memcpy(aligned, source, size);
+            data = aligned;
+        }
+
+        MD5_CTX md5ctx;
+        MD5_Init(&md5ctx);
+        MD5_Update(&md5ctx, data, size);
+        MD5_Final(digest, &md5ctx);
+
+        // two hex digits per byte, so that different digests never give the
+        // same id, it also keys the on-disk code cache
+        std::stringstream checksum;
+        checksum << std::hex << std::setfill('0');
+        for (int i = 0; i < 16; ++i) {
+            checksum << std::setw(2) << static_cast<unsigned int>(digest[i]);
+        }
+        id = checksum.str();
+    }
+
+    /// the blob at @source of @size bytes
+    static const ProgramBlob& get(const void* source, size_t size) {
+        static std::mutex lock;
+        static std::map<std::pair<const void*, size_t>, std::unique_ptr<ProgramBlob>> blobs;
+        std::lock_guard<std::mutex> lck(lock);
+        std::unique_ptr<ProgramBlob>& blob = blobs[std::make_pair(source, size)];
+        if (!blob)
+            blob.reset(new ProgramBlob(source, size));
+        return *blob;
+    }
+
+    /// overload taking the arguments of KalmarDevice::BuildProgram
+    static const ProgramBlob& get(void* size, void* source) {
+        return get(source, reinterpret_cast<size_t>(size));
+    }
+};
+
+} // namespace Kalmar
@@ -21,6 +21,9 @@
 #include <md5.h>
 #include <kalmar_runtime.h>
 #include <kalmar_aligned_alloc.h>
+#include <kalmar_code_cache.h>
+
+#include "../mcwamp_program.hpp"
 
 extern "C" void PushArgImpl(void *k_, int idx, size_t sz, const void *s);
 extern "C" void PushArgPtrImpl(void *k_, int idx, size_t sz, const void *s);
@@ -369,16 +372,26 @@ public:
     bool is_emulated() const override { return false; }
 
     void BuildProgram(void* size, void* source, bool needsCompilation = true) override {
+        std::lock_guard<std::mutex> l(programs_mutex);
         if (programs.find(source) == std::end(programs))
             programs[source] = Kalmar::CLAMP::CLCompileKernels(device, size, source);
     }
 
     void* CreateKernel(const char* fun, void* size, void* source, bool needsCompilation = true) override {
-        cl_int err;
+        return CreateKernelFromHandle(fun, GetKernelHandle(fun, size, source, needsCompilation));
+    }
+
+    void* GetKernelHandle(const char* fun, void* size, void* source, bool needsCompilation = true) override {
+        std::lock_guard<std::mutex> l(programs_mutex);
         if (programs.find(source) == std::end(programs))
             programs[source] = Kalmar::CLAMP::CLCompileKernels(device, size, source);
-        cl_program program = programs[source];
-        cl_kernel kernel = clCreateKernel(program, fun, &err);
+        return programs[source];
+    }
+
+    /// cl_kernel objects hold their arguments, so one is created per launch
+    void* CreateKernelFromHandle(const char* fun, void* handle) override {
+        cl_int err;
+        cl_kernel kernel = clCreateKernel(static_cast<cl_program>(handle), fun, &err);
         assert(err == CL_SUCCESS);
         return kernel;
     }
@@ -433,6 +446,8 @@ private:
     /// important map, more than one kernel will be created on this device
     /// cache each program for them
     std::map<void*, cl_program> programs;
+    /// guards programs, see HCC_PREWARM
+    std::mutex programs_mutex;
     struct DimMaxSize d;
     cl_device_id     device;
     std::wstring path;
@@ -530,58 +545,37 @@ cl_program CLCompileKernels(cl_device_id& device, void* kernel_size_, void* kern
     err = clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
     assert(err == CL_SUCCESS);
 
-    // calculate MD5 checksum
-    unsigned char md5_hash[16];
-    memset(md5_hash, 0, sizeof(unsigned char) * 16);
-    MD5_CTX md5ctx;
-    MD5_Init(&md5ctx);
-    MD5_Update(&md5ctx, source, size);
-    // hash device name, prevent storing the same kernel for different device
-    MD5_Update(&md5ctx, name, strlen(name));
-    MD5_Final(md5_hash, &md5ctx);
-
-    // compute compiled kernel file name
-    std::stringstream compiled_kernel_name;
-    compiled_kernel_name << "/tmp/";
-    compiled_kernel_name << std::setbase(16);
-    for (int i = 0; i < 16; ++i) {
-        compiled_kernel_name << static_cast<unsigned int>(md5_hash[i]);
-    }
-    compiled_kernel_name << ".bin";
-
-    //std::cout << "Try load precompiled kernel: " << compiled_kernel_name.str() << std::endl;
-
-    // check if pre-compiled kernel binary exist
-    std::ifstream precompiled_kernel(compiled_kernel_name.str(), std::ifstream::binary);
-    if (precompiled_kernel) {
+    // binaries are only reused with the driver which built them
+    size_t driver_len = 0;
+    err = clGetDeviceInfo(device, CL_DRIVER_VERSION, 0, NULL, &driver_len);
+    assert(err == CL_SUCCESS);
+    std::vector<char> driver(driver_len + 1, '\0');
+    err = clGetDeviceInfo(device, CL_DRIVER_VERSION, driver_len, driver.data(), NULL);
+    assert(err == CL_SUCCESS);
+    const std::string target = std::string(name) + " " + driver.data();
+
+    // look up the binary compiled for this device by an earlier process
+    const ProgramBlob& blob = ProgramBlob::get(kernel_size_, kernel_source_);
+    KalmarCodeCache& cache = KalmarCodeCache::getInstance();
+    const std::string cache_options = build_options;
+    std::vector<char> precompiled_kernel;
+    bool cached = false;
+    if (cache.load(blob.id, target, cache_options, precompiled_kernel)) {
         // use pre-compiled kernel binary
-        precompiled_kernel.seekg(0, std::ios_base::end);
-        size_t len = precompiled_kernel.tellg();
-        precompiled_kernel.seekg(0, std::ios_base::beg);
-        //std::cout << "Length of precompiled kernel: " << len << std::endl;
-        unsigned char* compiled_kernel = new unsigned char[len];
-        precompiled_kernel.read(reinterpret_cast<char*>(compiled_kernel), len);
-        precompiled_kernel.close();
-
-        const unsigned char *ks = (const unsigned char *)compiled_kernel;
+        size_t len = precompiled_kernel.size();
+        const unsigned char *ks = (const unsigned char *)precompiled_kernel.data();
         program = clCreateProgramWithBinary(Kalmar::context, 1, &device, &len, &ks, NULL, &err);
         if (err == CL_SUCCESS)
             err = clBuildProgram(program, 1, &device, build_options.c_str(), NULL, NULL);
-        if (err != CL_SUCCESS) {
-            size_t len;
-            err = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len);
-            assert(err == CL_SUCCESS);
-            char *msg = new char[len + 1];
-            err = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, len, msg, NULL);
-            assert(err == CL_SUCCESS);
-            msg[len] = '\0';
-            std::cerr << msg;
-            delete [] msg;
-            exit(1);
+        cached = err == CL_SUCCESS;
+        // rejected by the driver, compiled again and replaced below
+        if (!cached && program) {
+            clReleaseProgram(program);
+            program = nullptr;
         }
-        delete [] compiled_kernel;
-    } else {
-        // pre-compiled kernel binary doesn't exist
+    }
+    if (!cached) {
+        // pre-compiled kernel binary doesn't exist or can't be used
         // call CL compiler
 
         if (source[0] == 'B' && source[1] == 'C') {
@@ -640,11 +634,7 @@ cl_program CLCompileKernels(cl_device_id& device, void* kernel_size_, void* kern
         assert(err == CL_SUCCESS);
 
         // save compiled kernel binary
-        std::ofstream compiled_kernel(compiled_kernel_name.str(), std::ostream::binary);
-        compiled_kernel.write(reinterpret_cast<const char*>(pgBinaries[0]), pgBinarySizes[0]);
-        compiled_kernel.close();
-
-        //std::cout << "Kernel written to: " << compiled_kernel_name.str() << std::endl;
+        cache.store(blob.id, target, cache_options, pgBinaries[0], pgBinarySizes[0]);
 
         // release memory
         for (cl_uint i = 0; i < nDevices; ++i) {
@@ -654,7 +644,7 @@ cl_program CLCompileKernels(cl_device_id& device, void* kernel_size_, void* kern
         delete [] pgBinarySizes;
         delete [] devices;
 
-    } // if (precompiled_kernel)
+    } // if (!cached)
     return program;
 }
 
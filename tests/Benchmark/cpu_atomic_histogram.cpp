@@ -0,0 +1,59 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// benchmark contention of CPU atomics with histogram-style kernels
+// when atomics were serialized on a process-wide lock the timing did not
+// depend on the number of bins; with hardware atomics only updates to the
+// same bin contend, so timings should drop as the number of bins grows
+
+#define REPEAT (5)
+
+template <typename Launch>
+double measure(Launch launch) {
+  launch(); // warm up
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < REPEAT; ++i)
+    launch();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / REPEAT;
+}
+
+template <typename T>
+bool run_histogram(const char* name, int vecSize, int nbins) {
+  std::vector<T> bins(nbins, T(0));
+  hc::array_view<T, 1> av(nbins, bins);
+
+  double elapsed = measure([&]() {
+    hc::parallel_for_each(hc::extent<1>(vecSize), [=](hc::index<1> idx) [[hc]] {
+      // scatter consecutive work-items across the bins
+      unsigned int key = (unsigned int)idx[0] * 2654435761u;
+      hc::atomic_fetch_add(&av[key % nbins], T(1));
+    });
+  });
+  av.synchronize();
+
+  std::cout << "  " << name << " " << nbins << " bins: " << elapsed << " ms\n";
+
+  T total = T(0);
+  for (int b = 0; b < nbins; ++b)
+    total += bins[b];
+  return total == T(vecSize) * T(REPEAT + 1);
+}
+
+int main() {
+  bool ret = true;
+  const int vecSize = 1 << 20;
+
+  std::cout << "histogram of " << vecSize << " items\n";
+  for (int nbins = 1; nbins <= 4096; nbins *= 16) {
+    ret &= run_histogram<int>("int  ", vecSize, nbins);
+    ret &= run_histogram<float>("float", vecSize, nbins);
+  }
+
+  return !(ret == true);
+}
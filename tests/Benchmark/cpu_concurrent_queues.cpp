@@ -0,0 +1,104 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// stress CPU kernels launched by several host threads at once, each thread
+// on its own accelerator_view as a server handling one request per thread
+// would, and report how the throughput scales with the number of threads
+
+#define VECTOR_SIZE (1 << 16)
+#define LAUNCH_COUNT (200)
+
+// launch kernels on a new view of the accelerator, waiting for every other one
+bool request() {
+  std::vector<int> table(VECTOR_SIZE, 0);
+  hc::array_view<int, 1> av(VECTOR_SIZE, table);
+  hc::accelerator_view view = hc::accelerator().create_view();
+  for (int i = 0; i < LAUNCH_COUNT; ++i) {
+    hc::completion_future fut = hc::parallel_for_each(view, av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      av[idx] += 1;
+    });
+    if (i % 2)
+      fut.wait();
+  }
+  view.wait();
+  av.synchronize();
+  return std::all_of(table.begin(), table.end(), [](int v) { return v == LAUNCH_COUNT; });
+}
+
+// run a request on each of @threads host threads, return the elapsed time in ms
+double measure(int threads, bool& ret) {
+  std::vector<std::thread> workers;
+  std::vector<char> results(threads, 0);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int t = 0; t < threads; ++t)
+    workers.emplace_back([&results, t]() { results[t] = request(); });
+  for (auto& w : workers)
+    w.join();
+  auto end = std::chrono::high_resolution_clock::now();
+  for (char r : results)
+    ret &= (r != 0);
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// kernels of a view shared by several host threads still execute one at a time
+bool test_shared_view(int threads) {
+  std::atomic<int> active(0);
+  std::atomic<int> overlaps(0);
+  auto p_active = &active;
+  auto p_overlaps = &overlaps;
+  hc::accelerator_view view = hc::accelerator().create_view();
+  std::vector<std::vector<int>> tables(threads, std::vector<int>(1, 0));
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([=, &view, &tables]() {
+      hc::array_view<int, 1> av(1, tables[t]);
+      for (int i = 0; i < LAUNCH_COUNT; ++i) {
+        hc::completion_future fut = hc::parallel_for_each(view, av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+          if (p_active->fetch_add(1) > 0)
+            p_overlaps->fetch_add(1);
+          for (int k = 0; k < 1000; ++k)
+            p_active->load();
+          av[idx] += 1;
+          p_active->fetch_sub(1);
+        });
+        if (i % 3 == 0)
+          fut.wait();
+      }
+      view.wait();
+      av.synchronize();
+    });
+  }
+  for (auto& w : workers)
+    w.join();
+
+  bool ret = (overlaps == 0);
+  for (const auto& table : tables)
+    ret &= (table[0] == LAUNCH_COUNT);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+  const int max_threads = std::max(4u, std::thread::hardware_concurrency());
+
+  measure(1, ret); // warm up the worker pool
+  double base = measure(1, ret);
+  std::cout << "requests on independent views\n";
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    double elapsed = threads == 1 ? base : measure(threads, ret);
+    std::cout << "  " << threads << " threads: " << elapsed << " ms, "
+              << (threads * base / elapsed) << "x throughput\n";
+  }
+
+  ret &= test_shared_view(4);
+
+  return !(ret == true);
+}
@@ -0,0 +1,56 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// benchmark the bandwidth of copies between host memory and arrays, and
+// between arrays, on the CPU runtime across sizes, next to a single threaded
+// memcpy, large copies being split among the workers of the queue
+
+#define MIN_SIZE (64 * 1024)
+#define MAX_SIZE (256 * 1024 * 1024)
+// bytes copied by each measurement
+#define TRAFFIC (1024 * 1024 * 1024LL)
+
+// run @copy of @bytes enough times to move TRAFFIC bytes, return GB/s
+template <typename Copy>
+double measure(size_t bytes, Copy copy) {
+  const int rounds = std::max<long long>(1, TRAFFIC / bytes);
+  copy(); // warm up, the first copy faults the pages in
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int r = 0; r < rounds; ++r)
+    copy();
+  auto end = std::chrono::high_resolution_clock::now();
+  double s = std::chrono::duration<double>(end - start).count();
+  return bytes * double(rounds) / s / 1e9;
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator_view view = hc::accelerator().get_default_view();
+
+  std::cout << "size KB, memcpy, host to array, array to host, array to array (GB/s)\n";
+  for (size_t bytes = MIN_SIZE; bytes <= MAX_SIZE; bytes *= 4) {
+    const size_t count = bytes / sizeof(int);
+    std::vector<int> src(count), dst(count, 0);
+    for (size_t i = 0; i < count; ++i)
+      src[i] = i;
+    hc::array<int, 1> a(count, view);
+    hc::array<int, 1> b(count, view);
+
+    double host = measure(bytes, [&] { memcpy(dst.data(), src.data(), bytes); });
+    double write = measure(bytes, [&] { hc::copy(src.begin(), src.end(), a); });
+    double device = measure(bytes, [&] { hc::copy(a, b); });
+    double read = measure(bytes, [&] { hc::copy(b, dst.begin()); });
+    std::cout << "  " << bytes / 1024 << ", " << host << ", " << write << ", "
+              << read << ", " << device << "\n";
+
+    ret &= (dst == src);
+  }
+  return !(ret == true);
+}
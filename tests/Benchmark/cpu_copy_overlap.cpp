@@ -0,0 +1,66 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// benchmark a pipeline streaming data through a kernel in chunks, each chunk
+// copied to one of two arrays, transformed, then copied back, on a view
+// executing in order where copies and kernels take turns, against a view
+// executing in any order where the copies of a chunk run on the copy workers
+// while the kernel of the previous chunk runs on the worker pool
+
+#define CHUNK_SIZE (1 << 20)
+#define CHUNKS (16)
+#define ITERATIONS (16)
+
+// stream @in through the pipeline on @view into @out, return the elapsed time
+// in ms
+double pipeline(hc::accelerator_view view, const std::vector<float>& in, std::vector<float>& out) {
+  hc::array<float, 1> buf0(CHUNK_SIZE, view);
+  hc::array<float, 1> buf1(CHUNK_SIZE, view);
+  hc::array_view<float, 1> v0(buf0);
+  hc::array_view<float, 1> v1(buf1);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int c = 0; c < CHUNKS; ++c) {
+    hc::array<float, 1>& buf = c % 2 ? buf1 : buf0;
+    hc::array_view<float, 1> v = c % 2 ? v1 : v0;
+    hc::copy_async(in.data() + c * CHUNK_SIZE, in.data() + (c + 1) * CHUNK_SIZE, buf);
+    hc::parallel_for_each(view, v.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      float x = v[idx];
+      for (int i = 0; i < ITERATIONS; ++i)
+        x = x * 0.5f + 1.0f;
+      v[idx] = x;
+    });
+    hc::copy_async(buf, out.data() + c * CHUNK_SIZE);
+  }
+  view.wait();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main() {
+  std::vector<float> in(CHUNKS * CHUNK_SIZE);
+  std::vector<float> serial(in.size(), 0.0f), overlapped(in.size(), 0.0f);
+  for (size_t i = 0; i < in.size(); ++i)
+    in[i] = i % 100;
+
+  hc::accelerator acc;
+  pipeline(acc.create_view(), in, serial); // warm up the worker pools
+  double ordered = pipeline(acc.create_view(hc::execute_in_order), in, serial);
+  double any = pipeline(acc.create_view(hc::execute_any_order), in, overlapped);
+
+  const double mb = 2.0 * in.size() * sizeof(float) / (1024.0 * 1024.0);
+  std::cout << CHUNKS << " chunks, " << mb << " MB copied\n";
+  std::cout << "  copies and kernels in order: " << ordered << " ms\n";
+  std::cout << "  copies overlapping kernels:  " << any << " ms\n";
+
+  bool ret = (serial == overlapped);
+  float expected = 0.0f;
+  for (int i = 0; i < ITERATIONS; ++i)
+    expected = expected * 0.5f + 1.0f;
+  ret &= (serial[0] == expected);
+  return !(ret == true);
+}
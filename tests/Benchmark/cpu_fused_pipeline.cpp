@@ -0,0 +1,88 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// benchmark a pipeline of element-wise kernels over the same extent, scale,
+// then bias, then clamp, on a view in queuing_mode_deferred_elementwise,
+// where they are fused into a single pass over memory, against the default
+// queuing mode where each kernel is a separate pass
+
+#define VECTOR_SIZE (1 << 22)
+#define ROUNDS (10)
+#define STAGES (3)
+
+// run the pipeline ROUNDS times on @view, return the elapsed time in ms
+double pipeline(hc::accelerator_view view, std::vector<float>& table, const std::vector<float>& bias) {
+  hc::array_view<float, 1> data(VECTOR_SIZE, table);
+  hc::array_view<const float, 1> b(VECTOR_SIZE, bias);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int r = 0; r < ROUNDS; ++r) {
+    hc::parallel_for_each(view, data.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      data[idx] *= 0.5f;
+    });
+    hc::parallel_for_each(view, data.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      data[idx] += b[idx];
+    });
+    hc::parallel_for_each(view, data.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      float v = data[idx];
+      data[idx] = v < 0.0f ? 0.0f : (v > 100.0f ? 100.0f : v);
+    });
+  }
+  view.wait();
+  auto end = std::chrono::high_resolution_clock::now();
+  data.synchronize();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// a kernel reading a shifted section of a buffer written before it is not
+// fused, it sees every element written by the previous kernel
+bool test_shifted() {
+  hc::accelerator_view view = hc::accelerator().create_view(hc::execute_in_order, hc::queuing_mode_deferred_elementwise);
+  std::vector<int> src(1025), dst(1024, 0);
+  for (int i = 0; i < 1025; ++i)
+    src[i] = i;
+  hc::array_view<int, 1> s(1025, src);
+  hc::array_view<int, 1> d(1024, dst);
+  hc::array_view<int, 1> head = s.section(0, 1024);
+  hc::array_view<int, 1> tail = s.section(1, 1024);
+  hc::parallel_for_each(view, d.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    head[idx] *= 2;
+  });
+  hc::parallel_for_each(view, d.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    d[idx] = tail[idx];
+  });
+  d.synchronize();
+  bool ret = (dst[1023] == 1024);
+  for (int i = 0; i < 1023; ++i)
+    ret &= (dst[i] == 2 * (i + 1));
+  return ret;
+}
+
+int main() {
+  std::vector<float> bias(VECTOR_SIZE);
+  std::vector<float> expected(VECTOR_SIZE), fused(VECTOR_SIZE);
+  for (int i = 0; i < VECTOR_SIZE; ++i) {
+    bias[i] = i % 7;
+    expected[i] = fused[i] = (i % 300) - 50;
+  }
+
+  hc::accelerator acc;
+  double separate = pipeline(acc.create_view(), expected, bias);
+  double deferred = pipeline(acc.create_view(hc::execute_in_order, hc::queuing_mode_deferred_elementwise), fused, bias);
+
+  // every kernel reads and writes the data, bias is read by one of them
+  const double mb = VECTOR_SIZE * sizeof(float) / (1024.0 * 1024.0);
+  std::cout << "pipeline of " << STAGES << " kernels over " << mb << " MB\n";
+  std::cout << "  separate passes: " << separate / ROUNDS << " ms, "
+            << (2 * STAGES + 1) * mb << " MB of memory traffic\n";
+  std::cout << "  fused pass:      " << deferred / ROUNDS << " ms, "
+            << 3 * mb << " MB of memory traffic\n";
+
+  bool ret = (expected == fused);
+  ret &= test_shifted();
+  return !(ret == true);
+}
@@ -0,0 +1,73 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// benchmark a timestep of an iterative solver, a fixed sequence of small
+// kernels and markers, issued on an accelerator_view every step against
+// captured once into a command_graph and replayed
+
+#define VECTOR_SIZE (1024)
+#define KERNEL_COUNT (20)
+#define STEP_COUNT (1000)
+
+void timestep(hc::accelerator_view& view, hc::array_view<float, 1>& x,
+              hc::array_view<const float, 1>& b) {
+  for (int k = 0; k < KERNEL_COUNT; ++k) {
+    if (k == KERNEL_COUNT / 2) {
+      hc::parallel_for_each(view, x.get_extent().tile(64), [=](hc::tiled_index<1> tidx) [[hc]] {
+        x[tidx.global] += 1.0f;
+      });
+      view.create_marker();
+    } else {
+      hc::parallel_for_each(view, x.get_extent(), [=](hc::index<1> idx) [[hc]] {
+        x[idx] = x[idx] * 0.5f + b[idx];
+      });
+    }
+  }
+}
+
+int main() {
+  bool ret = true;
+  std::vector<float> direct(VECTOR_SIZE, 1.0f), replayed(VECTOR_SIZE, 1.0f), rhs(VECTOR_SIZE);
+  for (int i = 0; i < VECTOR_SIZE; ++i)
+    rhs[i] = i % 5;
+  hc::array_view<const float, 1> b(VECTOR_SIZE, rhs);
+  hc::accelerator acc;
+
+  hc::accelerator_view view = acc.create_view();
+  hc::array_view<float, 1> x(VECTOR_SIZE, direct);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int s = 0; s < STEP_COUNT; ++s)
+    timestep(view, x, b);
+  view.wait();
+  auto end = std::chrono::high_resolution_clock::now();
+  double issued = std::chrono::duration<double, std::micro>(end - start).count() / STEP_COUNT;
+
+  hc::accelerator_view graph_view = acc.create_view();
+  hc::array_view<float, 1> y(VECTOR_SIZE, replayed);
+  graph_view.begin_capture();
+  timestep(graph_view, y, b);
+  hc::command_graph graph = graph_view.end_capture();
+  // nothing executes while capturing
+  ret &= (graph.get_size() == KERNEL_COUNT + 1) && (replayed[0] == 1.0f);
+
+  start = std::chrono::high_resolution_clock::now();
+  for (int s = 0; s < STEP_COUNT; ++s)
+    graph.replay();
+  graph_view.wait();
+  end = std::chrono::high_resolution_clock::now();
+  double replay = std::chrono::duration<double, std::micro>(end - start).count() / STEP_COUNT;
+
+  std::cout << "timestep of " << KERNEL_COUNT << " kernels\n";
+  std::cout << "  issued:   " << issued << " us\n";
+  std::cout << "  replayed: " << replay << " us\n";
+
+  x.synchronize();
+  y.synchronize();
+  ret &= (direct == replayed);
+  return !(ret == true);
+}
@@ -0,0 +1,62 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// benchmark dispatch overhead of parallel_for_each on the CPU runtime with
+// kernels doing a single work-item of work, so that the time of each launch
+// is spent in the runtime
+
+#define LAUNCH_COUNT (5000)
+
+template <typename Launch>
+double measure(Launch launch) {
+  launch(); // warm up, the first launch of a kernel resolves its descriptor
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < LAUNCH_COUNT; ++i)
+    launch();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / LAUNCH_COUNT;
+}
+
+int main() {
+  std::vector<int> table(3, 0);
+  hc::array_view<int, 1> counter(3, table);
+  hc::accelerator_view av = hc::accelerator().get_default_view();
+
+  // back-to-back launches without waiting, only bounded by the enqueue path
+  double async = measure([&]() {
+    hc::parallel_for_each(av, hc::extent<1>(1), [=](hc::index<1> idx) [[hc]] {
+      counter[0] += 1;
+    });
+  });
+  av.wait();
+
+  // launch and wait, a round trip through the dispatcher of the queue
+  double sync = measure([&]() {
+    hc::parallel_for_each(av, hc::extent<1>(1), [=](hc::index<1> idx) [[hc]] {
+      counter[1] += 1;
+    }).wait();
+  });
+
+  double tiled = measure([&]() {
+    hc::parallel_for_each(av, hc::extent<1>(1).tile(1), [=](hc::tiled_index<1> tidx) [[hc]] {
+      counter[2] += 1;
+    }).wait();
+  });
+
+  std::cout << "launch overhead per kernel\n";
+  std::cout << "  async:        " << async << " us\n";
+  std::cout << "  synchronous:  " << sync << " us\n";
+  std::cout << "  tiled:        " << tiled << " us\n";
+
+  // sanity check, every launch increments its counter once
+  counter.synchronize();
+  bool ret = true;
+  for (int i = 0; i < 3; ++i)
+    ret &= (table[i] == LAUNCH_COUNT + 1);
+  return !(ret == true);
+}
@@ -0,0 +1,78 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// benchmark launch overhead of tiny CPU kernels against the number of
+// array_view captured, which are all synchronized at every launch
+
+#define LAUNCH_COUNT (2000)
+#define VEC_SIZE (16)
+
+template <typename Launch>
+double measure(Launch launch) {
+  launch(); // warm up
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < LAUNCH_COUNT; ++i)
+    launch();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::micro>(end - start).count() / LAUNCH_COUNT;
+}
+
+int main() {
+  std::vector<std::vector<int>> tables(16, std::vector<int>(VEC_SIZE, 0));
+  std::vector<hc::array_view<int, 1>> views;
+  for (auto& table : tables)
+    views.emplace_back(VEC_SIZE, table);
+  hc::extent<1> ext(VEC_SIZE);
+
+  hc::array_view<int, 1> a0 = views[0], a1 = views[1], a2 = views[2], a3 = views[3];
+  hc::array_view<int, 1> a4 = views[4], a5 = views[5], a6 = views[6], a7 = views[7];
+  hc::array_view<int, 1> a8 = views[8], a9 = views[9], a10 = views[10], a11 = views[11];
+  hc::array_view<int, 1> a12 = views[12], a13 = views[13], a14 = views[14], a15 = views[15];
+
+  double t1 = measure([&]() {
+    hc::parallel_for_each(ext, [=](hc::index<1> idx) [[hc]] {
+      a0[idx] += 1;
+    });
+  });
+  double t4 = measure([&]() {
+    hc::parallel_for_each(ext, [=](hc::index<1> idx) [[hc]] {
+      a0[idx] += 1; a1[idx] += 1; a2[idx] += 1; a3[idx] += 1;
+    });
+  });
+  double t8 = measure([&]() {
+    hc::parallel_for_each(ext, [=](hc::index<1> idx) [[hc]] {
+      a0[idx] += 1; a1[idx] += 1; a2[idx] += 1; a3[idx] += 1;
+      a4[idx] += 1; a5[idx] += 1; a6[idx] += 1; a7[idx] += 1;
+    });
+  });
+  double t16 = measure([&]() {
+    hc::parallel_for_each(ext, [=](hc::index<1> idx) [[hc]] {
+      a0[idx] += 1; a1[idx] += 1; a2[idx] += 1; a3[idx] += 1;
+      a4[idx] += 1; a5[idx] += 1; a6[idx] += 1; a7[idx] += 1;
+      a8[idx] += 1; a9[idx] += 1; a10[idx] += 1; a11[idx] += 1;
+      a12[idx] += 1; a13[idx] += 1; a14[idx] += 1; a15[idx] += 1;
+    });
+  });
+
+  std::cout << "launch overhead per captured array_view count\n";
+  std::cout << "   1: " << t1 << " us\n";
+  std::cout << "   4: " << t4 << " us\n";
+  std::cout << "   8: " << t8 << " us\n";
+  std::cout << "  16: " << t16 << " us\n";
+
+  // sanity check, every launch increments each captured view once
+  const int launches = LAUNCH_COUNT + 1;
+  bool ret = true;
+  for (int i = 0; i < 16; ++i) {
+    views[i].synchronize();
+    int expected = launches * ((i < 1) + (i < 4) + (i < 8) + 1);
+    for (int j = 0; j < VEC_SIZE; ++j)
+      ret &= (tables[i][j] == expected);
+  }
+  return !(ret == true);
+}
@@ -0,0 +1,81 @@
+// RUN: %hc_cpu %s -o %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=STATIC %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=DYNAMIC %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=GUIDED %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// benchmark load balance of CPU kernels with skewed per work-item cost
+// compare the timing printed by each HCC_CPU_SCHEDULE policy
+
+#define REPEAT (5)
+
+template <typename Launch>
+double measure(Launch launch) {
+  launch(); // warm up
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < REPEAT; ++i)
+    launch();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / REPEAT;
+}
+
+int main() {
+  const char* policy = getenv("HCC_CPU_SCHEDULE");
+  const int vecSize = 1 << 14;
+  std::vector<float> table(vecSize, 1.0f);
+  hc::array_view<float, 1> av(vecSize, table);
+
+  // cost of a work-item grows linearly with its index
+  double triangular = measure([&]() {
+    hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      float acc = av[idx];
+      for (int i = 0; i < idx[0] / 8; ++i)
+        acc = acc * 0.999f + 0.001f;
+      av[idx] = acc;
+    });
+  });
+
+  // a few work-items at the end of the domain are very expensive
+  double tail_heavy = measure([&]() {
+    hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      float acc = av[idx];
+      int iter = (idx[0] >= vecSize - 64) ? 20000 : 4;
+      for (int i = 0; i < iter; ++i)
+        acc = acc * 0.999f + 0.001f;
+      av[idx] = acc;
+    });
+  });
+
+  // narrow first dimension, which used to bound the parallelism
+  const int dim1 = vecSize;
+  std::vector<float> table2d(3 * dim1, 1.0f);
+  hc::array_view<float, 2> av2d(3, dim1, table2d);
+  double narrow = measure([&]() {
+    hc::parallel_for_each(av2d.get_extent(), [=](hc::index<2> idx) [[hc]] {
+      float acc = av2d[idx];
+      for (int i = 0; i < 64; ++i)
+        acc = acc * 0.999f + 0.001f;
+      av2d[idx] = acc;
+    });
+  });
+
+  av.synchronize();
+  av2d.synchronize();
+
+  std::cout << "schedule: " << (policy ? policy : "default") << "\n";
+  std::cout << "  triangular: " << triangular << " ms\n";
+  std::cout << "  tail heavy: " << tail_heavy << " ms\n";
+  std::cout << "  3 x " << dim1 << ":  " << narrow << " ms\n";
+
+  // sanity check, all values stay within (0, 1]
+  int error = 0;
+  for (int i = 0; i < vecSize; ++i)
+    error += !(table[i] > 0.0f && table[i] <= 1.0f);
+  return (error != 0);
+}
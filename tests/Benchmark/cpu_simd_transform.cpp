@@ -0,0 +1,74 @@
+// RUN: %hc_cpu %s -o %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SIMD=OFF %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SIMD=ON %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// benchmark element-wise transform kernels on CPU, whose work-items along the
+// innermost dimension are executed as SIMD lanes
+// compare the timing printed by each HCC_CPU_SIMD
+
+#define REPEAT (10)
+
+template <typename Run>
+double measure(Run run) {
+  run(); // warm up
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < REPEAT; ++i)
+    run();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / REPEAT;
+}
+
+int main() {
+  const char* simd = getenv("HCC_CPU_SIMD");
+  const int rows = 1024;
+  const int cols = 4096;
+  const int vecSize = rows * cols;
+  const float a = 2.0f;
+
+  std::vector<float> x(vecSize);
+  std::vector<float> y(vecSize);
+  std::vector<float> z(vecSize);
+  std::vector<float> w(vecSize, 0.0f);
+  for (int i = 0; i < vecSize; ++i) {
+    x[i] = i % 13;
+    y[i] = i % 7;
+  }
+  hc::array_view<const float, 1> av_x(vecSize, x);
+  hc::array_view<const float, 1> av_y(vecSize, y);
+  hc::array_view<float, 1> av_z(vecSize, z);
+  hc::array_view<float, 2> av_w(rows, cols, w);
+
+  // z = a * x + y
+  double saxpy = measure([&]() {
+    hc::parallel_for_each(av_z.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      av_z[idx] = a * av_x[idx] + av_y[idx];
+    }).wait();
+  });
+  av_z.synchronize();
+  bool ret = true;
+  for (int i = 0; i < vecSize; ++i)
+    ret &= (z[i] == a * x[i] + y[i]);
+
+  // w = w * 0.5 + column, over a 2D domain
+  double scale = measure([&]() {
+    hc::parallel_for_each(av_w.get_extent(), [=](hc::index<2> idx) [[hc]] {
+      av_w[idx] = av_w[idx] * 0.5f + idx[1];
+    }).wait();
+  });
+  av_w.synchronize();
+  for (int i = 0; i < vecSize; ++i)
+    ret &= (w[i] >= 0.0f && w[i] < 2.0f * (i % cols) + 1.0f);
+
+  std::cout << "simd: " << (simd ? simd : "default") << "\n";
+  std::cout << "  saxpy:    " << saxpy << " ms\n";
+  std::cout << "  scale 2D: " << scale << " ms\n";
+
+  return !(ret == true);
+}
@@ -0,0 +1,63 @@
+// RUN: %hc_cpu %s -o %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_TILE_ENGINE=UCONTEXT %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_TILE_ENGINE=FIBER %t.out
+
+// Parallel STL headers
+#include <coordinate>
+#include <experimental/algorithm>
+#include <experimental/numeric>
+#include <experimental/execution_policy>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+// benchmark barrier cost of tiled kernels on CPU with the tiled reduce and
+// scan kernels of Parallel STL
+// compare the timing printed by each HCC_CPU_TILE_ENGINE
+
+#define REPEAT (5)
+
+template <typename Run>
+double measure(Run run) {
+  run(); // warm up
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < REPEAT; ++i)
+    run();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() / REPEAT;
+}
+
+int main() {
+  using std::experimental::parallel::par;
+
+  const char* engine = getenv("HCC_CPU_TILE_ENGINE");
+  const int vecSize = 1 << 18;
+  std::vector<int> input(vecSize);
+  for (int i = 0; i < vecSize; ++i)
+    input[i] = i % 7;
+  std::vector<int> output(vecSize);
+
+  int sum = 0;
+  double reduce = measure([&]() {
+    sum = std::experimental::parallel::reduce(par, std::begin(input), std::end(input), 0);
+  });
+
+  double scan = measure([&]() {
+    std::experimental::parallel::inclusive_scan(par, std::begin(input), std::end(input),
+                                                std::begin(output), std::plus<int>());
+  });
+
+  std::cout << "tile engine: " << (engine ? engine : "default") << "\n";
+  std::cout << "  reduce:         " << reduce << " ms\n";
+  std::cout << "  inclusive scan: " << scan << " ms\n";
+
+  // sanity check
+  std::vector<int> expected(vecSize);
+  std::partial_sum(std::begin(input), std::end(input), std::begin(expected));
+  bool ret = (sum == std::accumulate(std::begin(input), std::end(input), 0));
+  ret &= (output == expected);
+  return !(ret == true);
+}
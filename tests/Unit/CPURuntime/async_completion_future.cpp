@@ -0,0 +1,142 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// check that parallel_for_each on CPU path returns a completion_future which
+// tracks the kernel, and that kernels in one queue still execute in order
+
+#define SIZE (4096)
+#define CHAIN (5)
+
+bool test_wait() {
+  std::vector<int> table(SIZE, 1);
+  hc::array_view<int, 1> av(SIZE, table);
+
+  hc::completion_future fut = hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    int acc = 0;
+    for (int i = 0; i < 10000; ++i)
+      acc += i & 1;
+    av[idx] += acc;
+  });
+
+  bool ret = fut.valid();
+  fut.wait();
+  ret &= fut.is_ready();
+  ret &= (fut.get_tick_frequency() != 0);
+  ret &= (fut.get_begin_tick() != 0);
+  ret &= (fut.get_end_tick() >= fut.get_begin_tick());
+
+  av.synchronize();
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (table[i] == 1 + 5000);
+  return ret;
+}
+
+bool test_in_order() {
+  std::vector<int> table(SIZE, 1);
+  std::vector<int> other(SIZE, 3);
+  hc::array_view<int, 1> av(SIZE, table);
+  hc::array_view<int, 1> aw(SIZE, other);
+
+  // dependent kernels, not waited for on the host
+  hc::completion_future last;
+  for (int i = 0; i < CHAIN; ++i) {
+    last = hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      av[idx] *= 2;
+    });
+  }
+  hc::parallel_for_each(aw.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    aw[idx] += av[idx];
+  });
+
+  // host access waits for the kernels using the buffer
+  bool ret = true;
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (aw[i] == 3 + (1 << CHAIN));
+
+  hc::accelerator().get_default_view().wait();
+  ret &= last.is_ready();
+  return ret;
+}
+
+// spin until @flag is set, at most @ms milliseconds
+bool wait_flag(std::atomic<int>* flag, int ms) {
+  auto start = std::chrono::steady_clock::now();
+  while (!flag->load()) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(ms))
+      return false;
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+// a kernel using a buffer of the kernel before it on the same queue is
+// launched without the host waiting for that one
+bool test_no_host_wait() {
+  std::vector<int> table(SIZE, 0);
+  hc::array_view<int, 1> av(SIZE, table);
+  std::atomic<int> flag(0);
+  auto p_flag = &flag;
+
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0)
+      wait_flag(p_flag, 2000);
+    av[idx] += 1;
+  });
+  auto start = std::chrono::steady_clock::now();
+  hc::completion_future second = hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] *= 3;
+  });
+  bool ret = std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000);
+  ret &= !second.is_ready();
+
+  flag = 1;
+  second.wait();
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (av[i] == 3);
+  return ret;
+}
+
+// a kernel reading a part of a buffer the kernel before it on the same queue
+// did not use gets that part up to date
+bool test_section() {
+  std::vector<int> table(SIZE + 1);
+  std::vector<int> result(SIZE, 0);
+  for (int i = 0; i <= SIZE; ++i)
+    table[i] = i;
+  hc::array_view<int, 1> av(SIZE + 1, table);
+  hc::array_view<int, 1> head = av.section(0, SIZE);
+  hc::array_view<int, 1> tail = av.section(1, SIZE);
+  hc::array_view<int, 1> out(SIZE, result);
+
+  hc::parallel_for_each(head.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    head[idx] *= 2;
+  });
+  hc::parallel_for_each(out.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    out[idx] = tail[idx];
+  }).wait();
+
+  bool ret = true;
+  for (int i = 0; i < SIZE - 1; ++i)
+    ret &= (out[i] == 2 * (i + 1));
+  ret &= (out[SIZE - 1] == SIZE);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_wait();
+  ret &= test_in_order();
+  ret &= test_no_host_wait();
+  ret &= test_section();
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,68 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// check CPU atomics under contention from all worker threads
+// every work-item updates a handful of shared locations
+
+#define NBINS (4)
+
+int main() {
+  bool ret = true;
+  const int vecSize = 1 << 16;
+
+  std::vector<int> counts(NBINS, 0);
+  std::vector<unsigned int> mask(1, 0u);
+  std::vector<float> fsum(1, 0.0f);
+  std::vector<uint64_t> wide(1, 0);
+  std::vector<int> extremes(2, 0);
+  std::vector<int> winner(1, -1);
+
+  hc::array_view<int, 1> av_counts(NBINS, counts);
+  hc::array_view<unsigned int, 1> av_mask(1, mask);
+  hc::array_view<float, 1> av_fsum(1, fsum);
+  hc::array_view<uint64_t, 1> av_wide(1, wide);
+  hc::array_view<int, 1> av_extremes(2, extremes);
+  hc::array_view<int, 1> av_winner(1, winner);
+
+  hc::parallel_for_each(hc::extent<1>(vecSize), [=](hc::index<1> idx) [[hc]] {
+    int i = idx[0];
+    hc::atomic_fetch_add(&av_counts[i % NBINS], 2);
+    hc::atomic_fetch_sub(&av_counts[i % NBINS], 1);
+    hc::atomic_fetch_or(&av_mask[0], 1u << (i % 32));
+    hc::atomic_fetch_add(&av_fsum[0], 1.0f);
+    hc::atomic_fetch_add(&av_wide[0], (uint64_t)1 << 32);
+    hc::atomic_fetch_max(&av_extremes[0], i);
+    hc::atomic_fetch_min(&av_extremes[1], -i);
+    int expected = -1;
+    hc::atomic_compare_exchange(&av_winner[0], &expected, i);
+  });
+
+  av_counts.synchronize();
+  av_mask.synchronize();
+  av_fsum.synchronize();
+  av_wide.synchronize();
+  av_extremes.synchronize();
+  av_winner.synchronize();
+
+  for (int b = 0; b < NBINS; ++b)
+    ret &= (counts[b] == vecSize / NBINS);
+  ret &= (mask[0] == 0xffffffffu);
+  // all partial sums are exactly representable
+  ret &= (fsum[0] == (float)vecSize);
+  ret &= (wide[0] == ((uint64_t)vecSize << 32));
+  ret &= (extremes[0] == vecSize - 1);
+  ret &= (extremes[1] == -(vecSize - 1));
+  ret &= (winner[0] >= 0 && winner[0] < vecSize);
+
+  if (ret) {
+    std::cout << "Verify success!\n";
+  } else {
+    std::cout << "Verify failed!\n";
+  }
+  return !(ret == true);
+}
@@ -0,0 +1,150 @@
+// RUN: %hc_cpu %s -o %t.out && rm -rf %t.cache && HCC_RUNTIME=CPU HCC_CACHE_DIR=%t.cache %t.out
+
+#include <hc.hpp>
+#include <kalmar_code_cache.h>
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// test the on-disk cache of finalized code objects with a fake device, which
+// "finalizes" a program by reversing it and counts how often it had to
+class FakeDevice final : public Kalmar::KalmarDevice
+{
+    Kalmar::KalmarCodeCache& cache;
+    std::string isa;
+    std::string options;
+public:
+    int finalized;
+    std::vector<char> code;
+
+    FakeDevice(Kalmar::KalmarCodeCache& cache, std::string isa, std::string options = "")
+        : KalmarDevice(Kalmar::access_type_none), cache(cache), isa(isa), options(options),
+          finalized(0), code() {}
+
+    std::wstring get_path() const override { return L"fake"; }
+    std::wstring get_description() const override { return L"Fake Device"; }
+    size_t get_mem() const override { return 0; }
+    bool is_double() const override { return true; }
+    bool is_lim_double() const override { return true; }
+    bool is_unified() const override { return true; }
+    bool is_emulated() const override { return true; }
+    std::shared_ptr<Kalmar::KalmarQueue> createQueue(Kalmar::execute_order order) override { return nullptr; }
+    void* create(size_t count, struct Kalmar::rw_info* key) override { return nullptr; }
+    void release(void* ptr, struct Kalmar::rw_info* key) override {}
+
+    void BuildProgram(void* size, void* source, bool needsCompilation) override {
+        const char* program = static_cast<const char*>(source);
+        std::string id(program, reinterpret_cast<size_t>(size));
+        if (cache.load(id, isa, options, code))
+            return;
+        code.assign(id.rbegin(), id.rend());
+        ++finalized;
+        cache.store(id, isa, options, code.data(), code.size());
+    }
+
+    void build(const std::string& program) {
+        BuildProgram(reinterpret_cast<void*>(program.size()), const_cast<char*>(program.data()), true);
+    }
+};
+
+// every device stands for a new process, it has no code objects of its own
+bool test_reuse() {
+  Kalmar::KalmarCodeCache& cache = Kalmar::KalmarCodeCache::getInstance();
+  if (!cache.enabled() || cache.get_dir() != getenv("HCC_CACHE_DIR"))
+    return false;
+
+  FakeDevice first(cache, "isa0");
+  first.build("program0");
+  FakeDevice second(cache, "isa0");
+  second.build("program0");
+  bool ret = first.finalized == 1 && second.finalized == 0 &&
+             std::string(second.code.begin(), second.code.end()) == "0margorp";
+
+  // ISA and finalizer options are part of the key
+  FakeDevice other_isa(cache, "isa1");
+  other_isa.build("program0");
+  FakeDevice other_options(cache, "isa0", "-O0");
+  other_options.build("program0");
+  ret &= other_isa.finalized == 1 && other_options.finalized == 1;
+  return ret;
+}
+
+// a truncated entry is a miss, then replaced
+bool test_corrupted(const std::string& dir) {
+  Kalmar::KalmarCodeCache cache(dir, 1 << 20);
+  FakeDevice first(cache, "isa0");
+  first.build("program1");
+
+  std::vector<char> code;
+  bool ret = cache.load("program1", "isa0", "", code);
+
+  // truncate every entry, as a writer killed without atomic renames would
+  DIR* d = opendir(dir.c_str());
+  while (struct dirent* ent = readdir(d)) {
+    if (ent->d_name[0] != '.')
+      ret &= truncate((dir + "/" + ent->d_name).c_str(), 10) == 0;
+  }
+  closedir(d);
+  ret &= !cache.load("program1", "isa0", "", code);
+
+  FakeDevice second(cache, "isa0");
+  second.build("program1");
+  ret &= second.finalized == 1 && cache.load("program1", "isa0", "", code);
+  return ret;
+}
+
+// the cache is trimmed to its capacity, least recently used entries first
+bool test_eviction(const std::string& dir) {
+  const size_t entrySize = 1000;
+  Kalmar::KalmarCodeCache cache(dir, 3 * entrySize);
+  std::vector<char> blob(entrySize - 64, 'x');
+  std::vector<char> code;
+
+  bool ret = true;
+  for (int i = 0; i < 3; ++i) {
+    ret &= cache.store("program" + std::to_string(i), "isa0", "", blob.data(), blob.size());
+    // keep modification times apart on file systems with coarse timestamps
+    usleep(10000);
+  }
+  // program0 becomes the most recently used
+  ret &= cache.load("program0", "isa0", "", code);
+  usleep(10000);
+  for (int i = 3; i < 5; ++i) {
+    ret &= cache.store("program" + std::to_string(i), "isa0", "", blob.data(), blob.size());
+    usleep(10000);
+  }
+
+  ret &= cache.load("program0", "isa0", "", code);
+  ret &= !cache.load("program1", "isa0", "", code);
+  ret &= !cache.load("program2", "isa0", "", code);
+  ret &= cache.load("program3", "isa0", "", code);
+  ret &= cache.load("program4", "isa0", "", code);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+  std::string dir = getenv("HCC_CACHE_DIR");
+
+  ret &= test_reuse();
+  ret &= test_corrupted(dir + "/corrupted");
+  ret &= test_eviction(dir + "/eviction");
+
+  // a cache of size 0 is disabled
+  Kalmar::KalmarCodeCache disabled(dir + "/disabled", 0);
+  ret &= !disabled.enabled();
+
+  // kernels still run on the CPU runtime with the cache configured
+  std::vector<int> table(64, 0);
+  hc::array_view<int, 1> av(64, table);
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] = idx[0];
+  }).wait();
+  av.synchronize();
+  for (int i = 0; i < 64; ++i)
+    ret &= (table[i] == i);
+
+  return !(ret == true);
+}
@@ -0,0 +1,85 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// test copies issued on an accelerator_view between begin_capture and
+// end_capture, which are recorded in the graph in order with its kernels, or
+// throw if they can't be
+
+#define SIZE (4096)
+
+// increment every element of @a on @view
+void increment(hc::accelerator_view& view, hc::array<int, 1>& a) {
+  hc::parallel_for_each(view, a.get_extent(), [&](hc::index<1> idx) [[hc]] {
+    a[idx] += 1;
+  });
+}
+
+// a kernel, a copy to another array, a kernel on that array, and a copy back
+// to host memory, executed in this order at every replay
+bool test_record(hc::accelerator& acc) {
+  hc::accelerator_view view = acc.create_view();
+  std::vector<int> init(SIZE, 0);
+  std::vector<int> result(SIZE, -1);
+  hc::array<int, 1> a(hc::extent<1>(SIZE), init.begin(), view);
+  hc::array<int, 1> b(SIZE, view);
+
+  view.begin_capture();
+  increment(view, a);
+  hc::completion_future fut = hc::copy_async(a, b);
+  increment(view, b);
+  hc::copy_async(b, result.data());
+  hc::command_graph graph = view.end_capture();
+
+  // nothing is executed until the graph is replayed
+  bool ret = fut.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+             graph.get_size() == 4 && result[0] == -1;
+
+  for (int i = 1; i <= 3; ++i) {
+    graph.replay().wait();
+    view.wait();
+    for (int j = 0; j < SIZE; ++j) {
+      if (result[j] != i + 1) {
+        ret = false;
+        break;
+      }
+    }
+  }
+  return ret;
+}
+
+// a copy of an array of the capturing view is not recorded, it throws
+bool test_throw(hc::accelerator& acc) {
+  hc::accelerator_view view = acc.create_view();
+  std::vector<int> host(SIZE, 0);
+  hc::array<int, 1> a(SIZE, view);
+
+  view.begin_capture();
+  bool ret = false;
+  try {
+    hc::copy(a, host.begin());
+  } catch (hc::runtime_exception&) {
+    ret = true;
+  }
+  hc::command_graph graph = view.end_capture();
+  ret &= graph.get_size() == 0;
+
+  // copies are executed once the capture is over
+  hc::copy(a, host.begin());
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator acc;
+
+  ret &= test_record(acc);
+  ret &= test_throw(acc);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
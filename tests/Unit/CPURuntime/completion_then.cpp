@@ -0,0 +1,172 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// check that the callbacks of completion_future::then on the CPU runtime run
+// on the few threads of the continuation executor once their future is
+// ready, chain through the futures they return, and that when_all and
+// when_any combine futures
+// A callback which never returns must not keep the process from exiting.
+
+#define SIZE (1024)
+#define CALLBACKS (1000)
+
+// spin until @flag is set, at most @ms milliseconds
+bool wait_flag(std::atomic<int>* flag, int ms) {
+  auto start = std::chrono::steady_clock::now();
+  while (!flag->load()) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(ms))
+      return false;
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+// launch a kernel adding 1 to @av on @view
+hc::completion_future increment(hc::accelerator_view& view, hc::array_view<int, 1> av) {
+  return hc::parallel_for_each(view, av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] += 1;
+  });
+}
+
+// the callback is a copy, it runs after the kernel, and the returned future
+// is ready once it has run
+hc::completion_future schedule(hc::accelerator_view& view, hc::array_view<int, 1> av,
+                               std::atomic<int>* seen) {
+  std::vector<int> local(16, 5);
+  hc::completion_future fut = increment(view, av);
+  return fut.then([local, av, seen] {
+    seen->store(local[15] + av[0]);
+  });
+}
+
+bool test_then(hc::accelerator_view& view) {
+  std::vector<int> table(SIZE, 0);
+  hc::array_view<int, 1> av(SIZE, table);
+  std::atomic<int> seen(0);
+  hc::completion_future done = schedule(view, av, &seen);
+  done.wait();
+  bool ret = done.valid() && (seen == 6);
+
+  // callbacks of an invalid future never run
+  hc::completion_future invalid;
+  ret &= !invalid.then([&] { seen = 0; }).valid();
+
+  // a callback throwing
+  hc::completion_future failed = increment(view, av).then([] { throw 1; });
+  try {
+    failed.get();
+    ret = false;
+  } catch (int) {
+  }
+  return ret && (seen == 6);
+}
+
+// a callback returning a future, the returned one is ready once it is
+bool test_chain(hc::accelerator_view& view) {
+  std::vector<int> table(SIZE, 0);
+  hc::array_view<int, 1> av(SIZE, table);
+  hc::completion_future last = increment(view, av).then([&view, av] {
+    return increment(view, av);
+  }).then([&view, av] {
+    return increment(view, av).then([&view, av] {
+      return increment(view, av);
+    });
+  });
+  last.wait();
+  return (av[0] == 4) && (av[SIZE - 1] == 4);
+}
+
+// many callbacks run on the few threads of the executor
+bool test_threads(hc::accelerator_view& view) {
+  std::mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<int> count(0);
+  std::vector<hc::completion_future> futures;
+  for (int i = 0; i < CALLBACKS; ++i) {
+    futures.push_back(view.create_marker().then([&] {
+      std::lock_guard<std::mutex> lck(mutex);
+      threads.insert(std::this_thread::get_id());
+      ++count;
+    }));
+  }
+  hc::when_all(futures.begin(), futures.end()).wait();
+  return (count == CALLBACKS) && (threads.size() <= 2) &&
+         (threads.count(std::this_thread::get_id()) == 0);
+}
+
+// when_all is ready once all of the futures are, when_any once one of them is
+bool test_when(hc::accelerator& acc) {
+  hc::accelerator_view slow_view = acc.create_view();
+  hc::accelerator_view fast_view = acc.create_view();
+  std::vector<int> ts(SIZE, 0), tf(SIZE, 0);
+  hc::array_view<int, 1> s(SIZE, ts);
+  hc::array_view<int, 1> f(SIZE, tf);
+  std::atomic<int> flag(0);
+  auto p_flag = &flag;
+
+  hc::completion_future slow = hc::parallel_for_each(slow_view, s.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0)
+      wait_flag(p_flag, 2000);
+    s[idx] += 1;
+  });
+  hc::completion_future fast = increment(fast_view, f);
+  hc::completion_future all = hc::when_all({slow, fast});
+  hc::completion_future any = hc::when_any({slow, fast});
+  any.wait();
+  bool ret = !slow.is_ready() && !all.is_ready() &&
+             (all.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready);
+
+  flag = 1;
+  all.wait();
+  ret &= slow.is_ready() && fast.is_ready();
+  ret &= hc::when_all({}).valid() && hc::when_any({hc::completion_future()}).valid();
+  return ret;
+}
+
+// a kernel recorded in queuing_mode_deferred is enqueued so that the callback
+// runs
+bool test_deferred(hc::accelerator& acc) {
+  hc::accelerator_view view = acc.create_view(hc::execute_in_order, hc::queuing_mode_deferred);
+  std::vector<int> table(SIZE, 0);
+  hc::array_view<int, 1> av(SIZE, table);
+  std::atomic<int> seen(0);
+  increment(view, av).then([&] { seen = 1; }).wait();
+  return seen == 1;
+}
+
+// a callback still running at exit is not waited for
+void leave_running(hc::accelerator_view& view) {
+  view.create_marker().then([] {
+    while (true)
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+  });
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator acc;
+  hc::accelerator_view in_order = acc.create_view();
+  hc::accelerator_view any_order = acc.create_view(hc::execute_any_order);
+
+  for (hc::accelerator_view* view : {&in_order, &any_order}) {
+    ret &= test_then(*view);
+    ret &= test_chain(*view);
+    ret &= test_threads(*view);
+    view->wait();
+  }
+  ret &= test_when(acc);
+  ret &= test_deferred(acc);
+  leave_running(in_order);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,149 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+// check that copy_async on the CPU runtime is enqueued on a view, ordered with
+// the kernels and markers of the view, and executed by the copy workers while
+// kernels run
+
+#define SIZE (1 << 20)
+
+// spin until @flag is set, at most @ms milliseconds
+bool wait_flag(std::atomic<int>* flag, int ms) {
+  auto start = std::chrono::steady_clock::now();
+  while (!flag->load()) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(ms))
+      return false;
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+// copies to and from an array are ordered with the kernels of its view, and a
+// marker completes once they have
+bool test_ordered(hc::accelerator_view& view) {
+  std::vector<int> in(SIZE), out(SIZE, 0);
+  std::iota(in.begin(), in.end(), 0);
+  hc::array<int, 1> data(SIZE, view);
+  hc::array_view<int, 1> av(data);
+
+  hc::completion_future upload = hc::copy_async(in.begin(), in.end(), data);
+  hc::parallel_for_each(view, data.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] += 1;
+  });
+  hc::completion_future download = hc::copy_async(data, out.data());
+  view.create_marker().wait();
+
+  bool ret = upload.valid() && upload.is_ready() && download.is_ready();
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (out[i] == i + 1);
+  return ret;
+}
+
+// copies between array_views of host memory, sections and arrays
+bool test_views(hc::accelerator_view& view) {
+  std::vector<int> ta(SIZE, 7), tb(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, ta);
+  hc::array_view<int, 1> b(SIZE, tb);
+  hc::array<int, 1> data(SIZE, view);
+  hc::array<int, 1> other(SIZE, view);
+  hc::array_view<int, 1> av(data);
+
+  hc::copy_async(a, data);
+  hc::parallel_for_each(view, data.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] += 1;
+  });
+  hc::copy_async(data, other);
+  hc::copy_async(other, b).wait();
+  bool ret = (b[0] == 8) && (tb[SIZE - 1] == 8);
+
+  hc::copy_async(a.section(0, 16), b.section(16, 16)).wait();
+  ret &= (b[15] == 8) && (b[16] == 7) && (b[31] == 7) && (b[32] == 8);
+  return ret;
+}
+
+// other copies complete before copy_async returns, errors are reported by the
+// completion_future
+bool test_eager(hc::accelerator_view& view) {
+  std::list<int> source(SIZE, 3);
+  std::vector<int> out(SIZE, 0);
+  hc::array<int, 1> data(SIZE, view);
+
+  hc::completion_future fut = hc::copy_async(source.begin(), source.end(), data);
+  bool ret = fut.valid();
+  fut.wait();
+  hc::copy(data, out.begin());
+  ret &= (out[0] == 3) && (out[SIZE - 1] == 3);
+
+  std::vector<int> small(16);
+  try {
+    hc::copy_async(small.begin(), small.end(), data).get();
+    ret = false;
+  } catch (...) {
+  }
+  return ret;
+}
+
+// synchronize_async brings the result of a kernel back to the host
+bool test_synchronize(hc::accelerator_view& view) {
+  std::vector<int> table(SIZE, 1);
+  hc::array_view<int, 1> av(SIZE, table);
+  hc::parallel_for_each(view, av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] *= 3;
+  });
+  hc::completion_future fut = av.synchronize_async();
+  fut.wait();
+  return fut.is_ready() && (table[0] == 3) && (table[SIZE - 1] == 3);
+}
+
+// a copy on one view completes while a kernel of another view is running
+bool test_overlap() {
+  hc::accelerator acc;
+  hc::accelerator_view compute = acc.create_view();
+  hc::accelerator_view copies = acc.create_view();
+  std::vector<int> tk(1024, 0), in(SIZE, 5), out(SIZE, 0);
+  hc::array_view<int, 1> k(1024, tk);
+  hc::array<int, 1> data(SIZE, copies);
+  std::atomic<int> flag(0);
+  auto p_flag = &flag;
+
+  hc::completion_future slow = hc::parallel_for_each(compute, k.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0)
+      wait_flag(p_flag, 2000);
+    k[idx] += 1;
+  });
+  hc::copy_async(in.begin(), in.end(), data);
+  hc::copy_async(data, out.begin()).wait();
+  bool ret = !slow.is_ready() && (out[SIZE - 1] == 5);
+
+  flag = 1;
+  slow.wait();
+  return ret && (k[0] == 1);
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator acc;
+  hc::accelerator_view in_order = acc.create_view();
+  hc::accelerator_view any_order = acc.create_view(hc::execute_any_order);
+
+  for (hc::accelerator_view* view : {&in_order, &any_order}) {
+    ret &= test_ordered(*view);
+    ret &= test_views(*view);
+    ret &= test_eager(*view);
+    ret &= test_synchronize(*view);
+    view->wait();
+  }
+  ret &= test_overlap();
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
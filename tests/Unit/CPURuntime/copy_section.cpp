@@ -0,0 +1,122 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <iostream>
+#include <list>
+#include <numeric>
+#include <vector>
+
+// check that copies of array_view sections on the CPU runtime, done row by
+// row with strided copies, move exactly the elements of the section
+
+#define ROWS (300)
+#define COLS (500)
+
+// value of element (i, j) of the initial data
+int at(int i, int j) { return i * COLS + j; }
+
+// sections to host memory, contiguous or not, and to arrays
+bool test_read(hc::array_view<int, 2> av, hc::accelerator_view& view) {
+  bool ret = true;
+  auto sec = av.section(hc::index<2>(10, 20), hc::extent<2>(50, 60));
+  std::vector<int> out(50 * 60);
+  std::list<int> lout(50 * 60);
+  hc::copy(sec, out.begin());
+  hc::copy(sec, lout.begin());
+  auto it = lout.begin();
+  for (int i = 0; i < 50; ++i)
+    for (int j = 0; j < 60; ++j, ++it)
+      ret &= (out[i * 60 + j] == at(10 + i, 20 + j)) && (*it == out[i * 60 + j]);
+
+  hc::array<int, 2> tile(50, 60, view);
+  hc::copy(sec, tile);
+  std::vector<int> tv(50 * 60);
+  hc::copy(tile, tv.begin());
+  ret &= (tv == out);
+  return ret;
+}
+
+// arrays and host memory to sections, elements around them are left alone
+bool test_write(hc::array_view<int, 2> av, hc::accelerator_view& view) {
+  std::vector<int> init(50 * 60, 3);
+  hc::array<int, 2> tile(50, 60, init.begin(), view);
+  hc::copy(tile, av.section(hc::index<2>(100, 200), hc::extent<2>(50, 60)));
+  bool ret = (av(100, 200) == 3) && (av(149, 259) == 3) &&
+             (av(100, 199) == at(100, 199)) && (av(149, 260) == at(149, 260)) &&
+             (av(150, 200) == at(150, 200));
+
+  std::list<int> lin(20 * 30, 7);
+  hc::copy(lin.begin(), lin.end(), av.section(hc::index<2>(1, 1), hc::extent<2>(20, 30)));
+  ret &= (av(1, 1) == 7) && (av(20, 30) == 7) && (av(0, 1) == at(0, 1)) &&
+         (av(21, 30) == at(21, 30)) && (av(20, 31) == at(20, 31));
+
+  std::vector<int> vin(20 * 30, 9);
+  hc::copy(vin.begin(), av.section(hc::index<2>(1, 1), hc::extent<2>(20, 30)));
+  ret &= (av(1, 1) == 9) && (av(20, 30) == 9) && (av(21, 30) == at(21, 30));
+  return ret;
+}
+
+// sections to sections, of another buffer or overlapping in the same one
+bool test_sections(hc::array_view<int, 2> av) {
+  std::vector<int> table(ROWS * COLS, 0);
+  hc::array_view<int, 2> hv(ROWS, COLS, table);
+  hc::copy(av.section(hc::index<2>(200, 100), hc::extent<2>(50, 60)),
+           hv.section(hc::index<2>(5, 5), hc::extent<2>(50, 60)));
+  bool ret = (hv(5, 5) == at(200, 100)) && (table[54 * COLS + 64] == at(249, 159)) &&
+             (table[4 * COLS + 5] == 0) && (table[54 * COLS + 65] == 0);
+
+  hc::copy(hv.section(hc::index<2>(5, 5), hc::extent<2>(50, 60)),
+           hv.section(hc::index<2>(0, 0), hc::extent<2>(50, 60)));
+  ret &= (hv(0, 0) == at(200, 100)) && (hv(49, 59) == at(249, 159)) &&
+         (hv(50, 60) == at(245, 155)) && (hv(55, 65) == 0);
+  return ret;
+}
+
+// sections of rank 3 and 4, the outer dimensions of the latter are walked by
+// hc::copy
+bool test_ranks(hc::accelerator_view& view) {
+  bool ret = true;
+  std::vector<int> init(6 * 7 * 8 * 9);
+  std::iota(init.begin(), init.end(), 0);
+
+  hc::array<int, 3> a3(hc::extent<3>(6, 7, 8), init.begin(), view);
+  hc::array_view<int, 3> v3(a3);
+  std::vector<int> o3(2 * 3 * 4);
+  hc::copy(v3.section(hc::index<3>(1, 2, 3), hc::extent<3>(2, 3, 4)), o3.begin());
+  int k = 0;
+  for (int i = 0; i < 2; ++i)
+    for (int j = 0; j < 3; ++j)
+      for (int l = 0; l < 4; ++l)
+        ret &= (o3[k++] == ((1 + i) * 7 + 2 + j) * 8 + 3 + l);
+
+  int ext[] = {6, 7, 8, 9}, base[] = {1, 2, 3, 4}, sub[] = {2, 3, 4, 5};
+  hc::array<int, 4> a4(hc::extent<4>(ext), init.begin(), view);
+  hc::array_view<int, 4> v4(a4);
+  std::vector<int> o4(2 * 3 * 4 * 5);
+  hc::copy(v4.section(hc::index<4>(base), hc::extent<4>(sub)), o4.begin());
+  k = 0;
+  for (int i = 0; i < 2; ++i)
+    for (int j = 0; j < 3; ++j)
+      for (int l = 0; l < 4; ++l)
+        for (int m = 0; m < 5; ++m)
+          ret &= (o4[k++] == (((1 + i) * 7 + 2 + j) * 8 + 3 + l) * 9 + 4 + m);
+  return ret;
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator_view view = hc::accelerator().get_default_view();
+  std::vector<int> init(ROWS * COLS);
+  std::iota(init.begin(), init.end(), 0);
+  hc::array<int, 2> data(ROWS, COLS, init.begin(), view);
+  hc::array_view<int, 2> av(data);
+
+  ret &= test_read(av, view);
+  ret &= test_sections(av);
+  ret &= test_write(av, view);
+  ret &= test_ranks(view);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,76 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <iostream>
+#include <vector>
+
+// test kernels recorded on views in queuing_mode_deferred, which are only
+// fused into a single pass in queuing_mode_deferred_elementwise
+
+#define SIZE (1024 * 1024)
+#define SHIFT (4096)
+
+// the second kernel reads the elements written by the first one at other
+// indices, which a fused pass over blocks of indices would not have written
+// yet
+bool test_shifted(hc::accelerator& acc) {
+  hc::accelerator_view view = acc.create_view(hc::execute_in_order, hc::queuing_mode_deferred);
+  std::vector<int> table_a(SIZE, 0);
+  std::vector<int> table_b(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, table_a);
+  hc::array_view<int, 1> b(SIZE, table_b);
+
+  hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    a[idx] = idx[0] + 1;
+  });
+  hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    b[idx] = a[(idx[0] + SHIFT) % SIZE];
+  });
+  view.wait();
+
+  b.synchronize();
+  for (int i = 0; i < SIZE; ++i) {
+    if (table_b[i] != (i + SHIFT) % SIZE + 1)
+      return false;
+  }
+  return true;
+}
+
+// element-wise kernels fused into a single pass
+bool test_elementwise(hc::accelerator& acc) {
+  hc::accelerator_view view = acc.create_view(hc::execute_in_order, hc::queuing_mode_deferred_elementwise);
+  std::vector<int> table_a(SIZE, 0);
+  std::vector<int> table_b(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, table_a);
+  hc::array_view<int, 1> b(SIZE, table_b);
+
+  hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    a[idx] = idx[0];
+  });
+  hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    a[idx] *= 3;
+  });
+  hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    b[idx] = a[idx] + 1;
+  });
+  view.wait();
+
+  b.synchronize();
+  for (int i = 0; i < SIZE; ++i) {
+    if (table_b[i] != i * 3 + 1)
+      return false;
+  }
+  return true;
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator acc;
+
+  ret &= test_shifted(acc);
+  ret &= test_elementwise(acc);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,192 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+
+#include <hc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// check that an accelerator_view created with execute_any_order on the CPU
+// runtime orders kernels by the buffers they use instead of the order they
+// were launched in, and that markers are synchronization points on views
+// executing in any order or in order
+
+#define SIZE (1024)
+
+// spin until @flag is set, at most @ms milliseconds
+bool wait_flag(std::atomic<int>* flag, int ms) {
+  auto start = std::chrono::steady_clock::now();
+  while (!flag->load()) {
+    if (std::chrono::steady_clock::now() - start > std::chrono::milliseconds(ms))
+      return false;
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+// the host does not wait for a kernel writing a buffer to launch another
+// one reading it, which still sees its result, nor for a kernel reading it
+// to launch one writing it
+bool test_dependencies(hc::accelerator_view& view) {
+  std::vector<int> ta(SIZE, 0), tb(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, ta);
+  hc::array_view<int, 1> b(SIZE, tb);
+  std::atomic<int> flag(0), seen(0);
+  auto p_flag = &flag;
+  auto p_seen = &seen;
+
+  hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0)
+      p_seen->store(wait_flag(p_flag, 2000));
+    a[idx] += 1;
+  });
+  hc::completion_future read = hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    b[idx] = a[idx] + 10;
+  });
+  hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    a[idx] += 1;
+  });
+  // the first kernel completes once the launches have returned
+  flag = 1;
+  read.wait();
+
+  bool ret = (seen == 1);
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (b[i] == 11) && (a[i] == 2);
+  return ret;
+}
+
+// kernels only reading a buffer may run in any order, those writing it wait
+// for them
+bool test_readers(hc::accelerator_view& view) {
+  std::vector<int> ta(SIZE, 5), tb(SIZE, 0), tc(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, ta);
+  hc::array_view<int, 1> b(SIZE, tb);
+  hc::array_view<int, 1> c(SIZE, tc);
+  for (int r = 0; r < 50; ++r) {
+    hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      b[idx] = a[idx] + 1;
+    });
+    hc::parallel_for_each(view, c.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      c[idx] = a[idx] + 2;
+    });
+    hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      a[idx] += 1;
+    });
+  }
+  view.wait();
+
+  bool ret = (view.get_pending_async_ops() == 0);
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (a[i] == 55) && (b[i] == 55) && (c[i] == 56);
+  return ret;
+}
+
+// a blocking marker waits for a kernel of another view, and the kernels
+// launched after it wait for the marker
+bool test_markers(hc::accelerator_view& view) {
+  std::vector<int> ta(SIZE, 0), tb(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, ta);
+  hc::array_view<int, 1> b(SIZE, tb);
+  hc::accelerator_view other = hc::accelerator().create_view();
+  std::atomic<int> flag(0);
+  auto p_flag = &flag;
+
+  hc::completion_future slow = hc::parallel_for_each(other, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0)
+      wait_flag(p_flag, 2000);
+    a[idx] += 1;
+  });
+  hc::completion_future marker = view.create_blocking_marker(slow);
+  hc::completion_future after = hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    b[idx] += 1;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  bool ret = !marker.is_ready() && !after.is_ready() && (view.get_pending_async_ops() == 2);
+
+  flag = 1;
+  after.wait();
+  ret &= marker.is_ready() && slow.is_ready();
+  other.wait();
+
+  // a marker is ready once the commands before it are
+  hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    b[idx] += 1;
+  });
+  view.create_marker().wait();
+  ret &= (view.get_pending_async_ops() == 0);
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (a[i] == 1) && (b[i] == 2);
+  return ret;
+}
+
+// a blocking marker on a kernel recorded on a view in queuing_mode_deferred
+// has it enqueued, no thread of the runtime waits for it
+bool test_deferred_dependency(hc::accelerator_view& view) {
+  std::vector<int> ta(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, ta);
+  hc::accelerator_view deferred = hc::accelerator().create_view(hc::execute_in_order, hc::queuing_mode_deferred);
+
+  hc::completion_future recorded = hc::parallel_for_each(deferred, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    a[idx] += 1;
+  });
+  hc::completion_future marker = view.create_blocking_marker(recorded);
+  bool ret = (marker.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+  ret &= recorded.is_ready();
+  view.wait();
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (a[i] == 1);
+  return ret;
+}
+
+// independent kernels run concurrently, each one waits for the other to start
+bool test_concurrent(hc::accelerator_view& view) {
+  std::vector<int> ta(SIZE, 0), tb(SIZE, 0);
+  hc::array_view<int, 1> a(SIZE, ta);
+  hc::array_view<int, 1> b(SIZE, tb);
+  std::atomic<int> started_a(0), started_b(0), overlap_a(0), overlap_b(0);
+  auto p_started_a = &started_a;
+  auto p_started_b = &started_b;
+  auto p_overlap_a = &overlap_a;
+  auto p_overlap_b = &overlap_b;
+
+  hc::parallel_for_each(view, a.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0) {
+      p_started_a->store(1);
+      p_overlap_a->store(wait_flag(p_started_b, 2000));
+    }
+    a[idx] += 1;
+  });
+  hc::parallel_for_each(view, b.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    if (idx[0] == 0) {
+      p_started_b->store(1);
+      p_overlap_b->store(wait_flag(p_started_a, 2000));
+    }
+    b[idx] += 1;
+  });
+  view.wait();
+  return overlap_a == 1 && overlap_b == 1;
+}
+
+int main() {
+  bool ret = true;
+  hc::accelerator_view view = hc::accelerator().create_view(hc::execute_any_order);
+
+  ret &= (view.get_execute_order() == hc::execute_any_order);
+  ret &= test_dependencies(view);
+  ret &= test_readers(view);
+  ret &= test_markers(view);
+  ret &= test_deferred_dependency(view);
+  // markers of a view executing in order are completed the same way
+  hc::accelerator_view in_order = hc::accelerator().create_view();
+  ret &= test_markers(in_order);
+  ret &= test_deferred_dependency(in_order);
+  // a single worker executes one kernel at a time
+  if (std::thread::hardware_concurrency() > 1)
+    ret &= test_concurrent(view);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
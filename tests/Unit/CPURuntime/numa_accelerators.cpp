@@ -0,0 +1,59 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_NUMA=ON %t.out
+
+#include <hc.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// test kernels launched on every CPU fallback accelerator, which are one per
+// NUMA node when HCC_CPU_NUMA=ON
+bool test_accelerator(hc::accelerator& acc) {
+  const int vecSize = 1 << 20;
+  hc::accelerator_view av = acc.get_default_view();
+
+  // storage is first touched by the workers of the accelerator
+  hc::array<int, 1> table(vecSize, av);
+  hc::parallel_for_each(av, table.get_extent(), [&](hc::index<1> idx) [[hc]] {
+    table[idx] = idx[0];
+  });
+  hc::parallel_for_each(av, table.get_extent().tile(256), [&](hc::tiled_index<1> tidx) [[hc]] {
+    table[tidx.global] += 1;
+  });
+
+  std::vector<int> result = table;
+  int error = 0;
+  for (int i = 0; i < vecSize; ++i)
+    error += (result[i] != i + 1);
+  return (error == 0);
+}
+
+// accelerators of other nodes than the first one are named after the sysfs id
+// of their node, which may differ from their position
+bool test_name(hc::accelerator& acc) {
+  std::wstring path = acc.get_device_path();
+  if (path == L"fallback")
+    return true;
+  std::wstring id = path.substr(path.find(L':') + 1);
+  std::ifstream node("/sys/devices/system/node/node" + std::string(id.begin(), id.end()) + "/cpulist");
+  return node && acc.get_description().find(L"node " + id + L")") != std::wstring::npos;
+}
+
+int main() {
+  bool ret = true;
+  int count = 0;
+
+  for (auto& acc : hc::accelerator::get_all()) {
+    if (acc.get_device_path().compare(0, 8, L"fallback") != 0)
+      continue;
+    ret &= test_accelerator(acc);
+    ret &= test_name(acc);
+    ++count;
+  }
+  ret &= (count > 0);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
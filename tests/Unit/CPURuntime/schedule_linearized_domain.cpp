@@ -0,0 +1,97 @@
+// RUN: %hc_cpu %s -o %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=STATIC %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=DYNAMIC %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=GUIDED %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_SCHEDULE=DYNAMIC HCC_CPU_GRAIN=7 %t.out
+
+#include <hc.hpp>
+
+#include <iostream>
+#include <vector>
+
+// test that every work-item of the linearized compute domain is executed
+// exactly once on CPU path, regardless of the scheduling policy
+
+bool test_2d() {
+  // a narrow first dimension used to limit the parallelism of CPU kernels
+  const int dim0 = 3;
+  const int dim1 = 100003;
+  std::vector<int> table(dim0 * dim1, 0);
+  hc::array_view<int, 2> av(dim0, dim1, table);
+
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<2> idx) [[hc]] {
+    av[idx] += idx[0] * dim1 + idx[1] + 1;
+  });
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < dim0 * dim1; ++i)
+    error += (table[i] != i + 1);
+  return (error == 0);
+}
+
+bool test_3d() {
+  const int dim0 = 5, dim1 = 7, dim2 = 11;
+  std::vector<int> table(dim0 * dim1 * dim2, 0);
+  hc::array_view<int, 3> av(dim0, dim1, dim2, table);
+
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<3> idx) [[hc]] {
+    av[idx] += (idx[0] * dim1 + idx[1]) * dim2 + idx[2] + 1;
+  });
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < dim0 * dim1 * dim2; ++i)
+    error += (table[i] != i + 1);
+  return (error == 0);
+}
+
+bool test_tiled_2d() {
+  const int dim0 = 16, dim1 = 48;
+  std::vector<int> table(dim0 * dim1, 0);
+  hc::array_view<int, 2> av(dim0, dim1, table);
+
+  hc::parallel_for_each(av.get_extent().tile(4, 8), [=](hc::tiled_index<2> tidx) [[hc]] {
+    tile_static int lds[4][8];
+    lds[tidx.local[0]][tidx.local[1]] = tidx.tile[0] * (dim1 / 8) + tidx.tile[1];
+    tidx.barrier.wait();
+    av[tidx.global] += lds[3 - tidx.local[0]][7 - tidx.local[1]] + 1;
+  });
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < dim0; ++i)
+    for (int j = 0; j < dim1; ++j)
+      error += (table[i * dim1 + j] != (i / 4) * (dim1 / 8) + (j / 8) + 1);
+  return (error == 0);
+}
+
+bool test_tiled_3d() {
+  const int dim0 = 4, dim1 = 8, dim2 = 12;
+  std::vector<int> table(dim0 * dim1 * dim2, 0);
+  hc::array_view<int, 3> av(dim0, dim1, dim2, table);
+
+  hc::parallel_for_each(av.get_extent().tile(2, 4, 4), [=](hc::tiled_index<3> tidx) [[hc]] {
+    av[tidx.global] += (tidx.tile[0] * (dim1 / 4) + tidx.tile[1]) * (dim2 / 4) + tidx.tile[2] + 1;
+  });
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < dim0; ++i)
+    for (int j = 0; j < dim1; ++j)
+      for (int k = 0; k < dim2; ++k)
+        error += (table[(i * dim1 + j) * dim2 + k] != ((i / 2) * (dim1 / 4) + (j / 4)) * (dim2 / 4) + (k / 4) + 1);
+  return (error == 0);
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_2d();
+  ret &= test_3d();
+  ret &= test_tiled_2d();
+  ret &= test_tiled_3d();
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,172 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU HCC_STAGING_POOL_SIZE=1 %t.out
+
+#include <hc.hpp>
+#include <kalmar_runtime.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// test the pool of host buffers staging transfers to and from a device, with
+// allocation functions keeping track of the buffers they hand out
+
+#define KB (1024)
+#define MB (1024 * 1024)
+
+struct Allocator {
+  std::mutex mutex;
+  std::set<void*> live;
+  int allocated = 0;
+
+  Kalmar::KalmarStagingPool* make(size_t limit) {
+    return new Kalmar::KalmarStagingPool(
+      [this](size_t count) {
+        void* p = malloc(count);
+        std::lock_guard<std::mutex> lck(mutex);
+        live.insert(p);
+        ++allocated;
+        return p;
+      },
+      [this](void* p) {
+        {
+          std::lock_guard<std::mutex> lck(mutex);
+          live.erase(p);
+        }
+        free(p);
+      }, limit);
+  }
+};
+
+// requests are rounded up to powers of two from 4 KB to 64 MB
+bool test_classes() {
+  typedef Kalmar::KalmarStagingPool Pool;
+  return Pool::size_class(1) == 0 && Pool::size_class(4 * KB) == 0 &&
+         Pool::size_class(4 * KB + 1) == 1 && Pool::class_size(1) == 8 * KB &&
+         Pool::size_class(64 * MB) == Pool::classes - 1 &&
+         Pool::size_class(64 * MB + 1) == -1;
+}
+
+// a released buffer serves the next request of its class, larger requests
+// are not kept
+bool test_reuse() {
+  Allocator a;
+  Kalmar::KalmarStagingPool* pool = a.make(64 * MB);
+  void* p = pool->acquire(10000);
+  pool->release(p, 10000);
+  void* q = pool->acquire(12000);
+  void* r = pool->acquire(12000);
+  bool ret = q == p && r != p;
+  Kalmar::KalmarStagingPool::Stats stats = pool->get_stats();
+  ret &= stats.hits == 1 && stats.misses == 2 && stats.in_use == 32 * KB &&
+         stats.cached == 0;
+  pool->release(q, 12000);
+  pool->release(r, 12000);
+
+  void* big = pool->acquire(65 * MB);
+  ret &= pool->get_stats().high_water == 65 * MB;
+  pool->release(big, 65 * MB);
+  ret &= a.live.count(big) == 0 && pool->get_stats().cached == 32 * KB;
+  delete pool;
+  return ret && a.live.empty();
+}
+
+// the pool keeps at most its limit of released buffers
+bool test_limit() {
+  Allocator a;
+  Kalmar::KalmarStagingPool* pool = a.make(64 * KB);
+  std::vector<void*> held;
+  for (int i = 0; i < 4; ++i)
+    held.push_back(pool->acquire(32 * KB));
+  for (void* p : held)
+    pool->release(p, 32 * KB);
+  Kalmar::KalmarStagingPool::Stats stats = pool->get_stats();
+  bool ret = stats.cached == 64 * KB && stats.trimmed == 2 && a.live.size() == 2;
+  delete pool;
+  return ret && a.live.empty();
+}
+
+// buffers beyond the high-water mark since the previous trim are freed
+bool test_trim() {
+  Allocator a;
+  Kalmar::KalmarStagingPool* pool = a.make(64 * MB);
+  std::vector<void*> held;
+  for (int i = 0; i < 8; ++i)
+    held.push_back(pool->acquire(4 * KB));
+  for (void* p : held)
+    pool->release(p, 4 * KB);
+  pool->trim();
+  bool ret = pool->get_stats().cached == 32 * KB;
+
+  // a single buffer has been needed since, the others are freed
+  pool->release(pool->acquire(4 * KB), 4 * KB);
+  pool->trim();
+  ret &= pool->get_stats().cached == 4 * KB && a.live.size() == 1;
+
+  // trimmed every few releases without calling trim
+  pool->release(pool->acquire(MB), MB);
+  for (uint64_t i = 0; i < Kalmar::KalmarStagingPool::trimPeriod; ++i)
+    pool->release(pool->acquire(4 * KB), 4 * KB);
+  ret &= pool->get_stats().cached == 4 * KB && a.allocated == 9;
+  delete pool;
+  return ret && a.live.empty();
+}
+
+// threads never get the same buffer at once
+bool test_threads() {
+  Allocator a;
+  Kalmar::KalmarStagingPool* pool = a.make(MB);
+  std::vector<std::thread> threads;
+  std::vector<int> ok(8, 1);
+  for (int t = 0; t < 8; ++t) {
+    threads.push_back(std::thread([&, t] {
+      for (int i = 0; i < 1000; ++i) {
+        size_t count = (1 + (i * 7 + t) % 64) * KB;
+        char* p = static_cast<char*>(pool->acquire(count));
+        memset(p, t, count);
+        std::this_thread::yield();
+        for (size_t j = 0; j < count; j += 512)
+          ok[t] &= p[j] == t;
+        pool->release(p, count);
+      }
+    }));
+  }
+  for (auto& th : threads)
+    th.join();
+  Kalmar::KalmarStagingPool::Stats stats = pool->get_stats();
+  bool ret = stats.in_use == 0 && stats.cached <= MB &&
+             stats.hits + stats.misses == 8000 && stats.misses == a.allocated &&
+             a.live.size() == a.allocated - stats.trimmed;
+  for (int v : ok)
+    ret &= v == 1;
+  delete pool;
+  return ret && a.live.empty();
+}
+
+// each device has a pool, limited by HCC_STAGING_POOL_SIZE in MB
+bool test_device() {
+  Kalmar::KalmarDevice* dev = Kalmar::getContext()->getDevice(L"cpu");
+  Kalmar::KalmarStagingPool& pool = dev->get_staging_pool();
+  void* p = pool.acquire(100 * KB);
+  pool.release(p, 100 * KB);
+  void* q = pool.acquire(128 * KB);
+  pool.release(q, 128 * KB);
+  return Kalmar::KalmarStagingPool::DetermineLimit() == MB && pool.get_limit() == MB && q == p;
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_classes();
+  ret &= test_reuse();
+  ret &= test_limit();
+  ret &= test_trim();
+  ret &= test_threads();
+  ret &= test_device();
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
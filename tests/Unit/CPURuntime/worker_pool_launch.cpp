@@ -0,0 +1,61 @@
+// RUN: %hc_cpu %s -o %t.out && HCC_RUNTIME=CPU %t.out
+// RUN: HCC_RUNTIME=CPU HCC_CPU_TILE_STACK_SIZE=65536 %t.out
+
+#include <hc.hpp>
+
+#include <iostream>
+#include <vector>
+
+// test many back-to-back kernel launches on CPU path, which are executed by
+// the persistent worker threads of the CPU runtime
+#define LAUNCH_COUNT (1000)
+
+bool test_flat() {
+  const int vecSize = 64;
+  std::vector<int> table(vecSize, 0);
+  hc::array_view<int, 1> av(vecSize, table);
+
+  for (int i = 0; i < LAUNCH_COUNT; ++i) {
+    hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      av[idx] += idx[0];
+    });
+  }
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < vecSize; ++i)
+    error += (table[i] != i * LAUNCH_COUNT);
+  return (error == 0);
+}
+
+bool test_tiled() {
+  const int vecSize = 256;
+  const int tileSize = 16;
+  std::vector<int> table(vecSize, 1);
+  hc::array_view<int, 1> av(vecSize, table);
+
+  for (int i = 0; i < LAUNCH_COUNT; ++i) {
+    hc::parallel_for_each(av.get_extent().tile(tileSize), [=](hc::tiled_index<1> tidx) [[hc]] {
+      tile_static int lds[tileSize];
+      lds[tidx.local[0]] = av[tidx.global[0]];
+      tidx.barrier.wait();
+      av[tidx.global[0]] = lds[tileSize - 1 - tidx.local[0]] + 1;
+    });
+  }
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < vecSize; ++i)
+    error += (table[i] != 1 + LAUNCH_COUNT);
+  return (error == 0);
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_flat();
+  ret &= test_tiled();
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,99 @@
+// RUN: %hc %s -o %t.out && %t.out
+// RUN: %hc_cpu %s -o %t_cpu.out && HCC_RUNTIME=CPU %t_cpu.out
+
+#include <hc.hpp>
+
+#include <iostream>
+#include <vector>
+
+// test coherence of array_view sections, which only synchronize the range
+// of the buffer they span
+#define ROWS (1024)
+#define COLS (256)
+#define STEPS (16)
+
+bool test_section_steps() {
+  std::vector<int> table(ROWS * COLS, 0);
+  hc::array_view<int, 2> av(ROWS, COLS, table);
+
+  // make the whole buffer resident on the accelerator
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<2> idx) [[hc]] {
+    av[idx] = idx[0];
+  });
+
+  // update a band of two rows per step, then synchronize the whole view
+  for (int step = 0; step < STEPS; ++step) {
+    hc::array_view<int, 2> band = av.section(hc::index<2>(step * 4, 0), hc::extent<2>(2, COLS));
+    hc::parallel_for_each(band.get_extent(), [=](hc::index<2> idx) [[hc]] {
+      band[idx] += 1000;
+    });
+    av.synchronize();
+  }
+
+  int error = 0;
+  for (int i = 0; i < ROWS; ++i) {
+    int expected = i + ((i < STEPS * 4 && i % 4 < 2) ? 1000 : 0);
+    for (int j = 0; j < COLS; ++j)
+      error += (table[i * COLS + j] != expected);
+  }
+  return (error == 0);
+}
+
+bool test_host_section_write() {
+  std::vector<int> table(ROWS * COLS, 1);
+  hc::array_view<int, 2> av(ROWS, COLS, table);
+
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<2> idx) [[hc]] {
+    av[idx] += 1;
+  });
+
+  // modify one row on host, the rest of the buffer stays on the accelerator
+  hc::array_view<int, 2> row = av.section(hc::index<2>(ROWS / 2, 0), hc::extent<2>(1, COLS));
+  for (int j = 0; j < COLS; ++j)
+    row(0, j) = 100;
+
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<2> idx) [[hc]] {
+    av[idx] += 1;
+  });
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < ROWS; ++i) {
+    int expected = (i == ROWS / 2) ? 101 : 3;
+    for (int j = 0; j < COLS; ++j)
+      error += (table[i * COLS + j] != expected);
+  }
+  return (error == 0);
+}
+
+bool test_discard_section() {
+  std::vector<int> table(ROWS * COLS, 5);
+  hc::array_view<int, 2> av(ROWS, COLS, table);
+
+  // a discarded section is overwritten without being read back
+  hc::array_view<int, 2> band = av.section(hc::index<2>(0, 0), hc::extent<2>(ROWS / 2, COLS));
+  band.discard_data();
+  hc::parallel_for_each(band.get_extent(), [=](hc::index<2> idx) [[hc]] {
+    band[idx] = 7;
+  });
+  av.synchronize();
+
+  int error = 0;
+  for (int i = 0; i < ROWS; ++i) {
+    int expected = (i < ROWS / 2) ? 7 : 5;
+    for (int j = 0; j < COLS; ++j)
+      error += (table[i * COLS + j] != expected);
+  }
+  return (error == 0);
+}
+
+int main() {
+  bool ret = true;
+
+  ret &= test_section_steps();
+  ret &= test_host_section_write();
+  ret &= test_discard_section();
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
@@ -0,0 +1,46 @@
+// RUN: %hc %s -o %t.out && %t.out
+
+#include <hc.hpp>
+
+#include <iostream>
+#include <vector>
+
+#define SIZE (1024 * 1024)
+#define LOOP_COUNT (1024)
+
+// test dependent kernels whose arguments are laid out once per functor type
+// and pushed at once, see KernelArgLayout
+// The second kernel must wait for the first one through the buffers both of
+// them write, although none of them is pushed by KalmarQueue::Push.
+int main() {
+  bool ret = true;
+
+  std::vector<int> table(SIZE);
+  hc::array_view<int, 1> av(SIZE, table);
+
+  for (int iter = 0; iter < 8 && ret; ++iter) {
+    // a slow kernel writing the buffer
+    hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      int v = 0;
+      for (int i = 0; i < LOOP_COUNT; ++i)
+        v += (i == idx[0] % LOOP_COUNT);
+      av[idx] = iter + v;
+    });
+    // a fast kernel updating it, launched without waiting for the first one
+    hc::completion_future fut = hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+      av[idx] *= 2;
+    });
+    fut.wait();
+
+    av.synchronize();
+    for (int i = 0; i < SIZE; ++i) {
+      if (table[i] != (iter + 1) * 2) {
+        ret = false;
+        break;
+      }
+    }
+  }
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}
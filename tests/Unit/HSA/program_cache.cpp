@@ -0,0 +1,54 @@
+// RUN: %hc %s -o %t.out && rm -rf %t.cache && HCC_CACHE_DIR=%t.cache %t.out && HCC_CACHE_DIR=%t.cache %t.out
+
+#include <hc.hpp>
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+
+// test the id of the embedded kernel program, which keys the on-disk code
+// cache: a second process finds the code objects the first one stored, so
+// it adds no entry
+// Runtimes which do not finalize at load time store nothing, the number of
+// entries then stays 0.
+
+#define SIZE (1024)
+
+// number of entries in the cache directory
+int count_entries() {
+  int count = 0;
+  DIR* dir = opendir(getenv("HCC_CACHE_DIR"));
+  if (!dir)
+    return 0;
+  while (struct dirent* ent = readdir(dir)) {
+    std::string name(ent->d_name);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bin") == 0)
+      ++count;
+  }
+  closedir(dir);
+  return count;
+}
+
+int main() {
+  bool ret = true;
+  const int before = count_entries();
+
+  std::vector<int> table(SIZE, 0);
+  hc::array_view<int, 1> av(SIZE, table);
+  hc::parallel_for_each(av.get_extent(), [=](hc::index<1> idx) [[hc]] {
+    av[idx] = idx[0] * 2;
+  }).wait();
+  av.synchronize();
+  for (int i = 0; i < SIZE; ++i)
+    ret &= (table[i] == i * 2);
+
+  // the first process starts with an empty cache
+  const int after = count_entries();
+  ret &= (before == 0 || after == before);
+
+  std::cout << (ret ? "Verify success!\n" : "Verify failed!\n");
+  return !(ret == true);
+}